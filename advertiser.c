@@ -0,0 +1,340 @@
+/**
+ * Bluetooth Low Energy advertiser
+ * for the Nordic Semiconductor nRF51 series
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ *
+ * Every advertising event sends the PDU on channels 37, 38 and 39.
+ * The channels are switched from within the radio's send callback,
+ * so an event is a single burst without CPU involvement in between
+ * and the CPU may sleep until the timer starts the next event.
+ *
+ * Scannable (ADV_SCAN_IND) and connectable (ADV_IND) PDUs are followed
+ * by a receive window on the same channel. For these events the advertiser
+ * operates the radio from its interrupt (radio_set_event_handler()):
+ * the DISABLED_RXEN shortcut turns the radio around after the
+ * transmission, DISABLED_TXEN after the request. The request is validated
+ * while the transmitter ramps up (130 us), and the PACKETPTR is pointed
+ * at the pre-built SCAN_RSP before START, which the radio issues
+ * T_IFS (150 us) after the request ended. Anything else aborts the
+ * ramp-up with DISABLE.
+ */
+
+#include "advertiser.h"
+
+static const uint8_t channels[] = {37, 38, 39};
+
+static const uint8_t *adv_pdu;
+static uint32_t adv_interval;
+static volatile uint8_t adv_index;
+static volatile bool adv_running = false;
+static int8_t adv_timer = -1;
+
+// receive window after ADV_IND and ADV_SCAN_IND
+#define STATE_TX            0   // advertising PDU on air
+#define STATE_LISTEN        1   // waiting for a request
+#define STATE_RESPOND       2   // SCAN_RSP on air
+#define STATE_NEXT          3   // ramp-up aborted, continue on the next channel
+#define STATE_CONNECT       4   // CONNECT_REQ received
+
+static const uint8_t *scan_rsp = NULL;
+static advertiser_connect_callback_t connect_callback = NULL;
+static volatile uint8_t state;
+static uint8_t request[RADIO_PDU_MAX];
+static int8_t listen_timer = -1;
+static volatile uint32_t scan_responses = 0;
+
+static void advertiser_event();
+
+/**
+ * advDelay from the hardware random number generator
+ */
+static uint32_t advertiser_delay()
+{
+    return (rng_get_byte() * ADVERTISER_DELAY_MAX) / 255;
+}
+
+/**
+ * Whether the current PDU invites requests, which we answer
+ */
+static bool advertiser_listens()
+{
+    switch (RADIO_PDU_TYPE(adv_pdu))
+    {
+        case RADIO_PDU_TYPE_ADV_IND:
+            return (scan_rsp != NULL) || (connect_callback != NULL);
+        case RADIO_PDU_TYPE_ADV_SCAN_IND:
+            return (scan_rsp != NULL);
+    }
+    return false;
+}
+
+/**
+ * Send the PDU on the current channel, followed by a receive window
+ */
+static void advertiser_transmit()
+{
+    radio_set_channel(channels[adv_index]);
+
+    RADIO_EVENT_DISABLED = 0;
+    RADIO_SHORTS = RADIO_SHORTCUT_READY_START
+                 | RADIO_SHORTCUT_END_DISABLE
+                 | RADIO_SHORTCUT_DISABLED_RXEN;
+
+    // radio_send() of a previous event has left the END interrupt enabled
+    RADIO_INTENCLR = ~0;
+    RADIO_INTENSET = RADIO_INTERRUPT_DISABLED;
+
+    state = STATE_TX;
+    RADIO_PACKETPTR = (uint32_t) adv_pdu;
+    radio_latency_mark();
+    RADIO_TASK_TXEN = 1;
+}
+
+/**
+ * Continue on the next channel or schedule the next advertising event
+ */
+static void advertiser_next()
+{
+    if (++adv_index < sizeof(channels))
+    {
+        advertiser_transmit();
+        return;
+    }
+
+    RADIO_SHORTS = 0;
+    RADIO_INTENCLR = RADIO_INTERRUPT_DISABLED;
+    timer_start(adv_timer, adv_interval + advertiser_delay(), advertiser_event);
+}
+
+/**
+ * Whether the received PDU is a request of the given type addressed to us
+ */
+static bool advertiser_addressed(uint8_t type, uint8_t length)
+{
+    // the RxAdd bit of the request must match the TxAdd bit of our PDU
+    return RADIO_CRCSTATUS
+        && RADIO_PDU_TYPE(request) == type
+        && request[1] == length
+        && ((request[0] & RADIO_PDU_RXADD) != 0) == ((adv_pdu[0] & RADIO_PDU_TXADD) != 0)
+        && memcmp(&request[2 + ADVERTISER_ADDRESS_LENGTH], &adv_pdu[2], ADVERTISER_ADDRESS_LENGTH) == 0;
+}
+
+/**
+ * Timer callback: the receive window is over
+ */
+static void advertiser_listen_timeout()
+{
+    // a request is being received, its DISABLED event follows
+    if (state != STATE_LISTEN || RADIO_EVENT_ADDRESS)
+        return;
+
+    state = STATE_NEXT;
+    RADIO_SHORTS = 0;
+    RADIO_TASK_DISABLE = 1;
+}
+
+/**
+ * Radio interrupt handler during listening advertising events
+ */
+static void advertiser_radio_event()
+{
+    if (!RADIO_EVENT_DISABLED)
+        return;
+    RADIO_EVENT_DISABLED = 0;
+
+    switch (state)
+    {
+        case STATE_TX:
+            // the receiver is ramping up already
+            RADIO_EVENT_ADDRESS = 0;
+            RADIO_PACKETPTR = (uint32_t) request;
+            RADIO_SHORTS = RADIO_SHORTCUT_READY_START
+                         | RADIO_SHORTCUT_END_DISABLE
+                         | RADIO_SHORTCUT_DISABLED_TXEN;
+            state = STATE_LISTEN;
+            timer_start(listen_timer, ADVERTISER_LISTEN_WINDOW, advertiser_listen_timeout);
+            break;
+
+        case STATE_LISTEN:
+            // a packet was received and the transmitter is ramping up
+            timer_stop(listen_timer);
+            if (scan_rsp != NULL && advertiser_addressed(RADIO_PDU_TYPE_SCAN_REQ, ADVERTISER_SCAN_REQ_LENGTH))
+            {
+                RADIO_PACKETPTR = (uint32_t) scan_rsp;
+                RADIO_SHORTS = RADIO_SHORTCUT_READY_START
+                             | RADIO_SHORTCUT_END_DISABLE;
+                state = STATE_RESPOND;
+                break;
+            }
+
+            RADIO_SHORTS = 0;
+            RADIO_TASK_DISABLE = 1;
+            if (connect_callback != NULL
+             && RADIO_PDU_TYPE(adv_pdu) == RADIO_PDU_TYPE_ADV_IND
+             && advertiser_addressed(RADIO_PDU_TYPE_CONNECT_REQ, ADVERTISER_CONNECT_REQ_LENGTH))
+                state = STATE_CONNECT;
+            else
+                state = STATE_NEXT;
+            break;
+
+        case STATE_RESPOND:
+            scan_responses++;
+            advertiser_next();
+            break;
+
+        case STATE_NEXT:
+            advertiser_next();
+            break;
+
+        case STATE_CONNECT:
+            // advertising ends with the connection
+            adv_running = false;
+            RADIO_INTENCLR = RADIO_INTERRUPT_DISABLED;
+            radio_set_event_handler(NULL);
+            connect_callback(request);
+            break;
+    }
+}
+
+/**
+ * Timer callback: begin an advertising event on the first channel
+ */
+static void advertiser_event()
+{
+    if (!adv_running)
+        return;
+
+    adv_index = 0;
+
+    // the radio is idle between events, so the interrupt may change hands
+    if (advertiser_listens())
+    {
+        radio_set_event_handler(advertiser_radio_event);
+        advertiser_transmit();
+        return;
+    }
+
+    radio_set_event_handler(NULL);
+    radio_set_channel(channels[0]);
+    radio_send(adv_pdu, 0);
+}
+
+/**
+ * Radio send callback: continue on the next channel
+ * or schedule the next advertising event
+ */
+static void advertiser_sent(bool active)
+{
+    (void) active;
+
+    if (!adv_running)
+        return;
+
+    if (++adv_index < sizeof(channels))
+    {
+        radio_set_channel(channels[adv_index]);
+        radio_send(adv_pdu, 0);
+        return;
+    }
+
+    timer_start(adv_timer, adv_interval + advertiser_delay(), advertiser_event);
+}
+
+void advertiser_init()
+{
+    if (adv_timer < 0)
+    {
+        timer_init();
+        adv_timer = timer_create(TIMER_SINGLESHOT);
+        listen_timer = timer_create(TIMER_SINGLESHOT);
+    }
+
+    rng_init();
+}
+
+/**
+ * Start advertising the given PDU (header, length, payload)
+ * every interval_us microseconds plus advDelay
+ *
+ * The radio must be initialized. Its callbacks are taken over until advertiser_stop().
+ */
+bool advertiser_start(const uint8_t *pdu, uint32_t interval_us)
+{
+    if (adv_timer < 0 || listen_timer < 0)
+        return false;
+
+    if (interval_us < ADVERTISER_INTERVAL_MIN || interval_us > ADVERTISER_INTERVAL_MAX)
+        return false;
+
+    if ((RADIO_PDU_TYPE(pdu) == RADIO_PDU_TYPE_ADV_SCAN_IND
+      || RADIO_PDU_TYPE(pdu) == RADIO_PDU_TYPE_ADV_NONCONN_IND)
+     && interval_us < ADVERTISER_INTERVAL_MIN_NONCONN)
+        return false;
+
+    if (!radio_prepare(channels[0], RADIO_ADVERTISING_ACCESS_ADDRESS, RADIO_ADVERTISING_CRCINIT))
+        return false;
+
+    adv_pdu = pdu;
+    adv_interval = interval_us;
+    adv_running = true;
+
+    radio_set_callbacks(NULL, advertiser_sent);
+
+    advertiser_event();
+
+    return true;
+}
+
+/**
+ * Exchange the advertised PDU;
+ * takes effect with the next advertising event
+ *
+ * The interval is not checked again, ADV_SCAN_IND and ADV_NONCONN_IND
+ * require at least ADVERTISER_INTERVAL_MIN_NONCONN.
+ */
+void advertiser_set_pdu(const uint8_t *pdu)
+{
+    adv_pdu = pdu;
+}
+
+/**
+ * Answer SCAN_REQs to ADV_IND and ADV_SCAN_IND PDUs with the given
+ * SCAN_RSP (header, length, AdvA and up to 31 bytes of scan response data);
+ * NULL ignores them. Takes effect with the next advertising event.
+ */
+void advertiser_set_scan_response(const uint8_t *pdu)
+{
+    scan_rsp = pdu;
+}
+
+/**
+ * Accept CONNECT_REQs to ADV_IND PDUs
+ *
+ * Advertising stops upon a CONNECT_REQ, and the callback is invoked
+ * from the radio interrupt a few microseconds after it ended,
+ * with the PDU (header, length, payload). NULL ignores them.
+ */
+void advertiser_set_connect_callback(advertiser_connect_callback_t callback)
+{
+    connect_callback = callback;
+}
+
+/**
+ * Number of SCAN_RSPs sent since advertiser_init()
+ */
+uint32_t advertiser_get_scan_response_count()
+{
+    return scan_responses;
+}
+
+void advertiser_stop()
+{
+    adv_running = false;
+    timer_stop(adv_timer);
+    timer_stop(listen_timer);
+    radio_stop();
+    radio_set_event_handler(NULL);
+    radio_set_callbacks(NULL, NULL);
+}
@@ -0,0 +1,60 @@
+/**
+ * Bluetooth Low Energy advertiser
+ * for the Nordic Semiconductor nRF51 series
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ *
+ * Requires:
+ *      Radio library
+ *      Timer library
+ *      Random Number Generator (RNG) library
+ */
+
+#ifndef ADVERTISER_H
+#define ADVERTISER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "radio.h"
+#include "timers.h"
+#include "random.h"
+
+/*
+ * Link Layer specification section 4.4.2.2, Core 4.1, page 2528
+ */
+
+// advInterval: 20 ms up to 10.24 s
+#define ADVERTISER_INTERVAL_MIN         TIMER_MILLIS(20)
+#define ADVERTISER_INTERVAL_MAX         TIMER_MILLIS(10240)
+
+// ... but at least 100 ms for ADV_SCAN_IND and ADV_NONCONN_IND
+#define ADVERTISER_INTERVAL_MIN_NONCONN TIMER_MILLIS(100)
+
+// advDelay: pseudo-random value within 0-10 ms
+#define ADVERTISER_DELAY_MAX            TIMER_MILLIS(10)
+
+/*
+ * How long to listen for a SCAN_REQ or CONNECT_REQ after every ADV_IND
+ * or ADV_SCAN_IND, counted from the end of the transmission:
+ * T_IFS (150 us) plus preamble and access address (40 us) plus margin
+ */
+#define ADVERTISER_LISTEN_WINDOW        220
+
+// AdvA within the payload, ScanA/InitA and AdvA in requests
+#define ADVERTISER_ADDRESS_LENGTH       6
+#define ADVERTISER_SCAN_REQ_LENGTH     (2 * ADVERTISER_ADDRESS_LENGTH)
+#define ADVERTISER_CONNECT_REQ_LENGTH   34
+
+typedef void (*advertiser_connect_callback_t) (const uint8_t *connect_req);
+
+void advertiser_init();
+bool advertiser_start(const uint8_t *pdu, uint32_t interval_us);
+void advertiser_set_pdu(const uint8_t *pdu);
+void advertiser_set_scan_response(const uint8_t *scan_rsp);
+void advertiser_set_connect_callback(advertiser_connect_callback_t callback);
+uint32_t advertiser_get_scan_response_count();
+void advertiser_stop();
+
+#endif
@@ -15,7 +15,9 @@
 #include <stdint.h>
 
 
+#ifndef CLOCK_BASE
 #define CLOCK_BASE                  0x40000000
+#endif
 
 // Tasks
 #define CLOCK_TASK_HFCLKSTART       (*(volatile uint32_t*) (CLOCK_BASE+0x000))    // Start HFCLK crystal oscillator
@@ -0,0 +1,538 @@
+/**
+ * Bluetooth Low Energy link layer connection, slave (peripheral) role
+ * for the Nordic Semiconductor nRF51 series
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ *
+ * Every connection event is started by hardware: CONNECTION_TIMER
+ * compares against the start time and triggers RXEN through PPI,
+ * so interrupt latency does not affect the timing. The receiver is enabled
+ * early by the window widening (both sleep clock accuracies times the time
+ * since the last anchor point) and listens until the widening has passed
+ * again. The ADDRESS of the master's first packet is captured into the
+ * timer and becomes the anchor point, from which the next event is scheduled.
+ *
+ * The TIMER is only 16 bit wide: starts further than 65 ms away are
+ * reached by counting compare matches ("laps") in its interrupt and
+ * connecting the PPI channel only for the last one.
+ *
+ * Within an event the radio is turned around by the DISABLED_TXEN and
+ * DISABLED_RXEN shortcuts. The response is chosen upon the master's
+ * SN and NESN, while the transmitter ramps up (see advertiser.c).
+ *
+ * The channels are selected by hopping.c. Of the LL control procedures
+ * only the channel map update is handled here, which allows the master
+ * to move the link away from polluted channels (see hopping_assess()).
+ *
+ * Not implemented: slave latency (every event is attended),
+ * and the other LL control procedures; their PDUs are passed
+ * to the application like data.
+ */
+
+#include "connection.h"
+
+#if CONNECTION_TX_QUEUE_SIZE & (CONNECTION_TX_QUEUE_SIZE - 1)
+#error "CONNECTION_TX_QUEUE_SIZE must be a power of two"
+#endif
+
+// capture/compare registers of CONNECTION_TIMER
+#define CC_START            0   // compare: RXEN via PPI
+#define CC_ADDRESS          1   // capture: ADDRESS of the last packet
+#define CC_END              2   // capture: END of the last packet
+#define CC_TIMEOUT          3   // compare: the receive window is over
+
+/*
+ * LLData of a CONNECT_REQ, offsets within the PDU (header and length first)
+ * Link Layer specification section 2.3.3.1, Core 4.1, page 2512
+ */
+#define LLDATA_AA           14
+#define LLDATA_CRCINIT      18
+#define LLDATA_WINSIZE      21
+#define LLDATA_WINOFFSET    22
+#define LLDATA_INTERVAL     24
+#define LLDATA_LATENCY      26
+#define LLDATA_TIMEOUT      28
+#define LLDATA_CHM          30
+#define LLDATA_HOP          35
+
+/*
+ * LL_CHANNEL_MAP_REQ, offsets within the PDU
+ * Link Layer specification section 2.4.2, Core 4.1, page 2517
+ */
+#define LL_CHANNEL_MAP_REQ      0x01
+#define CTRDATA_OPCODE          2
+#define CTRDATA_CHM             3
+#define CTRDATA_INSTANT         8
+#define CTRDATA_CHANNEL_MAP_LENGTH  8
+
+#define le16(p)            ((uint16_t) ((p)[0] | ((p)[1] << 8)))
+
+// transmitWindowDelay
+#define WINDOW_DELAY_US     1250
+
+#define STATE_IDLE          0
+#define STATE_WAIT          1   // the radio start is scheduled
+#define STATE_RX            2   // listening for the master
+#define STATE_TX            3   // response on air, the event closes afterwards
+#define STATE_TX_MORE       4   // response on air, the event continues
+#define STATE_CLOSE         5   // receiver being disabled, the event closes
+
+// masterSCA in ppm
+static const uint16_t master_sca_ppm[8] = {500, 250, 150, 100, 75, 50, 30, 20};
+
+static uint8_t ppi_start;
+static volatile uint8_t state = STATE_IDLE;
+
+static connection_receive_callback_t receive_callback = NULL;
+static connection_state_callback_t state_callback = NULL;
+
+// timing, all in microseconds
+static uint16_t anchor;             // anchor point of the current event, as received or expected
+static uint32_t interval;
+static uint32_t supervision;
+static uint32_t window;             // transmit window, until the connection is established
+static uint32_t since_sync;         // from the last received anchor point to the current one
+static uint32_t since_valid;        // from the last packet with a valid CRC, for the supervision timeout
+static uint16_t widening;
+static uint16_t sca_ppm;
+static uint8_t laps;                // compare matches to skip until the radio start
+static bool established;
+static bool event_synced;
+
+static volatile uint32_t missed;
+
+// acknowledgement and flow control
+static uint8_t sn;                  // transmitSeqNum
+static uint8_t nesn;                // nextExpectedSeqNum
+static uint8_t rx_buffer[RADIO_PDU_MAX];
+static uint8_t tx_queue[CONNECTION_TX_QUEUE_SIZE][RADIO_PDU_MAX];
+static volatile uint8_t tx_head = 0;
+static volatile uint8_t tx_tail = 0;
+static uint8_t empty_pdu[2];
+static uint8_t *tx_current;         // sent and not yet acknowledged
+
+#define tx_queued()         ((uint8_t) (tx_head - tx_tail))
+
+/**
+ * Enable the receiver at the given offset from the current anchor point
+ * through PPI, the radio being disabled
+ *
+ * Returns false, if that time has passed already.
+ */
+static bool connection_schedule(uint32_t offset)
+{
+    // the anchor point lies less than 65 ms back
+    TIMER_TASK_CAPTURE(CONNECTION_TIMER)[CC_START] = 1;
+    uint16_t elapsed = TIMER_CC(CONNECTION_TIMER)[CC_START] - anchor;
+    if (offset <= (uint32_t) elapsed + CONNECTION_JITTER_US)
+        return false;
+
+    RADIO_EVENT_ADDRESS = 0;
+    RADIO_EVENT_DISABLED = 0;
+    RADIO_PACKETPTR = (uint32_t) rx_buffer;
+    RADIO_SHORTS = RADIO_SHORTCUT_READY_START
+                 | RADIO_SHORTCUT_ADDRESS_RSSISTART
+                 | RADIO_SHORTCUT_END_DISABLE
+                 | RADIO_SHORTCUT_DISABLED_TXEN
+                 | RADIO_SHORTCUT_DISABLED_RSSISTOP;
+
+    laps = (offset - elapsed - 1) >> 16;
+    TIMER_CC(CONNECTION_TIMER)[CC_START] = (uint16_t) (anchor + offset);
+    TIMER_EVENT_COMPARE(CONNECTION_TIMER)[CC_START] = 0;
+    if (laps == 0)
+        PPI_CHENSET = (1 << ppi_start);
+    timer_interrupt_upon_compare_enable(CONNECTION_TIMER, CC_START);
+
+    state = STATE_WAIT;
+    return true;
+}
+
+static void connection_end(uint8_t reason)
+{
+    connection_stop();
+
+    if (state_callback)
+        state_callback(reason);
+}
+
+/**
+ * The current event is over: schedule the next one
+ */
+static void connection_next_event()
+{
+    do
+    {
+        if (!event_synced)
+            missed++;
+        event_synced = false;
+
+        hopping_advance();
+        since_sync += interval;
+        since_valid += interval;
+        if (established ? (since_valid > supervision) : (hopping_get_event_counter() >= CONNECTION_ESTABLISH_EVENTS))
+        {
+            connection_end(established ? CONNECTION_LOST : CONNECTION_FAILED);
+            return;
+        }
+
+        // the radio is disabled, so the channel may change
+        radio_profile_apply(hopping_get_profile());
+
+        uint64_t drift = ((uint64_t) sca_ppm * since_sync) / 1000000;
+        uint32_t widening_max = interval / 2 - CONNECTION_TIFS_US;
+        widening = (drift + CONNECTION_JITTER_US > widening_max) ? widening_max : drift + CONNECTION_JITTER_US;
+
+        bool scheduled = connection_schedule(interval - widening - CONNECTION_RAMPUP_US);
+        anchor += interval;
+        if (scheduled)
+            return;
+    }
+    while (true);
+}
+
+/**
+ * Evaluate the master's packet and prepare the response,
+ * while the transmitter ramps up
+ *
+ * Returns true, if the packet carries new data for the application.
+ */
+static bool connection_respond(bool crc)
+{
+    bool received = false;
+    bool more;
+
+    if (crc)
+    {
+        if (((rx_buffer[0] & CONNECTION_SN) != 0) == nesn)
+        {
+            nesn ^= 1;
+            received = (rx_buffer[1] > 0);
+        }
+
+        if (((rx_buffer[0] & CONNECTION_NESN) != 0) != sn)
+        {
+            sn ^= 1;
+            if (tx_current != NULL && tx_current != empty_pdu)
+                tx_tail++;
+            tx_current = NULL;
+        }
+    }
+
+    // an unacknowledged PDU is sent again
+    if (tx_current == NULL)
+        tx_current = (tx_queued() > 0) ? tx_queue[tx_tail & (CONNECTION_TX_QUEUE_SIZE - 1)] : empty_pdu;
+    more = (tx_current == empty_pdu) ? (tx_queued() > 0) : (tx_queued() > 1);
+
+    tx_current[0] = (tx_current[0] & CONNECTION_LLID_MASK)
+                  | (nesn ? CONNECTION_NESN : 0)
+                  | (sn ? CONNECTION_SN : 0)
+                  | (more ? CONNECTION_MD : 0);
+    RADIO_PACKETPTR = (uint32_t) tx_current;
+
+    // the event continues, if either side has more data, but not after a CRC error
+    if (crc && (more || (rx_buffer[0] & CONNECTION_MD)))
+    {
+        RADIO_SHORTS = RADIO_SHORTCUT_READY_START
+                     | RADIO_SHORTCUT_END_DISABLE
+                     | RADIO_SHORTCUT_DISABLED_RXEN;
+        state = STATE_TX_MORE;
+    }
+    else
+    {
+        RADIO_SHORTS = RADIO_SHORTCUT_READY_START
+                     | RADIO_SHORTCUT_END_DISABLE;
+        state = STATE_TX;
+    }
+
+    return received;
+}
+
+/**
+ * Handle the LL control PDU just received, if it is implemented here
+ *
+ * Returns true, if it is not to be passed to the application.
+ */
+static bool connection_control()
+{
+    if ((rx_buffer[0] & CONNECTION_LLID_MASK) != CONNECTION_LLID_CONTROL)
+        return false;
+
+    if (rx_buffer[CTRDATA_OPCODE] == LL_CHANNEL_MAP_REQ && rx_buffer[1] == CTRDATA_CHANNEL_MAP_LENGTH)
+    {
+        // an invalid map or a passed instant leaves the map as is
+        hopping_set_channel_map(&rx_buffer[CTRDATA_CHM], le16(&rx_buffer[CTRDATA_INSTANT]));
+        return true;
+    }
+
+    return false;
+}
+
+static void connection_listen_until(uint16_t timeout)
+{
+    TIMER_CC(CONNECTION_TIMER)[CC_TIMEOUT] = timeout;
+    TIMER_EVENT_COMPARE(CONNECTION_TIMER)[CC_TIMEOUT] = 0;
+    timer_interrupt_upon_compare_enable(CONNECTION_TIMER, CC_TIMEOUT);
+    state = STATE_RX;
+}
+
+/**
+ * Radio interrupt handler, while connected
+ */
+static void connection_radio_event()
+{
+    if (!RADIO_EVENT_DISABLED)
+        return;
+    RADIO_EVENT_DISABLED = 0;
+
+    switch (state)
+    {
+        case STATE_RX:
+        {
+            // a packet was received and the transmitter is ramping up
+            timer_interrupt_upon_compare_disable(CONNECTION_TIMER, CC_TIMEOUT);
+
+            bool first = !event_synced;
+            if (first)
+            {
+                anchor = TIMER_CC(CONNECTION_TIMER)[CC_ADDRESS] - CONNECTION_ADDRESS_US;
+                event_synced = true;
+                since_sync = 0;
+                window = 0;
+            }
+
+            // a corrupted packet still marks the anchor point,
+            // but only valid ones keep the connection alive
+            bool crc = RADIO_CRCSTATUS;
+            bool received = connection_respond(crc);
+            radio_quality_record(crc);
+            if (crc)
+                since_valid = 0;
+
+            // the response is on its way, the application may take its time now
+            if (crc && !established)
+            {
+                established = true;
+                if (state_callback)
+                    state_callback(CONNECTION_CONNECTED);
+            }
+            if (received && connection_control())
+                received = false;
+            if (received && receive_callback)
+                receive_callback(rx_buffer);
+            break;
+        }
+
+        case STATE_TX_MORE:
+            // the receiver is ramping up, the master answers T_IFS after our END
+            RADIO_EVENT_ADDRESS = 0;
+            RADIO_PACKETPTR = (uint32_t) rx_buffer;
+            RADIO_SHORTS = RADIO_SHORTCUT_READY_START
+                         | RADIO_SHORTCUT_ADDRESS_RSSISTART
+                         | RADIO_SHORTCUT_END_DISABLE
+                         | RADIO_SHORTCUT_DISABLED_TXEN
+                         | RADIO_SHORTCUT_DISABLED_RSSISTOP;
+            connection_listen_until(TIMER_CC(CONNECTION_TIMER)[CC_END]
+                                  + CONNECTION_TIFS_US + CONNECTION_ADDRESS_US + CONNECTION_JITTER_US);
+            break;
+
+        case STATE_TX:
+        case STATE_CLOSE:
+            connection_next_event();
+            break;
+    }
+}
+
+/**
+ * CONNECTION_TIMER interrupt handler
+ *
+ * Included in nrf51_startup.c
+ */
+void CONNECTION_TIMER_Handler()
+{
+    // CC_START matches again with every lap of the TIMER, it only counts while waiting
+    if (TIMER_EVENT_COMPARE(CONNECTION_TIMER)[CC_START] && state == STATE_WAIT)
+    {
+        TIMER_EVENT_COMPARE(CONNECTION_TIMER)[CC_START] = 0;
+
+        if (laps > 0)
+        {
+            // connect the radio for the last lap
+            if (--laps == 0)
+                PPI_CHENSET = (1 << ppi_start);
+        }
+        else
+        {
+            // the receiver is ramping up
+            PPI_CHENCLR = (1 << ppi_start);
+            timer_interrupt_upon_compare_disable(CONNECTION_TIMER, CC_START);
+            connection_listen_until(TIMER_CC(CONNECTION_TIMER)[CC_START] + CONNECTION_RAMPUP_US
+                                  + 2*widening + window + CONNECTION_ADDRESS_US);
+        }
+    }
+
+    if (TIMER_EVENT_COMPARE(CONNECTION_TIMER)[CC_TIMEOUT])
+    {
+        TIMER_EVENT_COMPARE(CONNECTION_TIMER)[CC_TIMEOUT] = 0;
+        timer_interrupt_upon_compare_disable(CONNECTION_TIMER, CC_TIMEOUT);
+
+        // a packet being received ends the event with its DISABLED event
+        if (state == STATE_RX && !RADIO_EVENT_ADDRESS)
+        {
+            state = STATE_CLOSE;
+            RADIO_SHORTS = 0;
+            RADIO_TASK_DISABLE = 1;
+        }
+    }
+}
+
+/**
+ * Set up CONNECTION_TIMER and the given and the following two PPI channels
+ *
+ * The timer runs from here on and captures the END of every packet,
+ * so that connection_start() finds the end of the CONNECT_REQ.
+ */
+void connection_init(uint8_t ppi_channel_first)
+{
+    TIMER_TASK_STOP(CONNECTION_TIMER)  = 1;
+    TIMER_MODE(CONNECTION_TIMER)       = TIMER_MODE_TIMER;
+    TIMER_BITMODE(CONNECTION_TIMER)    = TIMER_BITMODE_16BIT;
+    TIMER_PRESCALER(CONNECTION_TIMER)  = 4;
+    TIMER_INTENCLR(CONNECTION_TIMER)   = ~0;
+    TIMER_TASK_CLEAR(CONNECTION_TIMER) = 1;
+    interrupt_enable(CONNECTION_TIMER_INTERRUPT);
+
+    ppi_start = ppi_channel_first;
+    PPI_CH[ppi_start].EEP     = (uint32_t) &TIMER_EVENT_COMPARE(CONNECTION_TIMER)[CC_START];
+    PPI_CH[ppi_start].TEP     = (uint32_t) &RADIO_TASK_RXEN;
+    PPI_CH[ppi_start + 1].EEP = (uint32_t) &RADIO_EVENT_ADDRESS;
+    PPI_CH[ppi_start + 1].TEP = (uint32_t) &TIMER_TASK_CAPTURE(CONNECTION_TIMER)[CC_ADDRESS];
+    PPI_CH[ppi_start + 2].EEP = (uint32_t) &RADIO_EVENT_END;
+    PPI_CH[ppi_start + 2].TEP = (uint32_t) &TIMER_TASK_CAPTURE(CONNECTION_TIMER)[CC_END];
+    PPI_CHENCLR = (1 << ppi_start);
+    PPI_CHENSET = (1 << (ppi_start + 1))
+                | (1 << (ppi_start + 2));
+
+    TIMER_TASK_START(CONNECTION_TIMER) = 1;
+}
+
+/**
+ * Receive callback: invoked from the radio interrupt with every
+ * non-empty PDU (header, length, payload), the buffer is reused afterwards.
+ * State callback: CONNECTION_CONNECTED upon the first valid packet from the master,
+ * CONNECTION_LOST or CONNECTION_FAILED when the connection has ended.
+ */
+void connection_set_callbacks(connection_receive_callback_t rcb, connection_state_callback_t scb)
+{
+    receive_callback = rcb;
+    state_callback = scb;
+}
+
+/**
+ * Enter the connection requested by the given CONNECT_REQ (header, length, payload)
+ *
+ * To be called right after the CONNECT_REQ has been received
+ * with the radio disabled, e.g. from the advertiser's connect callback.
+ * Takes over the radio until the connection ends or connection_stop().
+ * Returns false, if the CONNECT_REQ is invalid.
+ */
+bool connection_start(const uint8_t *pdu)
+{
+    uint16_t interval_units = le16(&pdu[LLDATA_INTERVAL]);
+    uint16_t timeout_units = le16(&pdu[LLDATA_TIMEOUT]);
+
+    if (pdu[1] != 34
+     || interval_units < CONNECTION_INTERVAL_MIN || interval_units > CONNECTION_INTERVAL_MAX
+     || timeout_units == 0
+     || pdu[LLDATA_WINSIZE] == 0)
+        return false;
+
+    // the end of the CONNECT_REQ is the reference for the transmit window
+    anchor = TIMER_CC(CONNECTION_TIMER)[CC_END];
+
+    uint32_t access_address = pdu[LLDATA_AA]
+                            | (pdu[LLDATA_AA + 1] << 8)
+                            | (pdu[LLDATA_AA + 2] << 16)
+                            | ((uint32_t) pdu[LLDATA_AA + 3] << 24);
+    uint32_t crcinit = pdu[LLDATA_CRCINIT]
+                     | (pdu[LLDATA_CRCINIT + 1] << 8)
+                     | ((uint32_t) pdu[LLDATA_CRCINIT + 2] << 16);
+    if (!hopping_init(pdu[LLDATA_HOP] & 0x1F, &pdu[LLDATA_CHM], access_address, crcinit))
+        return false;
+
+    interval    = interval_units * CONNECTION_UNIT_US;
+    supervision = timeout_units * CONNECTION_TIMEOUT_UNIT_US;
+    window      = pdu[LLDATA_WINSIZE] * CONNECTION_UNIT_US;
+    sca_ppm     = master_sca_ppm[pdu[LLDATA_HOP] >> 5] + CONNECTION_SCA_PPM;
+
+    missed = 0;
+    established = false;
+    event_synced = false;
+
+    sn = 0;
+    nesn = 0;
+    tx_current = NULL;
+    empty_pdu[0] = CONNECTION_LLID_CONTINUATION;
+    empty_pdu[1] = 0;
+
+    radio_set_event_handler(connection_radio_event);
+    RADIO_INTENCLR = ~0;
+    RADIO_INTENSET = RADIO_INTERRUPT_DISABLED;
+    radio_profile_apply(hopping_get_profile());
+
+    // the first event: listen throughout the transmit window
+    uint32_t offset = WINDOW_DELAY_US + le16(&pdu[LLDATA_WINOFFSET]) * CONNECTION_UNIT_US;
+    since_sync = offset;
+    since_valid = offset;
+    widening = ((uint64_t) sca_ppm * offset) / 1000000 + CONNECTION_JITTER_US;
+    if (!connection_schedule(offset - widening - CONNECTION_RAMPUP_US))
+    {
+        connection_stop();
+        return false;
+    }
+    anchor += offset;
+
+    return true;
+}
+
+/**
+ * Queue a data PDU (header with LLID, length, payload) for transmission,
+ * the PDU is copied; SN, NESN and MD are set by the link layer
+ *
+ * Returns false, if the queue is full.
+ */
+bool connection_send(const uint8_t *pdu)
+{
+    if (tx_queued() >= CONNECTION_TX_QUEUE_SIZE || pdu[1] > RADIO_PDU_MAX - 2)
+        return false;
+
+    memcpy(tx_queue[tx_head & (CONNECTION_TX_QUEUE_SIZE - 1)], pdu, pdu[1] + 2);
+    tx_head++;
+
+    return true;
+}
+
+/**
+ * connEventCounter of the current or next event
+ */
+uint16_t connection_get_event_counter()
+{
+    return hopping_get_event_counter();
+}
+
+/**
+ * Number of events, in which nothing was received from the master
+ */
+uint32_t connection_get_missed_count()
+{
+    return missed;
+}
+
+void connection_stop()
+{
+    state = STATE_IDLE;
+    PPI_CHENCLR = (1 << ppi_start);
+    TIMER_INTENCLR(CONNECTION_TIMER) = ~0;
+    radio_stop();
+    radio_set_event_handler(NULL);
+}
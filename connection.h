@@ -0,0 +1,111 @@
+/**
+ * Bluetooth Low Energy link layer connection, slave (peripheral) role
+ * for the Nordic Semiconductor nRF51 series
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ *
+ * Requires:
+ *      Radio library
+ *      Hopping library
+ *      PPI
+ *      one TIMER (CONNECTION_TIMER)
+ */
+
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "radio.h"
+#include "hopping.h"
+#include "timers.h"
+#include "ppi.h"
+
+/*
+ * TIMER scheduling the connection events, counts microseconds in 16 bit;
+ * must not be shared with the timer library (TIMER0), RADIO_TIMER,
+ * RADIO_LATENCY_TIMER or, in the same firmware, SNIFFER_TIMER
+ * (checked, where both headers are included)
+ */
+#ifndef CONNECTION_TIMER
+#define CONNECTION_TIMER              TIMER2
+#define CONNECTION_TIMER_INTERRUPT    TIMER2_INTERRUPT
+#define CONNECTION_TIMER_Handler      TIMER2_Handler
+#elif !defined(CONNECTION_TIMER_INTERRUPT) || !defined(CONNECTION_TIMER_Handler)
+#error "CONNECTION_TIMER requires CONNECTION_TIMER_INTERRUPT and CONNECTION_TIMER_Handler"
+#endif
+
+#if CONNECTION_TIMER_INTERRUPT == TIMER0_INTERRUPT || CONNECTION_TIMER_INTERRUPT == RADIO_TIMER_INTERRUPT
+#error "CONNECTION_TIMER must not be shared with the timer library or RADIO_TIMER"
+#endif
+#if defined(RADIO_LATENCY_TIMER_INTERRUPT) && CONNECTION_TIMER_INTERRUPT == RADIO_LATENCY_TIMER_INTERRUPT
+#error "CONNECTION_TIMER must not be shared with RADIO_LATENCY_TIMER"
+#endif
+#if defined(SNIFFER_TIMER_INTERRUPT) && CONNECTION_TIMER_INTERRUPT == SNIFFER_TIMER_INTERRUPT
+#error "CONNECTION_TIMER must not be shared with SNIFFER_TIMER"
+#endif
+
+/*
+ * Link Layer specification section 4.5, Core 4.1, page 2539
+ */
+
+// connInterval, transmitWindowOffset and transmitWindowSize are counted in 1.25 ms
+#define CONNECTION_UNIT_US              1250
+#define CONNECTION_INTERVAL_MIN         6
+#define CONNECTION_INTERVAL_MAX         3200
+
+// connSupervisionTimeout is counted in 10 ms
+#define CONNECTION_TIMEOUT_UNIT_US      10000
+
+// the connection is lost, if no packet arrives in the first six events
+#define CONNECTION_ESTABLISH_EVENTS     6
+
+// accuracy of our clock (the 16 MHz crystal), added to the master's
+#ifndef CONNECTION_SCA_PPM
+#define CONNECTION_SCA_PPM              50
+#endif
+
+// added to the window widening to cover the master's and our own jitter
+#define CONNECTION_JITTER_US            16
+
+// radio ramp-up, and preamble plus access address on air at 1 Mbit
+#define CONNECTION_RAMPUP_US            130
+#define CONNECTION_ADDRESS_US           40
+#define CONNECTION_TIFS_US              150
+
+/*
+ * Data channel PDU header (first byte in RAM)
+ * Link Layer specification section 2.4, Core 4.1, page 2512
+ */
+#define CONNECTION_LLID_MASK            0x03
+#define CONNECTION_LLID_CONTINUATION    1   // or an empty PDU
+#define CONNECTION_LLID_START           2
+#define CONNECTION_LLID_CONTROL         3
+#define CONNECTION_NESN                 0x04
+#define CONNECTION_SN                   0x08
+#define CONNECTION_MD                   0x10
+
+// data PDUs waiting for transmission (power of two)
+#ifndef CONNECTION_TX_QUEUE_SIZE
+#define CONNECTION_TX_QUEUE_SIZE        4
+#endif
+
+// the application's view of the connection, see connection_state_callback_t
+#define CONNECTION_CONNECTED            0
+#define CONNECTION_LOST                 1   // supervision timeout
+#define CONNECTION_FAILED               2   // not established within six events
+
+typedef void (*connection_receive_callback_t) (const uint8_t *pdu);
+typedef void (*connection_state_callback_t) (uint8_t state);
+
+void connection_init(uint8_t ppi_channel_first);
+void connection_set_callbacks(connection_receive_callback_t receive_callback, connection_state_callback_t state_callback);
+bool connection_start(const uint8_t *connect_req);
+bool connection_send(const uint8_t *pdu);
+uint16_t connection_get_event_counter();
+uint32_t connection_get_missed_count();
+void connection_stop();
+
+#endif
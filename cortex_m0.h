@@ -1,4 +1,3 @@
-
 /**
  * Cortex M0 Registers and Low-level Routines
  *
@@ -9,14 +8,21 @@
 #ifndef CORTEX_M0_H
 #define CORTEX_M0_H
 
+#include <stdint.h>
+
 /*
  * Nested Vector Interrupt Controller (NVIC)
  */
 
+// System Control Space, which contains the NVIC and the System Control Block
+#ifndef SCS_BASE
+#define SCS_BASE                    0xE000E000
+#endif
+
 // Interrupt Control State Register (ICSR)
 // http://infocenter.arm.com/help/index.jsp?topic=/com.arm.doc.dui0497a/Cihfaaha.html
 
-#define ICSR                        *((volatile uint32_t*) 0xE000ED04)
+#define ICSR                        *((volatile uint32_t*) (SCS_BASE+0xD04))
 #define VECTACTIVE                   (ICSR & 0x0000003f)
 #define VECTPENDING                 ((ICSR & 0x0003f000) >> 12)
 
@@ -27,14 +33,14 @@
 // Interrupt Set Enable Register (ISER)
 // http://infocenter.arm.com/help/index.jsp?topic=/com.arm.doc.dui0497a/Cihcajhj.html
 
-#define ISER                        *((volatile uint32_t*) 0xE000E100)
+#define ISER                        *((volatile uint32_t*) (SCS_BASE+0x100))
 
 #define interrupt_enable(IRQn)      ISER = (1 << IRQn)
 
 // Interrupt Clear Enable Register (ICER)
 // http://infocenter.arm.com/help/index.jsp?topic=/com.arm.doc.dui0497a/Cihbiadi.html
 
-#define ICER                        *((volatile uint32_t*) 0xE000E180)
+#define ICER                        *((volatile uint32_t*) (SCS_BASE+0x180))
 
 #define interrupt_disable(IRQn)     ICER = (1 << IRQn)
 
@@ -44,10 +50,33 @@
 //void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority);
 //uint32_t NVIC_GetPriority(IRQn_Type IRQn);
 
+#ifndef NRF51_HOST
+
 // globally disable interrupts
 #define DINT        asm("cpsid i")
 
 // re-enable interrupts
 #define EINT        asm("cpsie i")
 
+// burn one cycle, e.g. in a busy-wait loop
+#define NOP         asm("nop")
+
+// sleep until an interrupt or event occurs
+#define WFI         asm("wfi")
+
+#else
+
+/*
+ * When building for the host (see host/nrf51_model.h),
+ * the peripheral model takes the place of the CPU core:
+ * it advances the emulated time while the drivers wait
+ * and dispatches interrupts to the handlers.
+ */
+#define DINT        nrf51_model_irq_disable()
+#define EINT        nrf51_model_irq_enable()
+#define NOP         nrf51_model_nop()
+#define WFI         nrf51_model_wfi()
+
+#endif
+
 #endif
@@ -0,0 +1,285 @@
+/**
+ * Bluetooth Low Energy CRC in software
+ * for the Nordic Semiconductor nRF51 series and the host
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ *
+ * The CRC shift register is fed with the least significant bit of every byte first.
+ * The table-driven variants therefore operate on the bit-reversed register,
+ * in which the polynomial becomes 0xDA6000 and bytes are shifted out to the right.
+ * crc24_table[0][n] is the reversed register after shifting byte n into an empty register,
+ * crc24_table[k][n] the same followed by k zero bytes.
+ */
+
+#include "crc24.h"
+
+#define CRC24_POLYNOMIAL_REVERSED   0xDA6000
+
+static const uint32_t crc24_table[4][256] =
+{
+    {
+        0x000000, 0x01B4C0, 0x036980, 0x02DD40, 0x06D300, 0x0767C0,
+        0x05BA80, 0x040E40, 0x0DA600, 0x0C12C0, 0x0ECF80, 0x0F7B40,
+        0x0B7500, 0x0AC1C0, 0x081C80, 0x09A840, 0x1B4C00, 0x1AF8C0,
+        0x182580, 0x199140, 0x1D9F00, 0x1C2BC0, 0x1EF680, 0x1F4240,
+        0x16EA00, 0x175EC0, 0x158380, 0x143740, 0x103900, 0x118DC0,
+        0x135080, 0x12E440, 0x369800, 0x372CC0, 0x35F180, 0x344540,
+        0x304B00, 0x31FFC0, 0x332280, 0x329640, 0x3B3E00, 0x3A8AC0,
+        0x385780, 0x39E340, 0x3DED00, 0x3C59C0, 0x3E8480, 0x3F3040,
+        0x2DD400, 0x2C60C0, 0x2EBD80, 0x2F0940, 0x2B0700, 0x2AB3C0,
+        0x286E80, 0x29DA40, 0x207200, 0x21C6C0, 0x231B80, 0x22AF40,
+        0x26A100, 0x2715C0, 0x25C880, 0x247C40, 0x6D3000, 0x6C84C0,
+        0x6E5980, 0x6FED40, 0x6BE300, 0x6A57C0, 0x688A80, 0x693E40,
+        0x609600, 0x6122C0, 0x63FF80, 0x624B40, 0x664500, 0x67F1C0,
+        0x652C80, 0x649840, 0x767C00, 0x77C8C0, 0x751580, 0x74A140,
+        0x70AF00, 0x711BC0, 0x73C680, 0x727240, 0x7BDA00, 0x7A6EC0,
+        0x78B380, 0x790740, 0x7D0900, 0x7CBDC0, 0x7E6080, 0x7FD440,
+        0x5BA800, 0x5A1CC0, 0x58C180, 0x597540, 0x5D7B00, 0x5CCFC0,
+        0x5E1280, 0x5FA640, 0x560E00, 0x57BAC0, 0x556780, 0x54D340,
+        0x50DD00, 0x5169C0, 0x53B480, 0x520040, 0x40E400, 0x4150C0,
+        0x438D80, 0x423940, 0x463700, 0x4783C0, 0x455E80, 0x44EA40,
+        0x4D4200, 0x4CF6C0, 0x4E2B80, 0x4F9F40, 0x4B9100, 0x4A25C0,
+        0x48F880, 0x494C40, 0xDA6000, 0xDBD4C0, 0xD90980, 0xD8BD40,
+        0xDCB300, 0xDD07C0, 0xDFDA80, 0xDE6E40, 0xD7C600, 0xD672C0,
+        0xD4AF80, 0xD51B40, 0xD11500, 0xD0A1C0, 0xD27C80, 0xD3C840,
+        0xC12C00, 0xC098C0, 0xC24580, 0xC3F140, 0xC7FF00, 0xC64BC0,
+        0xC49680, 0xC52240, 0xCC8A00, 0xCD3EC0, 0xCFE380, 0xCE5740,
+        0xCA5900, 0xCBEDC0, 0xC93080, 0xC88440, 0xECF800, 0xED4CC0,
+        0xEF9180, 0xEE2540, 0xEA2B00, 0xEB9FC0, 0xE94280, 0xE8F640,
+        0xE15E00, 0xE0EAC0, 0xE23780, 0xE38340, 0xE78D00, 0xE639C0,
+        0xE4E480, 0xE55040, 0xF7B400, 0xF600C0, 0xF4DD80, 0xF56940,
+        0xF16700, 0xF0D3C0, 0xF20E80, 0xF3BA40, 0xFA1200, 0xFBA6C0,
+        0xF97B80, 0xF8CF40, 0xFCC100, 0xFD75C0, 0xFFA880, 0xFE1C40,
+        0xB75000, 0xB6E4C0, 0xB43980, 0xB58D40, 0xB18300, 0xB037C0,
+        0xB2EA80, 0xB35E40, 0xBAF600, 0xBB42C0, 0xB99F80, 0xB82B40,
+        0xBC2500, 0xBD91C0, 0xBF4C80, 0xBEF840, 0xAC1C00, 0xADA8C0,
+        0xAF7580, 0xAEC140, 0xAACF00, 0xAB7BC0, 0xA9A680, 0xA81240,
+        0xA1BA00, 0xA00EC0, 0xA2D380, 0xA36740, 0xA76900, 0xA6DDC0,
+        0xA40080, 0xA5B440, 0x81C800, 0x807CC0, 0x82A180, 0x831540,
+        0x871B00, 0x86AFC0, 0x847280, 0x85C640, 0x8C6E00, 0x8DDAC0,
+        0x8F0780, 0x8EB340, 0x8ABD00, 0x8B09C0, 0x89D480, 0x886040,
+        0x9A8400, 0x9B30C0, 0x99ED80, 0x985940, 0x9C5700, 0x9DE3C0,
+        0x9F3E80, 0x9E8A40, 0x972200, 0x9696C0, 0x944B80, 0x95FF40,
+        0x91F100, 0x9045C0, 0x929880, 0x932C40
+    },
+    {
+        0x000000, 0xB751B4, 0xDA6369, 0x6D32DD, 0x0006D3, 0xB75767,
+        0xDA65BA, 0x6D340E, 0x000DA6, 0xB75C12, 0xDA6ECF, 0x6D3F7B,
+        0x000B75, 0xB75AC1, 0xDA681C, 0x6D39A8, 0x001B4C, 0xB74AF8,
+        0xDA7825, 0x6D2991, 0x001D9F, 0xB74C2B, 0xDA7EF6, 0x6D2F42,
+        0x0016EA, 0xB7475E, 0xDA7583, 0x6D2437, 0x001039, 0xB7418D,
+        0xDA7350, 0x6D22E4, 0x003698, 0xB7672C, 0xDA55F1, 0x6D0445,
+        0x00304B, 0xB761FF, 0xDA5322, 0x6D0296, 0x003B3E, 0xB76A8A,
+        0xDA5857, 0x6D09E3, 0x003DED, 0xB76C59, 0xDA5E84, 0x6D0F30,
+        0x002DD4, 0xB77C60, 0xDA4EBD, 0x6D1F09, 0x002B07, 0xB77AB3,
+        0xDA486E, 0x6D19DA, 0x002072, 0xB771C6, 0xDA431B, 0x6D12AF,
+        0x0026A1, 0xB77715, 0xDA45C8, 0x6D147C, 0x006D30, 0xB73C84,
+        0xDA0E59, 0x6D5FED, 0x006BE3, 0xB73A57, 0xDA088A, 0x6D593E,
+        0x006096, 0xB73122, 0xDA03FF, 0x6D524B, 0x006645, 0xB737F1,
+        0xDA052C, 0x6D5498, 0x00767C, 0xB727C8, 0xDA1515, 0x6D44A1,
+        0x0070AF, 0xB7211B, 0xDA13C6, 0x6D4272, 0x007BDA, 0xB72A6E,
+        0xDA18B3, 0x6D4907, 0x007D09, 0xB72CBD, 0xDA1E60, 0x6D4FD4,
+        0x005BA8, 0xB70A1C, 0xDA38C1, 0x6D6975, 0x005D7B, 0xB70CCF,
+        0xDA3E12, 0x6D6FA6, 0x00560E, 0xB707BA, 0xDA3567, 0x6D64D3,
+        0x0050DD, 0xB70169, 0xDA33B4, 0x6D6200, 0x0040E4, 0xB71150,
+        0xDA238D, 0x6D7239, 0x004637, 0xB71783, 0xDA255E, 0x6D74EA,
+        0x004D42, 0xB71CF6, 0xDA2E2B, 0x6D7F9F, 0x004B91, 0xB71A25,
+        0xDA28F8, 0x6D794C, 0x00DA60, 0xB78BD4, 0xDAB909, 0x6DE8BD,
+        0x00DCB3, 0xB78D07, 0xDABFDA, 0x6DEE6E, 0x00D7C6, 0xB78672,
+        0xDAB4AF, 0x6DE51B, 0x00D115, 0xB780A1, 0xDAB27C, 0x6DE3C8,
+        0x00C12C, 0xB79098, 0xDAA245, 0x6DF3F1, 0x00C7FF, 0xB7964B,
+        0xDAA496, 0x6DF522, 0x00CC8A, 0xB79D3E, 0xDAAFE3, 0x6DFE57,
+        0x00CA59, 0xB79BED, 0xDAA930, 0x6DF884, 0x00ECF8, 0xB7BD4C,
+        0xDA8F91, 0x6DDE25, 0x00EA2B, 0xB7BB9F, 0xDA8942, 0x6DD8F6,
+        0x00E15E, 0xB7B0EA, 0xDA8237, 0x6DD383, 0x00E78D, 0xB7B639,
+        0xDA84E4, 0x6DD550, 0x00F7B4, 0xB7A600, 0xDA94DD, 0x6DC569,
+        0x00F167, 0xB7A0D3, 0xDA920E, 0x6DC3BA, 0x00FA12, 0xB7ABA6,
+        0xDA997B, 0x6DC8CF, 0x00FCC1, 0xB7AD75, 0xDA9FA8, 0x6DCE1C,
+        0x00B750, 0xB7E6E4, 0xDAD439, 0x6D858D, 0x00B183, 0xB7E037,
+        0xDAD2EA, 0x6D835E, 0x00BAF6, 0xB7EB42, 0xDAD99F, 0x6D882B,
+        0x00BC25, 0xB7ED91, 0xDADF4C, 0x6D8EF8, 0x00AC1C, 0xB7FDA8,
+        0xDACF75, 0x6D9EC1, 0x00AACF, 0xB7FB7B, 0xDAC9A6, 0x6D9812,
+        0x00A1BA, 0xB7F00E, 0xDAC2D3, 0x6D9367, 0x00A769, 0xB7F6DD,
+        0xDAC400, 0x6D95B4, 0x0081C8, 0xB7D07C, 0xDAE2A1, 0x6DB315,
+        0x00871B, 0xB7D6AF, 0xDAE472, 0x6DB5C6, 0x008C6E, 0xB7DDDA,
+        0xDAEF07, 0x6DBEB3, 0x008ABD, 0xB7DB09, 0xDAE9D4, 0x6DB860,
+        0x009A84, 0xB7CB30, 0xDAF9ED, 0x6DA859, 0x009C57, 0xB7CDE3,
+        0xDAFF3E, 0x6DAE8A, 0x009722, 0xB7C696, 0xDAF44B, 0x6DA5FF,
+        0x0091F1, 0xB7C045, 0xDAF298, 0x6DA32C
+    },
+    {
+        0x000000, 0xF1D051, 0x5760A3, 0xA6B0F2, 0xAEC146, 0x5F1117,
+        0xF9A1E5, 0x0871B4, 0xE9428D, 0x1892DC, 0xBE222E, 0x4FF27F,
+        0x4783CB, 0xB6539A, 0x10E368, 0xE13339, 0x66451B, 0x97954A,
+        0x3125B8, 0xC0F5E9, 0xC8845D, 0x39540C, 0x9FE4FE, 0x6E34AF,
+        0x8F0796, 0x7ED7C7, 0xD86735, 0x29B764, 0x21C6D0, 0xD01681,
+        0x76A673, 0x877622, 0xCC8A36, 0x3D5A67, 0x9BEA95, 0x6A3AC4,
+        0x624B70, 0x939B21, 0x352BD3, 0xC4FB82, 0x25C8BB, 0xD418EA,
+        0x72A818, 0x837849, 0x8B09FD, 0x7AD9AC, 0xDC695E, 0x2DB90F,
+        0xAACF2D, 0x5B1F7C, 0xFDAF8E, 0x0C7FDF, 0x040E6B, 0xF5DE3A,
+        0x536EC8, 0xA2BE99, 0x438DA0, 0xB25DF1, 0x14ED03, 0xE53D52,
+        0xED4CE6, 0x1C9CB7, 0xBA2C45, 0x4BFC14, 0x2DD46D, 0xDC043C,
+        0x7AB4CE, 0x8B649F, 0x83152B, 0x72C57A, 0xD47588, 0x25A5D9,
+        0xC496E0, 0x3546B1, 0x93F643, 0x622612, 0x6A57A6, 0x9B87F7,
+        0x3D3705, 0xCCE754, 0x4B9176, 0xBA4127, 0x1CF1D5, 0xED2184,
+        0xE55030, 0x148061, 0xB23093, 0x43E0C2, 0xA2D3FB, 0x5303AA,
+        0xF5B358, 0x046309, 0x0C12BD, 0xFDC2EC, 0x5B721E, 0xAAA24F,
+        0xE15E5B, 0x108E0A, 0xB63EF8, 0x47EEA9, 0x4F9F1D, 0xBE4F4C,
+        0x18FFBE, 0xE92FEF, 0x081CD6, 0xF9CC87, 0x5F7C75, 0xAEAC24,
+        0xA6DD90, 0x570DC1, 0xF1BD33, 0x006D62, 0x871B40, 0x76CB11,
+        0xD07BE3, 0x21ABB2, 0x29DA06, 0xD80A57, 0x7EBAA5, 0x8F6AF4,
+        0x6E59CD, 0x9F899C, 0x39396E, 0xC8E93F, 0xC0988B, 0x3148DA,
+        0x97F828, 0x662879, 0x5BA8DA, 0xAA788B, 0x0CC879, 0xFD1828,
+        0xF5699C, 0x04B9CD, 0xA2093F, 0x53D96E, 0xB2EA57, 0x433A06,
+        0xE58AF4, 0x145AA5, 0x1C2B11, 0xEDFB40, 0x4B4BB2, 0xBA9BE3,
+        0x3DEDC1, 0xCC3D90, 0x6A8D62, 0x9B5D33, 0x932C87, 0x62FCD6,
+        0xC44C24, 0x359C75, 0xD4AF4C, 0x257F1D, 0x83CFEF, 0x721FBE,
+        0x7A6E0A, 0x8BBE5B, 0x2D0EA9, 0xDCDEF8, 0x9722EC, 0x66F2BD,
+        0xC0424F, 0x31921E, 0x39E3AA, 0xC833FB, 0x6E8309, 0x9F5358,
+        0x7E6061, 0x8FB030, 0x2900C2, 0xD8D093, 0xD0A127, 0x217176,
+        0x87C184, 0x7611D5, 0xF167F7, 0x00B7A6, 0xA60754, 0x57D705,
+        0x5FA6B1, 0xAE76E0, 0x08C612, 0xF91643, 0x18257A, 0xE9F52B,
+        0x4F45D9, 0xBE9588, 0xB6E43C, 0x47346D, 0xE1849F, 0x1054CE,
+        0x767CB7, 0x87ACE6, 0x211C14, 0xD0CC45, 0xD8BDF1, 0x296DA0,
+        0x8FDD52, 0x7E0D03, 0x9F3E3A, 0x6EEE6B, 0xC85E99, 0x398EC8,
+        0x31FF7C, 0xC02F2D, 0x669FDF, 0x974F8E, 0x1039AC, 0xE1E9FD,
+        0x47590F, 0xB6895E, 0xBEF8EA, 0x4F28BB, 0xE99849, 0x184818,
+        0xF97B21, 0x08AB70, 0xAE1B82, 0x5FCBD3, 0x57BA67, 0xA66A36,
+        0x00DAC4, 0xF10A95, 0xBAF681, 0x4B26D0, 0xED9622, 0x1C4673,
+        0x1437C7, 0xE5E796, 0x435764, 0xB28735, 0x53B40C, 0xA2645D,
+        0x04D4AF, 0xF504FE, 0xFD754A, 0x0CA51B, 0xAA15E9, 0x5BC5B8,
+        0xDCB39A, 0x2D63CB, 0x8BD339, 0x7A0368, 0x7272DC, 0x83A28D,
+        0x25127F, 0xD4C22E, 0x35F117, 0xC42146, 0x6291B4, 0x9341E5,
+        0x9B3051, 0x6AE000, 0xCC50F2, 0x3D80A3
+    },
+    {
+        0x000000, 0x773910, 0xEE7220, 0x994B30, 0x682441, 0x1F1D51,
+        0x865661, 0xF16F71, 0xD04882, 0xA77192, 0x3E3AA2, 0x4903B2,
+        0xB86CC3, 0xCF55D3, 0x561EE3, 0x2127F3, 0x145105, 0x636815,
+        0xFA2325, 0x8D1A35, 0x7C7544, 0x0B4C54, 0x920764, 0xE53E74,
+        0xC41987, 0xB32097, 0x2A6BA7, 0x5D52B7, 0xAC3DC6, 0xDB04D6,
+        0x424FE6, 0x3576F6, 0x28A20A, 0x5F9B1A, 0xC6D02A, 0xB1E93A,
+        0x40864B, 0x37BF5B, 0xAEF46B, 0xD9CD7B, 0xF8EA88, 0x8FD398,
+        0x1698A8, 0x61A1B8, 0x90CEC9, 0xE7F7D9, 0x7EBCE9, 0x0985F9,
+        0x3CF30F, 0x4BCA1F, 0xD2812F, 0xA5B83F, 0x54D74E, 0x23EE5E,
+        0xBAA56E, 0xCD9C7E, 0xECBB8D, 0x9B829D, 0x02C9AD, 0x75F0BD,
+        0x849FCC, 0xF3A6DC, 0x6AEDEC, 0x1DD4FC, 0x514414, 0x267D04,
+        0xBF3634, 0xC80F24, 0x396055, 0x4E5945, 0xD71275, 0xA02B65,
+        0x810C96, 0xF63586, 0x6F7EB6, 0x1847A6, 0xE928D7, 0x9E11C7,
+        0x075AF7, 0x7063E7, 0x451511, 0x322C01, 0xAB6731, 0xDC5E21,
+        0x2D3150, 0x5A0840, 0xC34370, 0xB47A60, 0x955D93, 0xE26483,
+        0x7B2FB3, 0x0C16A3, 0xFD79D2, 0x8A40C2, 0x130BF2, 0x6432E2,
+        0x79E61E, 0x0EDF0E, 0x97943E, 0xE0AD2E, 0x11C25F, 0x66FB4F,
+        0xFFB07F, 0x88896F, 0xA9AE9C, 0xDE978C, 0x47DCBC, 0x30E5AC,
+        0xC18ADD, 0xB6B3CD, 0x2FF8FD, 0x58C1ED, 0x6DB71B, 0x1A8E0B,
+        0x83C53B, 0xF4FC2B, 0x05935A, 0x72AA4A, 0xEBE17A, 0x9CD86A,
+        0xBDFF99, 0xCAC689, 0x538DB9, 0x24B4A9, 0xD5DBD8, 0xA2E2C8,
+        0x3BA9F8, 0x4C90E8, 0xA28828, 0xD5B138, 0x4CFA08, 0x3BC318,
+        0xCAAC69, 0xBD9579, 0x24DE49, 0x53E759, 0x72C0AA, 0x05F9BA,
+        0x9CB28A, 0xEB8B9A, 0x1AE4EB, 0x6DDDFB, 0xF496CB, 0x83AFDB,
+        0xB6D92D, 0xC1E03D, 0x58AB0D, 0x2F921D, 0xDEFD6C, 0xA9C47C,
+        0x308F4C, 0x47B65C, 0x6691AF, 0x11A8BF, 0x88E38F, 0xFFDA9F,
+        0x0EB5EE, 0x798CFE, 0xE0C7CE, 0x97FEDE, 0x8A2A22, 0xFD1332,
+        0x645802, 0x136112, 0xE20E63, 0x953773, 0x0C7C43, 0x7B4553,
+        0x5A62A0, 0x2D5BB0, 0xB41080, 0xC32990, 0x3246E1, 0x457FF1,
+        0xDC34C1, 0xAB0DD1, 0x9E7B27, 0xE94237, 0x700907, 0x073017,
+        0xF65F66, 0x816676, 0x182D46, 0x6F1456, 0x4E33A5, 0x390AB5,
+        0xA04185, 0xD77895, 0x2617E4, 0x512EF4, 0xC865C4, 0xBF5CD4,
+        0xF3CC3C, 0x84F52C, 0x1DBE1C, 0x6A870C, 0x9BE87D, 0xECD16D,
+        0x759A5D, 0x02A34D, 0x2384BE, 0x54BDAE, 0xCDF69E, 0xBACF8E,
+        0x4BA0FF, 0x3C99EF, 0xA5D2DF, 0xD2EBCF, 0xE79D39, 0x90A429,
+        0x09EF19, 0x7ED609, 0x8FB978, 0xF88068, 0x61CB58, 0x16F248,
+        0x37D5BB, 0x40ECAB, 0xD9A79B, 0xAE9E8B, 0x5FF1FA, 0x28C8EA,
+        0xB183DA, 0xC6BACA, 0xDB6E36, 0xAC5726, 0x351C16, 0x422506,
+        0xB34A77, 0xC47367, 0x5D3857, 0x2A0147, 0x0B26B4, 0x7C1FA4,
+        0xE55494, 0x926D84, 0x6302F5, 0x143BE5, 0x8D70D5, 0xFA49C5,
+        0xCF3F33, 0xB80623, 0x214D13, 0x567403, 0xA71B72, 0xD02262,
+        0x496952, 0x3E5042, 0x1F77B1, 0x684EA1, 0xF10591, 0x863C81,
+        0x7753F0, 0x006AE0, 0x9921D0, 0xEE18C0
+    }
+};
+
+static const uint8_t nibble_reversed[16] =
+{
+    0x0, 0x8, 0x4, 0xC, 0x2, 0xA, 0x6, 0xE,
+    0x1, 0x9, 0x5, 0xD, 0x3, 0xB, 0x7, 0xF
+};
+
+static uint32_t reverse8(uint32_t x)
+{
+    return (nibble_reversed[x & 0xF] << 4) | nibble_reversed[(x >> 4) & 0xF];
+}
+
+static uint32_t reverse24(uint32_t x)
+{
+    return (reverse8(x) << 16) | (reverse8(x >> 8) << 8) | reverse8(x >> 16);
+}
+
+uint32_t crc24_bitwise(uint32_t init, const uint8_t *data, uint32_t length)
+{
+    uint32_t crc = init & 0xFFFFFF;
+
+    while (length--)
+    {
+        uint8_t byte = *data++;
+        for (uint8_t i=0; i<8; i++)
+        {
+            uint32_t feedback = ((crc >> 23) ^ byte) & 1;
+            crc = (crc << 1) & 0xFFFFFF;
+            if (feedback)
+                crc ^= CRC24_POLYNOMIAL;
+            byte >>= 1;
+        }
+    }
+
+    return crc;
+}
+
+uint32_t crc24(uint32_t init, const uint8_t *data, uint32_t length)
+{
+    uint32_t crc = reverse24(init);
+
+    while (length--)
+        crc = (crc >> 8) ^ crc24_table[0][(crc ^ *data++) & 0xFF];
+
+    return reverse24(crc);
+}
+
+uint32_t crc24_slice4(uint32_t init, const uint8_t *data, uint32_t length)
+{
+    uint32_t crc = reverse24(init);
+
+    // byte by byte up to word alignment
+    while (length > 0 && ((uintptr_t) data & 3))
+    {
+        crc = (crc >> 8) ^ crc24_table[0][(crc ^ *data++) & 0xFF];
+        length--;
+    }
+
+    while (length >= 4)
+    {
+        // assemble the word byte by byte: independent of the host's byte order
+        uint32_t x = crc ^ (data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24));
+        crc = crc24_table[3][x & 0xFF]
+            ^ crc24_table[2][(x >> 8) & 0xFF]
+            ^ crc24_table[1][(x >> 16) & 0xFF]
+            ^ crc24_table[0][x >> 24];
+        data += 4;
+        length -= 4;
+    }
+
+    while (length--)
+        crc = (crc >> 8) ^ crc24_table[0][(crc ^ *data++) & 0xFF];
+
+    return reverse24(crc);
+}
+
+void crc24_to_air(uint32_t crc, uint8_t *air)
+{
+    // the most significant bit goes first, bytes go least significant bit first
+    uint32_t reversed = reverse24(crc);
+    air[0] = reversed & 0xFF;
+    air[1] = (reversed >> 8) & 0xFF;
+    air[2] = (reversed >> 16) & 0xFF;
+}
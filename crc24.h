@@ -0,0 +1,46 @@
+/**
+ * Bluetooth Low Energy CRC in software
+ * for the Nordic Semiconductor nRF51 series and the host
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ *
+ * Computes the same 24 bit CRC as the RADIO with
+ * CRCCNF = 3 bytes, SKIPADDR, CRCPOLY = 0x100065B:
+ * the initial value is given like RADIO_CRCINIT
+ * and the result compares to RADIO_RXCRC.
+ * The data is the PDU as in RAM (header, length, payload).
+ */
+
+#ifndef CRC24_H
+#define CRC24_H
+
+#include <stdint.h>
+
+#define CRC24_POLYNOMIAL        0x00065B
+
+// CRCINIT of the advertising channels
+#define CRC24_ADVERTISING_INIT  0x555555
+
+/**
+ * Reference implementation, one bit at a time
+ */
+uint32_t crc24_bitwise(uint32_t init, const uint8_t *data, uint32_t length);
+
+/**
+ * One table lookup per byte (1 KiB of tables)
+ */
+uint32_t crc24(uint32_t init, const uint8_t *data, uint32_t length);
+
+/**
+ * Four table lookups per four bytes (4 KiB of tables),
+ * for bulk processing of captures
+ */
+uint32_t crc24_slice4(uint32_t init, const uint8_t *data, uint32_t length);
+
+/**
+ * Bytes of the CRC in the order they are transmitted
+ */
+void crc24_to_air(uint32_t crc, uint8_t *air);
+
+#endif
@@ -9,6 +9,16 @@
 
 #include "delay.h" 
 
+#ifdef NRF51_HOST
+
+void delay_us(uint32_t us)
+{
+    // let the peripheral model advance instead of burning cycles
+    nrf51_model_run(us);
+}
+
+#else
+
 void delay_us(uint32_t us)
 {
     // CPU is operating at 16 MHz:
@@ -34,6 +44,8 @@ void delay_us(uint32_t us)
     );
 }
 
+#endif
+
 // TODO: something's broken with this function, it doesn't work anymore...
 void delay_ms(uint32_t ms)
 {
@@ -0,0 +1,397 @@
+/**
+ * Enhanced ShockBurst style proprietary link
+ * with automatic acknowledgement and retransmission
+ * for the Nordic Semiconductor nRF51 series
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ *
+ * The transmitter (PTX) sends a packet and lets the DISABLED_RXEN shortcut
+ * turn the radio around to receive the acknowledgement. If none arrives
+ * within the retransmit delay, the packet is sent again up to the
+ * configured number of times.
+ *
+ * The receiver (PRX) listens with the DISABLED_TXEN shortcut in place,
+ * so the radio ramps up for the ACK as soon as a packet has been received.
+ * The ISR only has to point RADIO_PACKETPTR at the ACK and swap the shortcut
+ * for DISABLED_RXEN before the ramp-up completes. Packets without valid CRC
+ * or with the NO_ACK flag cancel the ramp-up instead.
+ *
+ * Retransmissions carry the PID of the original packet: a packet with the
+ * same PID and CRC as the previous one on the same pipe is acknowledged,
+ * but not delivered again.
+ */
+
+#include "esb.h"
+
+typedef enum
+{
+    ESB_STATE_IDLE,
+    ESB_STATE_PTX_TX,           // transmitting a packet
+    ESB_STATE_PTX_ACK,          // waiting for the acknowledgement
+    ESB_STATE_PRX_RX,           // receiving, TX ramp-up follows the packet
+    ESB_STATE_PRX_ACK,          // transmitting an acknowledgement
+    ESB_STATE_PRX_RESTART       // ACK cancelled, RX ramp-up follows
+} esb_state_t;
+
+static volatile esb_state_t state = ESB_STATE_IDLE;
+
+// EasyDMA buffers
+static uint8_t tx_buffer[ESB_PACKET_MAX] __attribute__ ((aligned));
+static uint8_t rx_buffer[ESB_PACKET_MAX] __attribute__ ((aligned));
+static uint8_t ack_buffer[ESB_HEADER_LENGTH] __attribute__ ((aligned));
+
+// transmitter
+static uint8_t tx_pid = 0;
+static bool tx_ack;
+static uint8_t tx_attempts;
+static uint16_t retransmit_delay = ESB_RETRANSMIT_DELAY_DEFAULT(RADIO_MODE_NRF_1MBIT);
+static uint16_t retransmit_delay_min = ESB_RETRANSMIT_DELAY_MIN(RADIO_MODE_NRF_1MBIT);
+static uint8_t retransmit_count = ESB_RETRANSMIT_COUNT_DEFAULT;
+static int8_t retransmit_timer = -1;
+
+// receiver: open pipes, PID and CRC of the previous packet per pipe for duplicate detection
+static uint8_t rx_pipes = RADIO_RXADDR0;
+static uint8_t rx_pid[ESB_PIPES];
+static uint32_t rx_crc[ESB_PIPES];
+
+// LENGTH field and 3 bit S1 field (PID and NO_ACK), MSB first
+static const radio_packet_format_t esb_packet_format =
+{
+    .length_bits    = ESB_LENGTH_BITS,
+    .s0_bytes       = 0,
+    .s1_bits        = 3,
+    .max_length     = ESB_PAYLOAD_MAX,
+    .static_length  = 0,
+    .address_length = 5,
+    .msb_first      = true,
+    .whitening      = false
+};
+
+static esb_receive_callback_t receive_callback;
+static esb_send_callback_t send_callback;
+
+static void esb_send_complete(bool acknowledged)
+{
+    state = ESB_STATE_IDLE;
+
+    if (send_callback)
+        send_callback(acknowledged, tx_attempts);
+}
+
+static void esb_transmit()
+{
+    tx_attempts++;
+    state = ESB_STATE_PTX_TX;
+
+    RADIO_EVENT_DISABLED = 0;
+    RADIO_SHORTS = RADIO_SHORTCUT_READY_START
+                 | RADIO_SHORTCUT_END_DISABLE
+                 | (tx_ack ? RADIO_SHORTCUT_DISABLED_RXEN : 0);
+    RADIO_INTENSET = RADIO_INTERRUPT_DISABLED;
+
+    RADIO_PACKETPTR = (uint32_t) tx_buffer;
+    radio_latency_mark();
+    RADIO_TASK_TXEN = 1;
+}
+
+/**
+ * Timer callback: the retransmit delay has passed without ACK
+ */
+static void esb_retransmit()
+{
+    if (state != ESB_STATE_PTX_ACK)
+        return;
+
+    radio_stop();
+
+    if (tx_attempts > retransmit_count)
+        esb_send_complete(false);
+    else
+        esb_transmit();
+}
+
+/**
+ * A packet has been received (the radio is ramping up for the ACK)
+ */
+static void esb_receive_complete()
+{
+    uint8_t pipe = RADIO_RXMATCH;
+    uint8_t s1 = rx_buffer[1];
+    uint32_t crc = RADIO_RXCRC;
+    bool crc_ok = RADIO_CRC_OK;
+
+    if (!crc_ok || (s1 & ESB_NO_ACK))
+    {
+        // no ACK: abort the ramp-up and return to the receiver
+        RADIO_SHORTS = RADIO_SHORTCUT_READY_START
+                     | RADIO_SHORTCUT_END_DISABLE
+                     | RADIO_SHORTCUT_DISABLED_RXEN;
+        RADIO_TASK_DISABLE = 1;
+        state = ESB_STATE_PRX_RESTART;
+    }
+    else
+    {
+        // acknowledge on the address the packet was received on,
+        // then return to the receiver
+        ack_buffer[0] = 0;
+        ack_buffer[1] = s1 & ~ESB_NO_ACK;
+        RADIO_TXADDRESS = pipe;
+        RADIO_PACKETPTR = (uint32_t) ack_buffer;
+        RADIO_SHORTS = RADIO_SHORTCUT_READY_START
+                     | RADIO_SHORTCUT_END_DISABLE
+                     | RADIO_SHORTCUT_DISABLED_RXEN;
+        state = ESB_STATE_PRX_ACK;
+    }
+
+    if (!crc_ok)
+        return;
+
+    // retransmission of a packet, whose ACK got lost
+    if (ESB_PID(s1) == rx_pid[pipe] && crc == rx_crc[pipe])
+        return;
+
+    rx_pid[pipe] = ESB_PID(s1);
+    rx_crc[pipe] = crc;
+
+    // the buffer is not received into again before the ACK has been sent
+    if (receive_callback)
+        receive_callback(pipe, &rx_buffer[ESB_HEADER_LENGTH], rx_buffer[0]);
+}
+
+/**
+ * Radio interrupt handler, while the link is active
+ *
+ * Only the DISABLED event is used: at that point the shortcuts
+ * have already started the ramp-up for the following packet.
+ */
+static void esb_radio_event()
+{
+    if (!RADIO_EVENT_DISABLED)
+        return;
+    RADIO_EVENT_DISABLED = 0;
+
+    switch (state)
+    {
+        case ESB_STATE_PTX_TX:
+            if (!tx_ack)
+            {
+                esb_send_complete(true);
+                break;
+            }
+            // the receiver is ramping up: receive the ACK only
+            RADIO_SHORTS = RADIO_SHORTCUT_READY_START
+                         | RADIO_SHORTCUT_END_DISABLE;
+            RADIO_PACKETPTR = (uint32_t) rx_buffer;
+            state = ESB_STATE_PTX_ACK;
+            timer_start(retransmit_timer, retransmit_delay, esb_retransmit);
+            break;
+
+        case ESB_STATE_PTX_ACK:
+            if (RADIO_CRC_OK && ESB_PID(rx_buffer[1]) == tx_pid)
+            {
+                timer_stop(retransmit_timer);
+                esb_send_complete(true);
+                break;
+            }
+            // not our ACK, keep listening until the retransmit delay is over
+            radio_latency_mark();
+            RADIO_TASK_RXEN = 1;
+            break;
+
+        case ESB_STATE_PRX_RX:
+            esb_receive_complete();
+            break;
+
+        case ESB_STATE_PRX_ACK:
+        case ESB_STATE_PRX_RESTART:
+            // the receiver is ramping up, acknowledge the next packet again
+            RADIO_SHORTS = RADIO_SHORTCUT_READY_START
+                         | RADIO_SHORTCUT_END_DISABLE
+                         | RADIO_SHORTCUT_DISABLED_TXEN;
+            RADIO_PACKETPTR = (uint32_t) rx_buffer;
+            state = ESB_STATE_PRX_RX;
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ * Configure the radio for the proprietary link
+ *
+ * mode is one of RADIO_MODE_NRF_2MBIT, RADIO_MODE_NRF_1MBIT or RADIO_MODE_NRF_250KBIT,
+ * frequency is the offset from 2400 MHz. The address consists of
+ * the prefix byte followed by the four bytes of base_address.
+ *
+ * The radio must have been initialized with radio_init().
+ * esb_init() must be called again after other modules have used the radio.
+ * The retransmit delay is reset to the default of the mode.
+ */
+void esb_init(uint8_t mode, uint8_t frequency, uint32_t base_address, uint8_t prefix)
+{
+    esb_stop();
+
+    if (retransmit_timer < 0)
+    {
+        timer_init();
+        retransmit_timer = timer_create(TIMER_SINGLESHOT);
+    }
+
+    // factory trim values exist for NRF_1MBIT only
+    if (mode == RADIO_MODE_NRF_1MBIT && FICR_OVERRIDE_ENABLED_NRF_1MBIT)
+    {
+        RADIO_OVERRIDE[0] = FICR_NRF_1MBIT[0];
+        RADIO_OVERRIDE[1] = FICR_NRF_1MBIT[1];
+        RADIO_OVERRIDE[2] = FICR_NRF_1MBIT[2];
+        RADIO_OVERRIDE[3] = FICR_NRF_1MBIT[3];
+        RADIO_OVERRIDE[4] = FICR_NRF_1MBIT[4] | 0x80000000;
+    }
+    else
+    {
+        RADIO_OVERRIDE[4] &= ~0x80000000;
+    }
+
+    RADIO_MODE = mode;
+    RADIO_FREQUENCY = frequency;
+
+    retransmit_delay_min = ESB_RETRANSMIT_DELAY_MIN(mode);
+    retransmit_delay = ESB_RETRANSMIT_DELAY_DEFAULT(mode);
+
+    radio_set_packet_format(&esb_packet_format);
+
+    // transmit on pipe 0, further pipes are opened with esb_open_pipe()
+    for (uint8_t i=1; i<ESB_PIPES; i++)
+        radio_close_pipe(i);
+    radio_open_pipe(0, base_address, prefix);
+    rx_pipes = RADIO_RXADDR0;
+    RADIO_TXADDRESS = RADIO_TXADDR0;
+    RADIO_DACNF = 0;
+
+    RADIO_CRCCNF = RADIO_CRCCNF_LEN_2 | RADIO_CRCCNF_INCLADDR;
+    RADIO_CRCPOLY = ESB_CRC_POLYNOMIAL;
+    RADIO_CRCINIT = ESB_CRC_INIT;
+
+    // no packet has been received yet: PIDs are two bits only
+    for (uint8_t i=0; i<ESB_PIPES; i++)
+        rx_pid[i] = 0xFF;
+}
+
+/**
+ * Let the receiver listen on an additional address
+ * (base_address is shared by pipes 1-7, see radio_open_pipe())
+ *
+ * The pipe a payload has been received on is passed to the receive callback,
+ * the ACK is sent on the same address.
+ */
+bool esb_open_pipe(uint8_t pipe, uint32_t base_address, uint8_t prefix)
+{
+    if (state != ESB_STATE_IDLE || pipe >= ESB_PIPES)
+        return false;
+
+    if (!radio_open_pipe(pipe, base_address, prefix))
+        return false;
+
+    rx_pipes |= (1 << pipe);
+    rx_pid[pipe] = 0xFF;
+
+    return true;
+}
+
+/**
+ * Configure the delay after a transmission until it is repeated
+ * for lack of an ACK, and the maximum number of repetitions
+ *
+ * Returns false, if the delay is too short for the ACK to arrive
+ * in the mode passed to esb_init().
+ */
+bool esb_set_retransmit(uint16_t delay_us, uint8_t count)
+{
+    if (delay_us < retransmit_delay_min)
+        return false;
+
+    retransmit_delay = delay_us;
+    retransmit_count = count;
+
+    return true;
+}
+
+void esb_set_callbacks(esb_receive_callback_t rcb, esb_send_callback_t scb)
+{
+    receive_callback = rcb;
+    send_callback = scb;
+}
+
+/**
+ * Send a payload and return immediately
+ *
+ * The payload is copied. The send callback reports, whether an ACK has been
+ * received and after how many attempts; without ack it is invoked right
+ * after the transmission with acknowledged = true.
+ *
+ * Returns false, if a transmission is in progress or the payload is too long.
+ */
+bool esb_send(const uint8_t *payload, uint8_t length, bool ack)
+{
+    if (state != ESB_STATE_IDLE || length > ESB_PAYLOAD_MAX)
+        return false;
+
+    // every new payload gets the next PID, retransmissions keep it
+    tx_pid = (tx_pid + 1) & 3;
+    tx_buffer[0] = length;
+    tx_buffer[1] = (tx_pid << 1) | (ack ? 0 : ESB_NO_ACK);
+    for (uint8_t i=0; i<length; i++)
+        tx_buffer[ESB_HEADER_LENGTH + i] = payload[i];
+
+    tx_ack = ack;
+    tx_attempts = 0;
+
+    // the ACK is received on the transmit address
+    RADIO_TXADDRESS = RADIO_TXADDR0;
+    RADIO_RXADDRESSES = RADIO_RXADDR0;
+
+    radio_set_event_handler(esb_radio_event);
+    esb_transmit();
+
+    return true;
+}
+
+/**
+ * Receive and acknowledge packets until esb_stop()
+ *
+ * Payloads are delivered to the receive callback from the radio interrupt
+ * and are only valid until the callback returns.
+ */
+void esb_start_receiver()
+{
+    esb_stop();
+
+    radio_set_event_handler(esb_radio_event);
+    state = ESB_STATE_PRX_RX;
+
+    RADIO_RXADDRESSES = rx_pipes;
+
+    RADIO_EVENT_DISABLED = 0;
+    RADIO_SHORTS = RADIO_SHORTCUT_READY_START
+                 | RADIO_SHORTCUT_END_DISABLE
+                 | RADIO_SHORTCUT_DISABLED_TXEN;
+    RADIO_INTENSET = RADIO_INTERRUPT_DISABLED;
+
+    RADIO_PACKETPTR = (uint32_t) rx_buffer;
+    radio_latency_mark();
+    RADIO_TASK_RXEN = 1;
+}
+
+/**
+ * Abort any transmission or reception
+ * and return the radio interrupt to the radio library
+ */
+void esb_stop()
+{
+    state = ESB_STATE_IDLE;
+    if (retransmit_timer >= 0)
+        timer_stop(retransmit_timer);
+    radio_stop();
+    radio_set_event_handler(NULL);
+}
@@ -0,0 +1,84 @@
+/**
+ * Enhanced ShockBurst style proprietary link
+ * with automatic acknowledgement and retransmission
+ * for the Nordic Semiconductor nRF51 series
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ *
+ * Requires:
+ *      Radio library
+ *      Timer library
+ */
+
+#ifndef ESB_H
+#define ESB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "radio.h"
+#include "timers.h"
+
+/*
+ * Packet format
+ *
+ *  in RAM: LENGTH, S1 (PID << 1 | NO_ACK), payload
+ *  on air: preamble, 5 byte address, packet control field (LENGTH and S1),
+ *          payload, CRC16 (including the address)
+ *
+ * The LENGTH field has 6 bits as in Enhanced ShockBurst (32 byte payloads),
+ * and 8 bits if ESB_PAYLOAD_MAX exceeds 63 bytes, up to RADIO_PAYLOAD_MAX.
+ */
+#ifndef ESB_PAYLOAD_MAX
+#define ESB_PAYLOAD_MAX                 32
+#endif
+
+#if ESB_PAYLOAD_MAX > RADIO_PAYLOAD_MAX
+#error "ESB_PAYLOAD_MAX must not exceed RADIO_PAYLOAD_MAX"
+#endif
+
+#define ESB_LENGTH_BITS                ((ESB_PAYLOAD_MAX > 63) ? 8 : 6)
+#define ESB_HEADER_LENGTH               2
+#define ESB_PACKET_MAX                 (ESB_HEADER_LENGTH + ESB_PAYLOAD_MAX)
+
+#define ESB_PID(s1)                    (((s1) >> 1) & 3)
+#define ESB_NO_ACK                      1
+
+#define ESB_CRC_POLYNOMIAL              0x11021
+#define ESB_CRC_INIT                    0xFFFF
+
+// number of logical addresses (pipes) the receiver listens on
+#define ESB_PIPES                       RADIO_PIPES
+
+/*
+ * Retransmission parameters
+ *
+ * The retransmit delay is counted from the end of a transmission.
+ * It must cover the receiver ramp-up, the ACK on air (preamble, address,
+ * packet control field and CRC) and the interrupt latency,
+ * so its minimum and default depend on the mode.
+ */
+#define ESB_RAMPUP_US                   130
+#define ESB_ACK_BITS                   (8 + 5*8 + ESB_LENGTH_BITS + 3 + 16)
+#define ESB_RETRANSMIT_MARGIN           30
+
+#define ESB_KBPS(mode)                 ((mode) == RADIO_MODE_NRF_2MBIT ? 2000 : \
+                                        (mode) == RADIO_MODE_NRF_250KBIT ? 250 : 1000)
+#define ESB_RETRANSMIT_DELAY_MIN(mode) (ESB_RAMPUP_US + (ESB_ACK_BITS * 1000 + ESB_KBPS(mode) - 1) / ESB_KBPS(mode) \
+                                        + ESB_RETRANSMIT_MARGIN)
+#define ESB_RETRANSMIT_DELAY_DEFAULT(mode)  (ESB_RETRANSMIT_DELAY_MIN(mode) + 100)
+#define ESB_RETRANSMIT_COUNT_DEFAULT    3
+
+typedef void (*esb_receive_callback_t) (uint8_t pipe, const uint8_t *payload, uint8_t length);
+typedef void (*esb_send_callback_t) (bool acknowledged, uint8_t attempts);
+
+void esb_init(uint8_t mode, uint8_t frequency, uint32_t base_address, uint8_t prefix);
+bool esb_open_pipe(uint8_t pipe, uint32_t base_address, uint8_t prefix);
+bool esb_set_retransmit(uint16_t delay_us, uint8_t count);
+void esb_set_callbacks(esb_receive_callback_t receive_callback, esb_send_callback_t send_callback);
+bool esb_send(const uint8_t *payload, uint8_t length, bool ack);
+void esb_start_receiver();
+void esb_stop();
+
+#endif
@@ -11,7 +11,9 @@
 #ifndef FICR_H
 #define FICR_H
 
+#ifndef FICR_BASE
 #define FICR_BASE               0x10000000
+#endif
 
 #define FICR_CODEPAGESIZE       (*(volatile uint32_t*)   (FICR_BASE+0x10))    // Code memory page size
 #define FICR_CODESIZE           (*(volatile uint32_t*)   (FICR_BASE+0x14))    // Code memory size
@@ -19,18 +21,19 @@
 #define FICR_PPFC               (*(volatile uint32_t*)   (FICR_BASE+0x2C))    // Pre-programmed factory Code present
 #define FICR_NUMRAMBLOCK        (*(volatile uint32_t*)   (FICR_BASE+0x34))    // Number of individually controllable RAM blocks
 #define FICR_SIZERAMBLOCKS      (*(volatile uint32_t*)   (FICR_BASE+0x38))    // RAM block size, in bytes
-#define FICR_SIZERAMBLOCK        ((volatile uint32_t[4]) {FICR_BASE+0x38})    // Size of RAM block, in bytes
+#define FICR_SIZERAMBLOCK        ((volatile uint32_t*)   (FICR_BASE+0x38))    // Size of RAM block, in bytes [4]
 #define FICR_CONFIGID           (*(volatile uint32_t*)   (FICR_BASE+0x5C))    // Configuration identifier
-#define FICR_DEVICEID            ((volatile uint32_t[2]) {FICR_BASE+0x60})    // Device identifier
-#define FICR_ER                  ((volatile uint32_t[4]) {FICR_BASE+0x80})    // Encryption Root
-#define FICR_IR                  ((volatile uint32_t[4]) {FICR_BASE+0x90})    // Identity Root
+#define FICR_DEVICEID            ((volatile uint32_t*)   (FICR_BASE+0x60))    // Device identifier [2]
+#define FICR_ER                  ((volatile uint32_t*)   (FICR_BASE+0x80))    // Encryption Root [4]
+#define FICR_IR                  ((volatile uint32_t*)   (FICR_BASE+0x90))    // Identity Root [4]
 #define FICR_DEVICEADDRTYPE     (*(volatile uint32_t*)   (FICR_BASE+0xA0))    // Device address type
-#define FICR_DEVICEADDR          ((volatile uint32_t[2]) {FICR_BASE+0xA4})    // Device address
+#define FICR_DEVICEADDR          ((volatile uint32_t*)   (FICR_BASE+0xA4))    // Device address [2]
 #define FICR_OVERRIDEEN         (*(volatile uint32_t*)   (FICR_BASE+0xAC))    // Override enable
-#define FICR_NRF_1MBIT           ((volatile uint32_t[5]) {FICR_BASE+0xB0})    // Override value for NRF_1MBIT mode
-#define FICR_BLE_1MBIT           ((volatile uint32_t[5]) {FICR_BASE+0xEC})    // Override value for BLE_1MBIT mode
+#define FICR_NRF_1MBIT           ((volatile uint32_t*)   (FICR_BASE+0xB0))    // Override value for NRF_1MBIT mode [5]
+#define FICR_BLE_1MBIT           ((volatile uint32_t*)   (FICR_BASE+0xEC))    // Override value for BLE_1MBIT mode [5]
 
 // Masks
+#define FICR_OVERRIDE_ENABLED_NRF_1MBIT         (FICR_OVERRIDEEN & (1 << 0))
 #define FICR_OVERRIDE_ENABLED_BLE_1MBIT         (FICR_OVERRIDEEN & (1 << 3))
 
 #endif
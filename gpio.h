@@ -10,7 +10,9 @@
 #ifndef GPIO_H
 #define GPIO_H
 
+#ifndef GPIO_BASE
 #define GPIO_BASE       0x50000000
+#endif
 
 #define GPIO_OUT        (*(volatile uint32_t*) (GPIO_BASE+0x504))  // Write GPIO port
 #define GPIO_OUTSET     (*(volatile uint32_t*) (GPIO_BASE+0x508))  // Set individual bits in GPIO port
@@ -19,7 +21,7 @@
 #define GPIO_DIR        (*(volatile uint32_t*) (GPIO_BASE+0x514))  // Direction of GPIO pins
 #define GPIO_DIRSET     (*(volatile uint32_t*) (GPIO_BASE+0x518))  // DIR set register
 #define GPIO_DIRCLR     (*(volatile uint32_t*) (GPIO_BASE+0x51C))  // DIR clear register
-#define GPIO_PIN_CNF  ((volatile uint32_t[32]) {GPIO_BASE+0x700})  // Configuration of GPIO pins
+#define GPIO_PIN_CNF   ((volatile uint32_t*) (GPIO_BASE+0x700))  // Configuration of GPIO pins [32]
 
 /*
  * Pin configuration masks
@@ -10,17 +10,19 @@
 #ifndef GPIOTE_H
 #define GPIOTE_H
 
+#ifndef GPIOTE_BASE
 #define GPIOTE_BASE         0x40006000
+#endif
 
 /*
  * Tasks
  */
-#define GPIOTE_TASK_OUT     ((volatile uint32_t[4]) {GPIOTE_BASE+0x000})
+#define GPIOTE_TASK_OUT     ((volatile uint32_t*)   (GPIOTE_BASE+0x000))  // [4]
 
 /*
  * Events
  */
-#define GPIOTE_EVENT_IN     ((volatile uint32_t[4]) {GPIOTE_BASE+0x100})
+#define GPIOTE_EVENT_IN     ((volatile uint32_t*)   (GPIOTE_BASE+0x100))  // [4]
 #define GPIOTE_PORT        (*(volatile uint32_t*)   (GPIOTE_BASE+0x170))
 
 /*
@@ -29,7 +31,7 @@
 #define GPIOTE_INTEN       (*(volatile uint32_t*)   (GPIOTE_BASE+0x300))
 #define GPIOTE_INTENSET    (*(volatile uint32_t*)   (GPIOTE_BASE+0x304))
 #define GPIOTE_INTENCLR    (*(volatile uint32_t*)   (GPIOTE_BASE+0x308))
-#define GPIOTE_CONFIG       ((volatile uint32_t[4]) {GPIOTE_BASE+0x510})
+#define GPIOTE_CONFIG       ((volatile uint32_t*)   (GPIOTE_BASE+0x510))  // [4]
 
 /*
  * GPIOTE_CONFIG values
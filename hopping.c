@@ -0,0 +1,251 @@
+/**
+ * Bluetooth Low Energy data channel hopping (channel selection algorithm #1)
+ * with adaptive channel maps
+ * for the Nordic Semiconductor nRF51 series
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ *
+ * With algorithm #1 the unmapped channel advances by hopIncrement modulo 37,
+ * so the sequence repeats after 37 events. It is computed once per
+ * channel map, remapping included, and a hop is a step through that table.
+ * The register values of every data channel are precomputed as well
+ * (see radio_profile_init()), so the radio interrupt merely applies them.
+ *
+ * A new channel map is computed into a second table right away and
+ * swapped in with the event counter reaching its instant,
+ * like the Link Layer's channel map update procedure requires.
+ * hopping_assess() proposes such a map from the per-channel
+ * statistics collected by the radio library.
+ */
+
+#include "hopping.h"
+
+static uint8_t hop;
+static radio_channel_profile_t profiles[HOPPING_CHANNELS];
+
+// channel maps and the hop sequences resulting from them, the second one pending
+static uint8_t maps[2][5];
+static uint8_t sequences[2][HOPPING_CHANNELS];
+static volatile uint8_t current = 0;
+static volatile bool pending = false;
+static uint16_t instant;
+
+static uint8_t step;                // position within the sequence
+static uint16_t event_counter;
+
+// assessments to go until a dropped channel is tried again
+static uint8_t probation[HOPPING_CHANNELS];
+
+#define channel_used(map, channel)      ((map)[(channel) >> 3] & (1 << ((channel) & 7)))
+
+/**
+ * unmappedChannel and remapping for all 37 steps
+ * Link Layer specification section 4.5.8.2, Core 4.1, page 2545
+ */
+static bool hopping_compute(uint8_t buffer, const uint8_t *channel_map)
+{
+    uint8_t used[HOPPING_CHANNELS];
+    uint8_t used_count = 0;
+
+    for (uint8_t channel=0; channel<HOPPING_CHANNELS; channel++)
+    {
+        if (channel_used(channel_map, channel))
+            used[used_count++] = channel;
+    }
+    if (used_count < HOPPING_USED_MIN)
+        return false;
+
+    uint8_t unmapped = 0;
+    for (uint8_t s=0; s<HOPPING_CHANNELS; s++)
+    {
+        unmapped = (unmapped + hop) % HOPPING_CHANNELS;
+        sequences[buffer][s] = channel_used(channel_map, unmapped) ? unmapped : used[unmapped % used_count];
+    }
+
+    for (uint8_t i=0; i<5; i++)
+        maps[buffer][i] = channel_map[i];
+    maps[buffer][4] &= 0x1F;
+
+    return true;
+}
+
+/**
+ * Set up the hop sequence of a link for connection event 0
+ *
+ * Returns false, if the hop increment (5-16) or the channel map
+ * (37 bits, at least two channels used) is invalid.
+ */
+bool hopping_init(uint8_t hop_increment, const uint8_t *channel_map, uint32_t access_address, uint32_t crcinit)
+{
+    if (hop_increment < 5 || hop_increment > 16)
+        return false;
+
+    hop = hop_increment;
+    pending = false;
+    current = 0;
+    if (!hopping_compute(current, channel_map))
+        return false;
+
+    for (uint8_t channel=0; channel<HOPPING_CHANNELS; channel++)
+    {
+        radio_profile_init(&profiles[channel], channel, access_address, crcinit);
+        probation[channel] = 0;
+    }
+
+    step = 0;
+    event_counter = 0;
+
+    return true;
+}
+
+/**
+ * Register values of the current event's channel,
+ * ready for radio_profile_apply()
+ */
+const radio_channel_profile_t* hopping_get_profile()
+{
+    return &profiles[sequences[current][step]];
+}
+
+/**
+ * Data channel index of the current event
+ */
+uint8_t hopping_get_channel()
+{
+    return sequences[current][step];
+}
+
+/**
+ * connEventCounter of the current event
+ */
+uint16_t hopping_get_event_counter()
+{
+    return event_counter;
+}
+
+/**
+ * Proceed to the next connection event, to be called once per event
+ * whether it took place or not
+ */
+void hopping_advance()
+{
+    event_counter++;
+    if (++step == HOPPING_CHANNELS)
+        step = 0;
+
+    if (pending && event_counter == instant)
+    {
+        current ^= 1;
+        pending = false;
+    }
+}
+
+/**
+ * Use the given channel map from the connection event
+ * with the given counter (instant) on
+ *
+ * Returns false, if the map is invalid, the instant is not ahead
+ * or an update is pending already.
+ */
+bool hopping_set_channel_map(const uint8_t *channel_map, uint16_t at)
+{
+    uint16_t ahead = at - event_counter;
+
+    if (pending || ahead == 0 || ahead >= 32767)
+        return false;
+
+    if (!hopping_compute(current ^ 1, channel_map))
+        return false;
+
+    instant = at;
+    pending = true;
+
+    return true;
+}
+
+/**
+ * Channel map in use (5 bytes)
+ */
+void hopping_get_channel_map(uint8_t *channel_map)
+{
+    for (uint8_t i=0; i<5; i++)
+        channel_map[i] = maps[current][i];
+}
+
+/**
+ * Propose a channel map from the statistics collected
+ * since the previous assessment (see radio_quality_enable())
+ *
+ * A used channel is dropped, if enough packets were received on it and
+ * too many of them failed the CRC, though the signal was strong:
+ * that points to interference, e.g. a WLAN, rather than to the range.
+ * A dropped channel is tried again after HOPPING_PROBATION assessments,
+ * channels left out of the map by the other end stay out.
+ * If too few channels remain, the least bad ones are kept.
+ *
+ * Resets the statistics. Returns true, if the proposed map
+ * differs from the one in use; it takes effect with hopping_set_channel_map(),
+ * on both ends of the link.
+ */
+bool hopping_assess(uint8_t *channel_map)
+{
+    uint8_t rate[HOPPING_CHANNELS];
+    uint8_t used_count = 0;
+    const uint8_t *map = maps[current];
+
+    for (uint8_t i=0; i<5; i++)
+        channel_map[i] = 0;
+
+    for (uint8_t channel=0; channel<HOPPING_CHANNELS; channel++)
+    {
+        const radio_channel_quality_t *q = radio_get_quality(channel);
+        bool keep;
+
+        rate[channel] = (q->packets > 0) ? ((uint32_t) q->crc_errors * 100) / q->packets : 0;
+
+        if (!channel_used(map, channel))
+        {
+            keep = (probation[channel] > 0) && (--probation[channel] == 0);
+        }
+        else
+        {
+            keep = q->packets < HOPPING_ASSESS_PACKETS
+                || rate[channel] <= HOPPING_ASSESS_ERRORS
+                || q->rssi_sum / q->packets < HOPPING_ASSESS_RSSI;
+            if (!keep)
+                probation[channel] = HOPPING_PROBATION;
+        }
+
+        if (keep)
+        {
+            channel_map[channel >> 3] |= 1 << (channel & 7);
+            used_count++;
+        }
+    }
+
+    // readmit the dropped channels with the fewest errors
+    while (used_count < HOPPING_USED_KEEP)
+    {
+        uint8_t best = HOPPING_CHANNELS;
+        for (uint8_t channel=0; channel<HOPPING_CHANNELS; channel++)
+        {
+            if (!channel_used(channel_map, channel)
+             && (best == HOPPING_CHANNELS || rate[channel] < rate[best]))
+                best = channel;
+        }
+
+        channel_map[best >> 3] |= 1 << (best & 7);
+        probation[best] = 0;
+        used_count++;
+    }
+
+    radio_quality_reset();
+
+    for (uint8_t i=0; i<5; i++)
+    {
+        if (channel_map[i] != map[i])
+            return true;
+    }
+    return false;
+}
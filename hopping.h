@@ -0,0 +1,69 @@
+/**
+ * Bluetooth Low Energy data channel hopping (channel selection algorithm #1)
+ * with adaptive channel maps
+ * for the Nordic Semiconductor nRF51 series
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ *
+ * Requires:
+ *      Radio library
+ */
+
+#ifndef HOPPING_H
+#define HOPPING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "radio.h"
+
+// number of data channels, the period of the unmapped hop sequence
+#define HOPPING_CHANNELS            37
+
+// the Link Layer requires at least two used channels
+#define HOPPING_USED_MIN            2
+
+/*
+ * Channel assessment, see hopping_assess()
+ */
+
+// packets received on a channel, before it is assessed at all
+#ifndef HOPPING_ASSESS_PACKETS
+#define HOPPING_ASSESS_PACKETS      16
+#endif
+
+// CRC error rate in percent, above which a channel is considered polluted
+#ifndef HOPPING_ASSESS_ERRORS
+#define HOPPING_ASSESS_ERRORS       25
+#endif
+
+// below this average RSSI in dBm errors are blamed on the range, not on interference
+#ifndef HOPPING_ASSESS_RSSI
+#define HOPPING_ASSESS_RSSI         -85
+#endif
+
+// assessments a dropped channel stays out, before it is tried again
+#ifndef HOPPING_PROBATION
+#define HOPPING_PROBATION           8
+#endif
+
+// channels kept in the map in any case
+#ifndef HOPPING_USED_KEEP
+#define HOPPING_USED_KEEP           8
+#endif
+
+#if HOPPING_USED_KEEP < HOPPING_USED_MIN || HOPPING_USED_KEEP > HOPPING_CHANNELS
+#error "HOPPING_USED_KEEP must be between 2 and 37"
+#endif
+
+bool hopping_init(uint8_t hop, const uint8_t *channel_map, uint32_t access_address, uint32_t crcinit);
+const radio_channel_profile_t* hopping_get_profile();
+uint8_t hopping_get_channel();
+uint16_t hopping_get_event_counter();
+void hopping_advance();
+bool hopping_set_channel_map(const uint8_t *channel_map, uint16_t instant);
+void hopping_get_channel_map(uint8_t *channel_map);
+bool hopping_assess(uint8_t *channel_map);
+
+#endif
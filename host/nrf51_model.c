@@ -0,0 +1,1352 @@
+/**
+ * Register-level model of the nRF51 peripherals
+ * for building and running the drivers on a PC
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nrf51_model.h"
+
+// register at the given byte offset
+#define REG(peripheral, offset)     (peripheral)[(offset) >> 2]
+
+// address of a register, as written to PPI_CH[n].EEP/TEP by the drivers
+#define ADDRESS(peripheral, offset) ((uint32_t) (uintptr_t) &REG(peripheral, offset))
+
+#define NEVER                       UINT64_MAX
+
+/*
+ * Register memory
+ */
+uint32_t nrf51_model_clock[NRF51_MODEL_REGISTERS];
+uint32_t nrf51_model_radio[NRF51_MODEL_REGISTERS];
+uint32_t nrf51_model_uart[NRF51_MODEL_REGISTERS];
+uint32_t nrf51_model_gpiote[NRF51_MODEL_REGISTERS];
+uint32_t nrf51_model_timer[3][NRF51_MODEL_REGISTERS];
+uint32_t nrf51_model_rng[NRF51_MODEL_REGISTERS];
+uint32_t nrf51_model_ppi[NRF51_MODEL_REGISTERS];
+uint32_t nrf51_model_ficr[NRF51_MODEL_REGISTERS];
+uint32_t nrf51_model_gpio[NRF51_MODEL_REGISTERS];
+uint32_t nrf51_model_scs[NRF51_MODEL_REGISTERS];
+
+nrf51_model_stats_t nrf51_model_stats;
+
+/*
+ * Interrupt handlers
+ * to be overridden by the drivers, as in nrf51_startup.c
+ */
+static void nrf51_model_default_handler(void);
+
+#define WEAK_ALIAS(x)       __attribute__ ((weak, alias(#x)))
+
+void POWER_CLOCK_Handler()  WEAK_ALIAS(nrf51_model_default_handler);
+void RADIO_Handler()        WEAK_ALIAS(nrf51_model_default_handler);
+void UART0_Handler()        WEAK_ALIAS(nrf51_model_default_handler);
+void GPIOTE_Handler()       WEAK_ALIAS(nrf51_model_default_handler);
+void TIMER0_Handler()       WEAK_ALIAS(nrf51_model_default_handler);
+void TIMER1_Handler()       WEAK_ALIAS(nrf51_model_default_handler);
+void TIMER2_Handler()       WEAK_ALIAS(nrf51_model_default_handler);
+void RNG_Handler()          WEAK_ALIAS(nrf51_model_default_handler);
+
+typedef void (*task_handler_t)(uint32_t *peripheral, uint32_t offset);
+
+static void clock_task(uint32_t *peripheral, uint32_t offset);
+static void radio_task(uint32_t *peripheral, uint32_t offset);
+static void uart_task(uint32_t *peripheral, uint32_t offset);
+static void gpiote_task(uint32_t *peripheral, uint32_t offset);
+static void timer_task(uint32_t *peripheral, uint32_t offset);
+static void rng_task(uint32_t *peripheral, uint32_t offset);
+static void ppi_task(uint32_t *peripheral, uint32_t offset);
+
+#define NO_IRQ      0xFF
+
+static const struct
+{
+    uint32_t *registers;
+    task_handler_t task;
+    uint8_t irq;
+    void (*handler)();
+}
+peripherals[] =
+{
+    {nrf51_model_clock,     clock_task,     0,      POWER_CLOCK_Handler},
+    {nrf51_model_radio,     radio_task,     1,      RADIO_Handler},
+    {nrf51_model_uart,      uart_task,      2,      UART0_Handler},
+    {nrf51_model_gpiote,    gpiote_task,    6,      GPIOTE_Handler},
+    {nrf51_model_timer[0],  timer_task,     8,      TIMER0_Handler},
+    {nrf51_model_timer[1],  timer_task,     9,      TIMER1_Handler},
+    {nrf51_model_timer[2],  timer_task,     10,     TIMER2_Handler},
+    {nrf51_model_rng,       rng_task,       13,     RNG_Handler},
+    {nrf51_model_ppi,       ppi_task,       NO_IRQ, NULL},
+};
+
+#define PERIPHERAL_COUNT    (sizeof(peripherals) / sizeof(peripherals[0]))
+
+/*
+ * CPU core state
+ */
+static uint64_t now;
+static bool primask;
+static bool in_isr;
+static uint8_t current_irq;
+static uint32_t nvic_enabled;
+
+/*
+ * Peripheral state, which is not visible in registers
+ */
+#define UART_TXD_EMPTY      0xFFFFFFFF
+
+static struct
+{
+    bool running;
+    uint64_t origin;
+    uint32_t base;
+} timers[3];
+
+#define RADIO_STATE_DISABLED    0
+#define RADIO_STATE_RXRU        1
+#define RADIO_STATE_RXIDLE      2
+#define RADIO_STATE_RX          3
+#define RADIO_STATE_RXDISABLE   4
+#define RADIO_STATE_TXRU        9
+#define RADIO_STATE_TXIDLE      10
+#define RADIO_STATE_TX          11
+#define RADIO_STATE_TXDISABLE   12
+
+#define RADIO_IS_TX(state)      ((state) >= RADIO_STATE_TXRU)
+
+// pseudo event, resolved to DEVMATCH or DEVMISS when due
+#define RADIO_DEVICE_ADDRESS    0xFFF
+
+#define RADIO_SCHEDULE_SIZE     8
+
+static struct
+{
+    struct
+    {
+        uint64_t time;
+        uint32_t event;
+    } schedule[RADIO_SCHEDULE_SIZE];
+    uint8_t scheduled;
+
+    bool receiving;
+    uint8_t rxmatch;
+    nrf51_model_packet_t rx;
+    nrf51_model_packet_t tx;
+    uint8_t *rx_ptr;
+
+    // TIFS applies to transmissions started by the DISABLED_TXEN shortcut
+    uint64_t end;
+    bool shortcut;
+
+    nrf51_model_packet_t medium[NRF51_MODEL_MEDIUM_SIZE];
+    uint8_t medium_count;
+
+    int8_t noise[101];
+    nrf51_model_packet_hook_t tx_hook;
+    nrf51_model_packet_hook_t tx_start_hook;
+} radio;
+
+static struct
+{
+    bool tx_started;
+    bool tx_busy;
+    bool tx_pending;
+    uint8_t tx_byte;
+    uint8_t tx_next;
+    uint64_t tx_done;
+
+    bool rx_started;
+    uint8_t rx_fifo[256];
+    uint8_t rx_head;
+    uint8_t rx_tail;
+    uint64_t rx_next;
+
+    nrf51_model_uart_hook_t tx_hook;
+} uart;
+
+static struct
+{
+    bool running;
+    uint64_t ready;
+    uint32_t seed;
+} rng;
+
+#define RNG_US      100
+
+static void dispatch(void);
+
+/*
+ * Events and PPI
+ */
+
+static void task_trigger(uint32_t address)
+{
+    for (uint8_t i=0; i<PERIPHERAL_COUNT; i++)
+    {
+        uintptr_t base = (uintptr_t) peripherals[i].registers;
+        if (address >= base && address < base + 0x100)
+        {
+            peripherals[i].task(peripherals[i].registers, address - base);
+            return;
+        }
+    }
+}
+
+static void event(uint32_t *peripheral, uint32_t offset)
+{
+    REG(peripheral, offset) = 1;
+
+    uint32_t address = ADDRESS(peripheral, offset);
+    uint32_t chen = REG(nrf51_model_ppi, 0x500);
+    for (uint8_t ch=0; ch<16; ch++)
+    {
+        if ((chen & (1 << ch)) && REG(nrf51_model_ppi, 0x510 + ch*8) == address)
+            task_trigger(REG(nrf51_model_ppi, 0x514 + ch*8));
+    }
+}
+
+static void ppi_task(uint32_t *peripheral, uint32_t offset)
+{
+    // TASKS_CHG[n].EN and TASKS_CHG[n].DIS
+    uint32_t group = REG(peripheral, 0x800 + (offset >> 3)*4);
+    if (offset & 4)
+        REG(peripheral, 0x500) &= ~group;
+    else
+        REG(peripheral, 0x500) |= group;
+}
+
+/*
+ * CLOCK
+ */
+static void clock_task(uint32_t *peripheral, uint32_t offset)
+{
+    switch (offset)
+    {
+        case 0x000:
+            REG(peripheral, 0x408) = 1;
+            REG(peripheral, 0x40C) = (1 << 16) | 1;
+            event(peripheral, 0x100);
+            break;
+        case 0x004:
+            REG(peripheral, 0x408) = 0;
+            REG(peripheral, 0x40C) = 0;
+            break;
+        case 0x008:
+            REG(peripheral, 0x414) = 1;
+            REG(peripheral, 0x41C) = REG(peripheral, 0x518);
+            REG(peripheral, 0x418) = (1 << 16) | (REG(peripheral, 0x518) & 3);
+            event(peripheral, 0x104);
+            break;
+        case 0x00C:
+            REG(peripheral, 0x414) = 0;
+            REG(peripheral, 0x418) = 0;
+            break;
+    }
+}
+
+/*
+ * TIMER
+ */
+static uint8_t timer_index(uint32_t *peripheral)
+{
+    return (peripheral - nrf51_model_timer[0]) / NRF51_MODEL_REGISTERS;
+}
+
+static uint32_t timer_mask(uint32_t *peripheral)
+{
+    switch (REG(peripheral, 0x508) & 3)
+    {
+        case 1:  return 0xFF;
+        case 2:  return 0xFFFFFF;
+        case 3:  return 0xFFFFFFFF;
+        default: return 0xFFFF;
+    }
+}
+
+static uint8_t timer_prescaler(uint32_t *peripheral)
+{
+    uint32_t prescaler = REG(peripheral, 0x510) & 0xF;
+    return (prescaler > 9) ? 9 : prescaler;
+}
+
+// number of ticks since the timer was last (re)started
+static uint64_t timer_ticks(uint32_t *peripheral)
+{
+    uint8_t t = timer_index(peripheral);
+    if (!timers[t].running || (REG(peripheral, 0x504) & 1))
+        return 0;
+    return (now - timers[t].origin) >> timer_prescaler(peripheral);
+}
+
+static uint32_t timer_value(uint32_t *peripheral)
+{
+    uint8_t t = timer_index(peripheral);
+    return (timers[t].base + timer_ticks(peripheral)) & timer_mask(peripheral);
+}
+
+static void timer_compare(uint32_t *peripheral, uint8_t n);
+
+static void timer_task(uint32_t *peripheral, uint32_t offset)
+{
+    uint8_t t = timer_index(peripheral);
+
+    switch (offset)
+    {
+        case 0x000:
+            if (!timers[t].running)
+            {
+                timers[t].running = true;
+                timers[t].origin = now;
+            }
+            break;
+        case 0x004:
+        case 0x010:
+            timers[t].base = timer_value(peripheral);
+            timers[t].running = false;
+            break;
+        case 0x008:
+            // counter mode
+            if (timers[t].running && (REG(peripheral, 0x504) & 1))
+            {
+                timers[t].base = (timers[t].base + 1) & timer_mask(peripheral);
+                for (uint8_t n=0; n<4; n++)
+                {
+                    if (REG(peripheral, 0x540 + n*4) == timers[t].base)
+                        timer_compare(peripheral, n);
+                }
+            }
+            break;
+        case 0x00C:
+            timers[t].base = 0;
+            timers[t].origin = now;
+            break;
+        case 0x040:
+        case 0x044:
+        case 0x048:
+        case 0x04C:
+            REG(peripheral, 0x540 + (offset - 0x040)) = timer_value(peripheral);
+            break;
+    }
+}
+
+static void timer_compare(uint32_t *peripheral, uint8_t n)
+{
+    uint32_t shorts = REG(peripheral, 0x200);
+
+    event(peripheral, 0x140 + n*4);
+
+    if (shorts & (1 << n))
+        timer_task(peripheral, 0x00C);
+    if (shorts & (1 << (n+8)))
+        timer_task(peripheral, 0x004);
+}
+
+// time at which the counter changes to CC[n]
+static uint64_t timer_deadline(uint32_t *peripheral, uint8_t n)
+{
+    uint8_t t = timer_index(peripheral);
+    if (!timers[t].running || (REG(peripheral, 0x504) & 1))
+        return NEVER;
+
+    uint32_t mask = timer_mask(peripheral);
+    uint64_t ticks = timer_ticks(peripheral);
+    uint32_t value = (timers[t].base + ticks) & mask;
+    uint64_t delta = (REG(peripheral, 0x540 + n*4) - value) & mask;
+    if (delta == 0)
+        delta = (uint64_t) mask + 1;
+
+    return timers[t].origin + ((ticks + delta) << timer_prescaler(peripheral));
+}
+
+/*
+ * RNG
+ */
+static void rng_task(uint32_t *peripheral, uint32_t offset)
+{
+    (void) peripheral;
+
+    if (offset == 0x000 && !rng.running)
+    {
+        rng.running = true;
+        rng.ready = now + NRF51_MODEL_CYCLES(RNG_US);
+    }
+    else if (offset == 0x004)
+    {
+        rng.running = false;
+    }
+}
+
+static void rng_ready(void)
+{
+    // xorshift32
+    rng.seed ^= rng.seed << 13;
+    rng.seed ^= rng.seed >> 17;
+    rng.seed ^= rng.seed << 5;
+    REG(nrf51_model_rng, 0x508) = rng.seed & 0xFF;
+
+    event(nrf51_model_rng, 0x100);
+
+    if (REG(nrf51_model_rng, 0x200) & 1)
+        rng.running = false;
+    else
+        rng.ready = now + NRF51_MODEL_CYCLES(RNG_US);
+}
+
+void nrf51_model_rng_seed(uint32_t seed)
+{
+    if (seed != 0)
+        rng.seed = seed;
+}
+
+/*
+ * GPIO and GPIOTE
+ */
+static void gpio_update(void)
+{
+    uint32_t *gpio = nrf51_model_gpio;
+
+    REG(gpio, 0x504) |= REG(gpio, 0x508);
+    REG(gpio, 0x504) &= ~REG(gpio, 0x50C);
+    REG(gpio, 0x514) |= REG(gpio, 0x518);
+    REG(gpio, 0x514) &= ~REG(gpio, 0x51C);
+    REG(gpio, 0x508) = 0;
+    REG(gpio, 0x50C) = 0;
+    REG(gpio, 0x518) = 0;
+    REG(gpio, 0x51C) = 0;
+
+    // outputs read back what they drive
+    REG(gpio, 0x510) = REG(gpio, 0x504) & REG(gpio, 0x514);
+}
+
+static void gpiote_task(uint32_t *peripheral, uint32_t offset)
+{
+    if (offset >= 0x010)
+        return;
+
+    uint32_t config = REG(peripheral, 0x510 + offset);
+    if ((config & 3) != 3)
+        return;
+
+    uint32_t pin = 1 << ((config >> 8) & 0x1F);
+    switch ((config >> 16) & 3)
+    {
+        case 1: REG(nrf51_model_gpio, 0x504) |= pin;  break;
+        case 2: REG(nrf51_model_gpio, 0x504) &= ~pin; break;
+        case 3: REG(nrf51_model_gpio, 0x504) ^= pin;  break;
+    }
+    gpio_update();
+}
+
+/*
+ * UART
+ */
+static uint64_t uart_byte_cycles(void)
+{
+    // baudrate = BAUDRATE * 16 MHz / 2^32, 10 bits per byte
+    uint64_t baudrate = REG(nrf51_model_uart, 0x524);
+    if (baudrate == 0)
+        baudrate = 0x01D7E000;
+    return (10ULL << 32) / baudrate;
+}
+
+static void uart_task(uint32_t *peripheral, uint32_t offset)
+{
+    (void) peripheral;
+
+    switch (offset)
+    {
+        case 0x000:
+            uart.rx_started = true;
+            if (uart.rx_head != uart.rx_tail)
+                uart.rx_next = now + uart_byte_cycles();
+            break;
+        case 0x004:
+            uart.rx_started = false;
+            break;
+        case 0x008:
+            uart.tx_started = true;
+            break;
+        case 0x00C:
+            uart.tx_started = false;
+            break;
+    }
+}
+
+static void uart_update(void)
+{
+    uint32_t txd = REG(nrf51_model_uart, 0x51C);
+    if (txd == UART_TXD_EMPTY)
+        return;
+    REG(nrf51_model_uart, 0x51C) = UART_TXD_EMPTY;
+
+    if (!uart.tx_started)
+        return;
+
+    if (!uart.tx_busy)
+    {
+        uart.tx_busy = true;
+        uart.tx_byte = txd;
+        uart.tx_done = now + uart_byte_cycles();
+    }
+    else
+    {
+        // TXD is double-buffered
+        uart.tx_pending = true;
+        uart.tx_next = txd;
+    }
+}
+
+static void uart_transmitted(void)
+{
+    if (uart.tx_hook)
+        uart.tx_hook(uart.tx_byte);
+
+    if (uart.tx_pending)
+    {
+        uart.tx_pending = false;
+        uart.tx_byte = uart.tx_next;
+        uart.tx_done = now + uart_byte_cycles();
+    }
+    else
+    {
+        uart.tx_busy = false;
+    }
+
+    event(nrf51_model_uart, 0x11C);
+}
+
+static void uart_received(void)
+{
+    REG(nrf51_model_uart, 0x518) = uart.rx_fifo[uart.rx_tail++];
+    event(nrf51_model_uart, 0x108);
+
+    if (uart.rx_head != uart.rx_tail)
+        uart.rx_next = now + uart_byte_cycles();
+}
+
+static void uart_stdout(uint8_t c)
+{
+    putchar(c);
+    fflush(stdout);
+}
+
+void nrf51_model_uart_set_tx_hook(nrf51_model_uart_hook_t hook)
+{
+    uart.tx_hook = hook;
+}
+
+bool nrf51_model_uart_inject(const uint8_t *data, uint16_t length)
+{
+    bool idle = (uart.rx_head == uart.rx_tail);
+
+    for (uint16_t i=0; i<length; i++)
+    {
+        if ((uint8_t) (uart.rx_head + 1) == uart.rx_tail)
+            return false;
+        uart.rx_fifo[uart.rx_head++] = data[i];
+    }
+
+    if (idle && length > 0 && uart.rx_started)
+        uart.rx_next = now + uart_byte_cycles();
+
+    return true;
+}
+
+/*
+ * RADIO
+ */
+static uint32_t radio_cycles_per_bit(void)
+{
+    switch (REG(nrf51_model_radio, 0x510) & 3)
+    {
+        case 1:  return 8;      // 2 Mbit/s
+        case 2:  return 64;     // 250 kbit/s
+        default: return 16;     // 1 Mbit/s
+    }
+}
+
+static uint8_t radio_balen(void)
+{
+    return (REG(nrf51_model_radio, 0x518) >> 16) & 7;
+}
+
+// logical address n, as it appears on air
+static uint64_t radio_address(uint8_t n)
+{
+    uint8_t balen = radio_balen();
+    uint32_t base = (n == 0) ? REG(nrf51_model_radio, 0x51C) : REG(nrf51_model_radio, 0x520);
+    uint32_t prefixes = (n < 4) ? REG(nrf51_model_radio, 0x524) : REG(nrf51_model_radio, 0x528);
+    uint64_t prefix = (prefixes >> ((n & 3) * 8)) & 0xFF;
+
+    if (balen == 0)
+        return prefix;
+    return (prefix << (balen * 8)) | (base >> (32 - balen * 8));
+}
+
+/*
+ * Determine the packet's size in RAM
+ * and the number of bits on air following the address
+ * according to PCNF0 and PCNF1
+ */
+static uint16_t radio_packet_format(const uint8_t *data, uint32_t *bits)
+{
+    uint32_t pcnf0 = REG(nrf51_model_radio, 0x514);
+    uint32_t pcnf1 = REG(nrf51_model_radio, 0x518);
+
+    uint8_t lflen = pcnf0 & 0xF;
+    uint8_t s0len = (pcnf0 >> 8) & 1;
+    uint8_t s1len = (pcnf0 >> 16) & 0xF;
+    uint8_t maxlen = pcnf1 & 0xFF;
+    uint8_t statlen = (pcnf1 >> 8) & 0xFF;
+
+    uint16_t header = s0len + (lflen > 0) + (s1len > 0);
+    uint16_t length = statlen;
+    if (lflen > 0)
+        length += data[s0len] & ((1 << lflen) - 1);
+    if (length > maxlen)
+        length = maxlen;
+
+    *bits = s0len*8 + lflen + s1len + length*8 + (REG(nrf51_model_radio, 0x534) & 3)*8;
+    return header + length;
+}
+
+static uint16_t radio_header_length(void)
+{
+    uint32_t pcnf0 = REG(nrf51_model_radio, 0x514);
+    return ((pcnf0 >> 8) & 1) + ((pcnf0 & 0xF) > 0) + (((pcnf0 >> 16) & 0xF) > 0);
+}
+
+static void radio_schedule(uint64_t time, uint32_t event)
+{
+    if (radio.scheduled >= RADIO_SCHEDULE_SIZE)
+    {
+        fprintf(stderr, "nrf51_model: radio schedule overflow\n");
+        abort();
+    }
+    radio.schedule[radio.scheduled].time = time;
+    radio.schedule[radio.scheduled].event = event;
+    radio.scheduled++;
+}
+
+static void radio_unschedule(uint32_t event)
+{
+    for (uint8_t i=0; i<radio.scheduled; )
+    {
+        if (event == 0 || radio.schedule[i].event == event)
+            radio.schedule[i] = radio.schedule[--radio.scheduled];
+        else
+            i++;
+    }
+}
+
+// abort the packet currently on air
+static void radio_abort_packet(void)
+{
+    radio_unschedule(0x104);
+    radio_unschedule(0x108);
+    radio_unschedule(0x10C);
+    radio_unschedule(0x128);
+    radio_unschedule(RADIO_DEVICE_ADDRESS);
+    radio.receiving = false;
+}
+
+static void radio_set_state(uint32_t state)
+{
+    REG(nrf51_model_radio, 0x550) = state;
+}
+
+// time of the ADDRESS event of a packet, whose preamble starts at the given time
+static uint64_t radio_address_time(uint64_t start)
+{
+    return start + (8 + (radio_balen() + 1) * 8) * radio_cycles_per_bit();
+}
+
+// schedule the events of a packet, whose preamble starts at the given time
+static void radio_schedule_packet(const uint8_t *data, bool rx, uint64_t start)
+{
+    uint32_t cpb = radio_cycles_per_bit();
+    uint32_t bits;
+    radio_packet_format(data, &bits);
+
+    uint64_t address = radio_address_time(start);
+    uint32_t crc_bits = (REG(nrf51_model_radio, 0x534) & 3) * 8;
+
+    radio_schedule(address, 0x104);
+    radio_schedule(address + (bits - crc_bits) * cpb, 0x108);
+    radio_schedule(address + bits * cpb, 0x10C);
+
+    uint32_t pcnf0 = REG(nrf51_model_radio, 0x514);
+    uint32_t header_bits = ((pcnf0 >> 8) & 1)*8 + (pcnf0 & 0xF) + ((pcnf0 >> 16) & 0xF);
+    if (rx && header_bits + 48 + crc_bits <= bits)
+        radio_schedule(address + (header_bits + 48) * cpb, RADIO_DEVICE_ADDRESS);
+}
+
+static void radio_start_tx(void)
+{
+    const uint8_t *data = (const uint8_t*) (uintptr_t) REG(nrf51_model_radio, 0x504);
+    uint32_t bits;
+
+    memset(&radio.tx, 0, sizeof(radio.tx));
+    radio.tx.time = now;
+    radio.tx.frequency = REG(nrf51_model_radio, 0x508);
+    radio.tx.address = radio_address(REG(nrf51_model_radio, 0x52C) & 7);
+    radio.tx.rssi = (int8_t) REG(nrf51_model_radio, 0x50C);
+    radio.tx.crc_ok = true;
+    if (data != NULL)
+    {
+        // the length field may only be evaluated after S0 has been copied
+        memcpy(radio.tx.data, data, 3);
+        radio.tx.length = radio_packet_format(radio.tx.data, &bits);
+        memcpy(radio.tx.data, data, radio.tx.length);
+    }
+
+    radio_set_state(RADIO_STATE_TX);
+    radio_schedule_packet(radio.tx.data, false, now);
+
+    if (radio.tx_start_hook)
+        radio.tx_start_hook(&radio.tx);
+}
+
+static void radio_task(uint32_t *peripheral, uint32_t offset)
+{
+    uint32_t state = REG(peripheral, 0x550);
+
+    switch (offset)
+    {
+        case 0x000:
+        case 0x004:
+            if (state != RADIO_STATE_DISABLED)
+                break;
+        {
+            uint64_t ready = now + NRF51_MODEL_CYCLES(NRF51_MODEL_RADIO_RAMPUP_US);
+            uint64_t tifs = radio.end + NRF51_MODEL_CYCLES(REG(peripheral, 0x544));
+            if (offset == 0x000 && radio.shortcut && tifs > ready)
+                ready = tifs;
+            radio_set_state(offset ? RADIO_STATE_RXRU : RADIO_STATE_TXRU);
+            radio_schedule(ready, 0x100);
+            break;
+        }
+
+        case 0x008:
+            if (state == RADIO_STATE_TXIDLE)
+            {
+                radio_start_tx();
+            }
+            else if (state == RADIO_STATE_RXIDLE)
+            {
+                // PACKETPTR is latched upon START
+                radio.rx_ptr = (uint8_t*) (uintptr_t) REG(peripheral, 0x504);
+                radio_set_state(RADIO_STATE_RX);
+            }
+            break;
+
+        case 0x00C:
+            if (state == RADIO_STATE_TX || state == RADIO_STATE_RX)
+            {
+                radio_abort_packet();
+                radio_set_state(state - 1);
+            }
+            break;
+
+        case 0x010:
+            if (state == RADIO_STATE_DISABLED || state == RADIO_STATE_RXDISABLE || state == RADIO_STATE_TXDISABLE)
+                break;
+            radio_unschedule(0);
+            radio.receiving = false;
+            if (RADIO_IS_TX(state))
+            {
+                radio_set_state(RADIO_STATE_TXDISABLE);
+                radio_schedule(now + NRF51_MODEL_CYCLES(NRF51_MODEL_RADIO_TXDISABLE_US), 0x110);
+            }
+            else
+            {
+                radio_set_state(RADIO_STATE_RXDISABLE);
+                radio_schedule(now + NRF51_MODEL_CYCLES(NRF51_MODEL_RADIO_RXDISABLE_US), 0x110);
+            }
+            break;
+
+        case 0x014:
+            radio_unschedule(0x11C);
+            radio_schedule(now + 4, 0x11C);
+            break;
+
+        case 0x018:
+            radio_unschedule(0x11C);
+            break;
+
+        case 0x01C:
+            if (state == RADIO_STATE_TX || radio.receiving)
+            {
+                radio_unschedule(0x128);
+                radio_schedule(now + REG(peripheral, 0x560) * radio_cycles_per_bit(), 0x128);
+            }
+            break;
+
+        case 0x020:
+            radio_unschedule(0x128);
+            break;
+    }
+}
+
+static bool radio_device_address_match(void)
+{
+    const uint8_t *data = radio.rx.data;
+    uint16_t header = radio_header_length();
+    uint32_t dacnf = REG(nrf51_model_radio, 0x640);
+    bool txadd = (REG(nrf51_model_radio, 0x514) & (1 << 8)) && (data[0] & (1 << 6));
+
+    for (uint8_t i=0; i<8; i++)
+    {
+        if (!(dacnf & (1 << i)))
+            continue;
+        if (txadd != ((dacnf & (1 << (i+8))) != 0))
+            continue;
+
+        uint32_t dab = REG(nrf51_model_radio, 0x600 + i*4);
+        uint32_t dap = REG(nrf51_model_radio, 0x620 + i*4);
+        uint8_t address[6] = {dab, dab >> 8, dab >> 16, dab >> 24, dap, dap >> 8};
+
+        if (memcmp(address, &data[header], 6) == 0)
+        {
+            REG(nrf51_model_radio, 0x410) = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void radio_fire(uint32_t offset)
+{
+    uint32_t *peripheral = nrf51_model_radio;
+    uint32_t state = REG(peripheral, 0x550);
+    uint32_t shorts = REG(peripheral, 0x200);
+
+    switch (offset)
+    {
+        case 0x100:
+            radio_set_state((state == RADIO_STATE_TXRU) ? RADIO_STATE_TXIDLE : RADIO_STATE_RXIDLE);
+            event(peripheral, 0x100);
+            if (shorts & (1 << 0))
+                radio_task(peripheral, 0x008);
+            break;
+
+        case 0x104:
+            if (state == RADIO_STATE_RX && radio.rx_ptr != NULL)
+            {
+                uint32_t bits;
+                uint16_t length = radio_packet_format(radio.rx.data, &bits);
+                memcpy(radio.rx_ptr, radio.rx.data, length);
+                REG(peripheral, 0x408) = radio.rxmatch;
+            }
+            event(peripheral, 0x104);
+            if (shorts & (1 << 4))
+                radio_task(peripheral, 0x014);
+            if (shorts & (1 << 6))
+                radio_task(peripheral, 0x01C);
+            break;
+
+        case 0x108:
+            event(peripheral, 0x108);
+            break;
+
+        case 0x10C:
+            if (state == RADIO_STATE_RX)
+            {
+                REG(peripheral, 0x400) = radio.rx.crc_ok;
+                REG(peripheral, 0x40C) = radio.rx.crc & 0xFFFFFF;
+                radio.receiving = false;
+                radio_set_state(RADIO_STATE_RXIDLE);
+                nrf51_model_stats.radio_rx_packets++;
+            }
+            else
+            {
+                radio_set_state(RADIO_STATE_TXIDLE);
+                nrf51_model_stats.radio_tx_packets++;
+                if (radio.tx_hook)
+                    radio.tx_hook(&radio.tx);
+            }
+            radio_unschedule(0x128);
+            radio.end = now;
+            event(peripheral, 0x10C);
+            if (shorts & (1 << 1))
+                radio_task(peripheral, 0x010);
+            if (shorts & (1 << 5))
+                radio_task(peripheral, 0x008);
+            break;
+
+        case 0x110:
+            radio_set_state(RADIO_STATE_DISABLED);
+            event(peripheral, 0x110);
+            radio.shortcut = true;
+            if (shorts & (1 << 2))
+                radio_task(peripheral, 0x000);
+            if (shorts & (1 << 3))
+                radio_task(peripheral, 0x004);
+            radio.shortcut = false;
+            break;
+
+        case RADIO_DEVICE_ADDRESS:
+            event(peripheral, radio_device_address_match() ? 0x114 : 0x118);
+            break;
+
+        case 0x11C:
+        {
+            uint8_t frequency = REG(peripheral, 0x508);
+            int8_t rssi = (frequency <= 100) ? radio.noise[frequency] : NRF51_MODEL_RADIO_NOISE_DBM;
+            if (radio.receiving)
+                rssi = radio.rx.rssi;
+            REG(peripheral, 0x548) = (uint8_t) (-rssi) & 0x7F;
+            event(peripheral, 0x11C);
+            break;
+        }
+
+        case 0x128:
+            event(peripheral, 0x128);
+            break;
+    }
+}
+
+// a packet starts on air
+static void radio_medium_packet(const nrf51_model_packet_t *packet)
+{
+    uint32_t *peripheral = nrf51_model_radio;
+
+    // the preamble may have begun in the past, as long as the address is still ahead
+    if (REG(peripheral, 0x550) != RADIO_STATE_RX
+     || radio.receiving
+     || REG(peripheral, 0x508) != packet->frequency
+     || radio_address_time(packet->time) < now)
+    {
+        nrf51_model_stats.radio_rx_missed++;
+        return;
+    }
+
+    uint8_t balen = radio_balen();
+    uint64_t mask = (balen == 4) ? 0xFFFFFFFFFFULL : ((1ULL << ((balen + 1) * 8)) - 1);
+
+    for (uint8_t n=0; n<8; n++)
+    {
+        if (!(REG(peripheral, 0x530) & (1 << n)))
+            continue;
+        if ((radio_address(n) & mask) != (packet->address & mask))
+            continue;
+
+        radio.rx = *packet;
+        radio.rxmatch = n;
+        radio.receiving = true;
+        radio_schedule_packet(radio.rx.data, true, packet->time);
+        return;
+    }
+
+    nrf51_model_stats.radio_rx_missed++;
+}
+
+bool nrf51_model_radio_inject(const nrf51_model_packet_t *packet)
+{
+    if (radio.medium_count >= NRF51_MODEL_MEDIUM_SIZE)
+        return false;
+
+    // keep the medium sorted by time
+    uint8_t i = radio.medium_count++;
+    while (i > 0 && radio.medium[i-1].time > packet->time)
+    {
+        radio.medium[i] = radio.medium[i-1];
+        i--;
+    }
+    radio.medium[i] = *packet;
+
+    return true;
+}
+
+void nrf51_model_radio_set_tx_hook(nrf51_model_packet_hook_t hook)
+{
+    radio.tx_hook = hook;
+}
+
+void nrf51_model_radio_set_tx_start_hook(nrf51_model_packet_hook_t hook)
+{
+    radio.tx_start_hook = hook;
+}
+
+void nrf51_model_radio_set_noise(uint8_t frequency, int8_t dbm)
+{
+    if (frequency <= 100)
+        radio.noise[frequency] = dbm;
+}
+
+/*
+ * Register writes with side effects
+ */
+static void write_one_registers(void)
+{
+    for (uint8_t i=0; i<PERIPHERAL_COUNT; i++)
+    {
+        uint32_t *peripheral = peripherals[i].registers;
+
+        // INTENSET and INTENCLR operate on INTEN
+        if (peripherals[i].irq != NO_IRQ)
+        {
+            REG(peripheral, 0x300) |= REG(peripheral, 0x304);
+            REG(peripheral, 0x300) &= ~REG(peripheral, 0x308);
+            REG(peripheral, 0x304) = 0;
+            REG(peripheral, 0x308) = 0;
+        }
+    }
+
+    REG(nrf51_model_ppi, 0x500) |= REG(nrf51_model_ppi, 0x504);
+    REG(nrf51_model_ppi, 0x500) &= ~REG(nrf51_model_ppi, 0x508);
+    REG(nrf51_model_ppi, 0x504) = 0;
+    REG(nrf51_model_ppi, 0x508) = 0;
+
+    nvic_enabled |= REG(nrf51_model_scs, 0x100);
+    nvic_enabled &= ~REG(nrf51_model_scs, 0x180);
+    REG(nrf51_model_scs, 0x100) = 0;
+    REG(nrf51_model_scs, 0x180) = 0;
+
+    gpio_update();
+    uart_update();
+}
+
+/*
+ * Apply all register writes since the previous access:
+ * trigger the tasks written to and clear the task registers
+ */
+static void flush(void)
+{
+    write_one_registers();
+
+    for (uint8_t i=0; i<PERIPHERAL_COUNT; i++)
+    {
+        uint32_t *peripheral = peripherals[i].registers;
+        for (uint32_t offset=0; offset<0x100; offset+=4)
+        {
+            if (REG(peripheral, offset))
+            {
+                REG(peripheral, offset) = 0;
+                peripherals[i].task(peripheral, offset);
+            }
+        }
+    }
+}
+
+/*
+ * Time
+ */
+static uint64_t next_deadline(void)
+{
+    uint64_t deadline = NEVER;
+
+    for (uint8_t t=0; t<3; t++)
+    {
+        for (uint8_t n=0; n<4; n++)
+        {
+            uint64_t d = timer_deadline(nrf51_model_timer[t], n);
+            if (d < deadline)
+                deadline = d;
+        }
+    }
+
+    for (uint8_t i=0; i<radio.scheduled; i++)
+    {
+        if (radio.schedule[i].time < deadline)
+            deadline = radio.schedule[i].time;
+    }
+
+    if (radio.medium_count > 0 && radio.medium[0].time < deadline)
+        deadline = radio.medium[0].time;
+
+    if (uart.tx_busy && uart.tx_done < deadline)
+        deadline = uart.tx_done;
+
+    if (uart.rx_started && uart.rx_head != uart.rx_tail && uart.rx_next < deadline)
+        deadline = uart.rx_next;
+
+    if (rng.running && rng.ready < deadline)
+        deadline = rng.ready;
+
+    return deadline;
+}
+
+// fire one event of the other peripherals, which is due
+static bool fire(void)
+{
+    for (uint8_t i=0; i<radio.scheduled; i++)
+    {
+        if (radio.schedule[i].time <= now)
+        {
+            uint32_t event = radio.schedule[i].event;
+            radio.schedule[i] = radio.schedule[--radio.scheduled];
+            radio_fire(event);
+            return true;
+        }
+    }
+
+    if (radio.medium_count > 0 && radio.medium[0].time <= now)
+    {
+        nrf51_model_packet_t packet = radio.medium[0];
+        radio.medium_count--;
+        memmove(&radio.medium[0], &radio.medium[1], radio.medium_count * sizeof(radio.medium[0]));
+        radio_medium_packet(&packet);
+        return true;
+    }
+
+    if (uart.tx_busy && uart.tx_done <= now)
+    {
+        uart_transmitted();
+        return true;
+    }
+
+    if (uart.rx_started && uart.rx_head != uart.rx_tail && uart.rx_next <= now)
+    {
+        uart_received();
+        return true;
+    }
+
+    if (rng.running && rng.ready <= now)
+    {
+        rng_ready();
+        return true;
+    }
+
+    return false;
+}
+
+static void advance_to(uint64_t time)
+{
+    // packets injected into the past are due right away, time never goes back
+    if (time < now)
+        time = now;
+
+    while (true)
+    {
+        uint64_t deadline = next_deadline();
+        if (deadline > time)
+            break;
+        if (deadline < now)
+            deadline = now;
+
+        // a compare is due exactly when its counter changes to CC,
+        // which must be determined before the time moves on
+        uint16_t compares = 0;
+        for (uint8_t t=0; t<3; t++)
+        {
+            for (uint8_t n=0; n<4; n++)
+            {
+                if (timer_deadline(nrf51_model_timer[t], n) == deadline)
+                    compares |= 1 << (t*4 + n);
+            }
+        }
+
+        if (REG(nrf51_model_radio, 0x550) != RADIO_STATE_DISABLED)
+            nrf51_model_stats.radio_active_cycles += deadline - now;
+        now = deadline;
+
+        for (uint8_t i=0; i<12; i++)
+        {
+            if (compares & (1 << i))
+                timer_compare(nrf51_model_timer[i/4], i%4);
+        }
+
+        while (fire());
+    }
+
+    if (REG(nrf51_model_radio, 0x550) != RADIO_STATE_DISABLED)
+        nrf51_model_stats.radio_active_cycles += time - now;
+    now = time;
+}
+
+/*
+ * Interrupts
+ */
+static bool irq_pending(uint8_t irq)
+{
+    for (uint8_t i=0; i<PERIPHERAL_COUNT; i++)
+    {
+        if (peripherals[i].irq != irq)
+            continue;
+
+        uint32_t *peripheral = peripherals[i].registers;
+        uint32_t inten = REG(peripheral, 0x300);
+        for (uint8_t bit=0; inten != 0; bit++, inten >>= 1)
+        {
+            if ((inten & 1) && REG(peripheral, 0x100 + bit*4))
+                return true;
+        }
+    }
+    return false;
+}
+
+static bool any_irq_pending(void)
+{
+    for (uint8_t i=0; i<PERIPHERAL_COUNT; i++)
+    {
+        uint8_t irq = peripherals[i].irq;
+        if (irq != NO_IRQ && (nvic_enabled & (1 << irq)) && irq_pending(irq))
+            return true;
+    }
+    return false;
+}
+
+static void dispatch(void)
+{
+    if (primask || in_isr)
+        return;
+
+    bool serviced;
+    do
+    {
+        serviced = false;
+
+        // lower numbers first, all interrupts have the same priority
+        for (uint8_t i=0; i<PERIPHERAL_COUNT; i++)
+        {
+            uint8_t irq = peripherals[i].irq;
+            if (irq == NO_IRQ || !(nvic_enabled & (1 << irq)) || !irq_pending(irq))
+                continue;
+
+            in_isr = true;
+            current_irq = irq;
+            nrf51_model_stats.interrupts[irq]++;
+            peripherals[i].handler();
+            in_isr = false;
+
+            flush();
+            serviced = true;
+            break;
+        }
+    }
+    while (serviced);
+}
+
+static void nrf51_model_default_handler(void)
+{
+    fprintf(stderr, "nrf51_model: unhandled interrupt %d, disabling it\n", current_irq);
+    nvic_enabled &= ~(1 << current_irq);
+}
+
+/*
+ * CPU core
+ */
+uintptr_t nrf51_model_access(uint32_t *peripheral)
+{
+    nrf51_model_stats.register_accesses++;
+
+    flush();
+    advance_to(now + 1);
+    dispatch();
+
+    return (uintptr_t) peripheral;
+}
+
+void nrf51_model_irq_disable(void)
+{
+    primask = true;
+}
+
+void nrf51_model_irq_enable(void)
+{
+    primask = false;
+    flush();
+    dispatch();
+}
+
+void nrf51_model_nop(void)
+{
+    flush();
+    advance_to(now + 1);
+    dispatch();
+}
+
+void nrf51_model_wfi(void)
+{
+    flush();
+
+    // wake up upon a pending interrupt, even if PRIMASK is set
+    while (!any_irq_pending())
+    {
+        uint64_t deadline = next_deadline();
+        if (deadline == NEVER)
+        {
+            fprintf(stderr, "nrf51_model: WFI without any event to wait for\n");
+            abort();
+        }
+        advance_to(deadline);
+    }
+
+    dispatch();
+}
+
+/*
+ * Emulation control
+ */
+uint64_t nrf51_model_time(void)
+{
+    return now;
+}
+
+void nrf51_model_run_until(uint64_t cycles)
+{
+    flush();
+    dispatch();
+
+    while (now < cycles)
+    {
+        uint64_t deadline = next_deadline();
+        advance_to((deadline < cycles) ? deadline : cycles);
+        dispatch();
+    }
+}
+
+void nrf51_model_run(uint32_t us)
+{
+    nrf51_model_run_until(now + NRF51_MODEL_CYCLES(us));
+}
+
+__attribute__ ((constructor))
+void nrf51_model_reset(void)
+{
+    memset(nrf51_model_clock,  0, sizeof(nrf51_model_clock));
+    memset(nrf51_model_radio,  0, sizeof(nrf51_model_radio));
+    memset(nrf51_model_uart,   0, sizeof(nrf51_model_uart));
+    memset(nrf51_model_gpiote, 0, sizeof(nrf51_model_gpiote));
+    memset(nrf51_model_timer,  0, sizeof(nrf51_model_timer));
+    memset(nrf51_model_rng,    0, sizeof(nrf51_model_rng));
+    memset(nrf51_model_ppi,    0, sizeof(nrf51_model_ppi));
+    memset(nrf51_model_ficr,   0, sizeof(nrf51_model_ficr));
+    memset(nrf51_model_gpio,   0, sizeof(nrf51_model_gpio));
+    memset(nrf51_model_scs,    0, sizeof(nrf51_model_scs));
+    memset(&nrf51_model_stats, 0, sizeof(nrf51_model_stats));
+    memset(timers, 0, sizeof(timers));
+    memset(&radio, 0, sizeof(radio));
+    memset(&uart,  0, sizeof(uart));
+    memset(&rng,   0, sizeof(rng));
+
+    now = 0;
+    primask = false;
+    in_isr = false;
+    nvic_enabled = 0;
+
+    // reset values
+    REG(nrf51_model_radio, 0x508) = 2;
+    REG(nrf51_model_uart, 0x51C) = UART_TXD_EMPTY;
+    REG(nrf51_model_uart, 0x524) = 0x04000000;
+    for (uint8_t i=0; i<=100; i++)
+        radio.noise[i] = NRF51_MODEL_RADIO_NOISE_DBM;
+
+    // factory information: a random static device address, no trim overrides
+    REG(nrf51_model_ficr, 0x010) = 1024;
+    REG(nrf51_model_ficr, 0x014) = 256;
+    REG(nrf51_model_ficr, 0x0A0) = 1;
+    REG(nrf51_model_ficr, 0x0A4) = 0x89ABCDEF;
+    REG(nrf51_model_ficr, 0x0A8) = 0xFFFFC567;
+    REG(nrf51_model_ficr, 0x0AC) = 0xFFFFFFFF;
+
+    uart.tx_hook = uart_stdout;
+    rng.seed = 0x2545F491;
+}
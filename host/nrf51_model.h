@@ -0,0 +1,213 @@
+/**
+ * Register-level model of the nRF51 peripherals
+ * for building and running the drivers on a PC
+ *
+ * The model provides memory for the peripheral registers
+ * and emulates the hardware behind them: tasks, events,
+ * shortcuts, PPI, interrupts and the timing of the
+ * RADIO, TIMER, UART, RNG, CLOCK, GPIO and GPIOTE peripherals.
+ *
+ * Drivers are compiled unmodified with
+ *
+ *      -DNRF51_HOST -no-pie -include host/nrf51_model.h
+ *
+ * which points the *_BASE macros of the register headers
+ * at the model (see the "host" target in the Makefile).
+ * Every register access first applies pending writes to task registers
+ * and then advances the emulated time by one CPU cycle,
+ * so busy-waiting loops make progress and the order of task writes is kept.
+ * Interrupt handlers are invoked between register accesses,
+ * from NOP and WFI and while nrf51_model_run() advances the time.
+ *
+ * Like on the target, EasyDMA addresses are 32 bits wide:
+ * buffers passed to the radio must be static (not on the stack),
+ * which holds for non-PIE executables only.
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ */
+
+#ifndef NRF51_MODEL_H
+#define NRF51_MODEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// number of 32 bit registers per peripheral (4 KiB of address space)
+#define NRF51_MODEL_REGISTERS       1024
+
+// the emulated CPU and peripherals run at 16 MHz
+#define NRF51_MODEL_CYCLES(us)      ((uint64_t) (us) * 16)
+
+/*
+ * Register memory
+ */
+extern uint32_t nrf51_model_clock[NRF51_MODEL_REGISTERS];
+extern uint32_t nrf51_model_radio[NRF51_MODEL_REGISTERS];
+extern uint32_t nrf51_model_uart[NRF51_MODEL_REGISTERS];
+extern uint32_t nrf51_model_gpiote[NRF51_MODEL_REGISTERS];
+extern uint32_t nrf51_model_timer[3][NRF51_MODEL_REGISTERS];
+extern uint32_t nrf51_model_rng[NRF51_MODEL_REGISTERS];
+extern uint32_t nrf51_model_ppi[NRF51_MODEL_REGISTERS];
+extern uint32_t nrf51_model_ficr[NRF51_MODEL_REGISTERS];
+extern uint32_t nrf51_model_gpio[NRF51_MODEL_REGISTERS];
+extern uint32_t nrf51_model_scs[NRF51_MODEL_REGISTERS];
+
+/**
+ * Account for one register access and return
+ * the base address of the given peripheral
+ */
+uintptr_t nrf51_model_access(uint32_t *peripheral);
+
+#define CLOCK_BASE      nrf51_model_access(nrf51_model_clock)
+#define POWER_BASE      nrf51_model_access(nrf51_model_clock)
+#define RADIO_BASE      nrf51_model_access(nrf51_model_radio)
+#define UART_BASE       nrf51_model_access(nrf51_model_uart)
+#define GPIOTE_BASE     nrf51_model_access(nrf51_model_gpiote)
+#define TIMER0          nrf51_model_access(nrf51_model_timer[0])
+#define TIMER1          nrf51_model_access(nrf51_model_timer[1])
+#define TIMER2          nrf51_model_access(nrf51_model_timer[2])
+#define RNG_BASE        nrf51_model_access(nrf51_model_rng)
+#define PPI_BASE        nrf51_model_access(nrf51_model_ppi)
+#define FICR_BASE       nrf51_model_access(nrf51_model_ficr)
+#define GPIO_BASE       nrf51_model_access(nrf51_model_gpio)
+#define SCS_BASE        nrf51_model_access(nrf51_model_scs)
+
+/*
+ * CPU core
+ */
+void nrf51_model_irq_disable(void);
+void nrf51_model_irq_enable(void);
+void nrf51_model_nop(void);
+void nrf51_model_wfi(void);
+
+/*
+ * Emulation control
+ */
+
+/**
+ * Restore the power-on state of all peripherals
+ * and restart the emulated time at zero.
+ * Invoked automatically before main().
+ */
+void nrf51_model_reset(void);
+
+/**
+ * Current emulated time in CPU cycles
+ */
+uint64_t nrf51_model_time(void);
+
+/**
+ * Advance the emulated time by the given number of microseconds
+ * while servicing interrupts
+ */
+void nrf51_model_run(uint32_t us);
+
+/**
+ * Advance the emulated time up to the given cycle
+ * while servicing interrupts
+ */
+void nrf51_model_run_until(uint64_t cycles);
+
+/*
+ * Radio medium
+ */
+
+// Maximum number of bytes per packet in RAM (S0, LENGTH, S1 and payload)
+#define NRF51_MODEL_PACKET_SIZE     258
+
+// Maximum number of packets on air, that are waiting to be received
+#define NRF51_MODEL_MEDIUM_SIZE     32
+
+// Radio timing
+#define NRF51_MODEL_RADIO_RAMPUP_US         130
+#define NRF51_MODEL_RADIO_TXDISABLE_US      6
+#define NRF51_MODEL_RADIO_RXDISABLE_US      1
+
+// Noise floor reported by RSSISAMPLE on idle channels
+#define NRF51_MODEL_RADIO_NOISE_DBM         -100
+
+typedef struct
+{
+    uint64_t time;          // start of the preamble in CPU cycles
+    uint8_t  frequency;     // channel as in RADIO_FREQUENCY
+    uint64_t address;       // prefix byte followed by the base address bytes
+    int8_t   rssi;          // signal strength in dBm
+    bool     crc_ok;
+    uint32_t crc;
+    uint16_t length;        // number of bytes used in data
+    uint8_t  data[NRF51_MODEL_PACKET_SIZE];    // packet as in RAM
+} nrf51_model_packet_t;
+
+typedef void (*nrf51_model_packet_hook_t)(const nrf51_model_packet_t *packet);
+
+/**
+ * Put a packet on air
+ *
+ * It is received if the radio is listening on the packet's
+ * frequency and address, when the preamble starts.
+ * The preamble may have started in the past, as long as
+ * the address has not been on air yet.
+ * Returns false, if the medium is full.
+ */
+bool nrf51_model_radio_inject(const nrf51_model_packet_t *packet);
+
+/**
+ * Invoke the given function upon every transmitted packet (at its END)
+ */
+void nrf51_model_radio_set_tx_hook(nrf51_model_packet_hook_t hook);
+
+/**
+ * Invoke the given function, when a packet goes on air (upon START),
+ * e.g. to relay it to other models in time for its address
+ */
+void nrf51_model_radio_set_tx_start_hook(nrf51_model_packet_hook_t hook);
+
+/**
+ * Configure the signal strength sampled on an otherwise idle channel
+ */
+void nrf51_model_radio_set_noise(uint8_t frequency, int8_t dbm);
+
+/*
+ * UART line
+ */
+
+typedef void (*nrf51_model_uart_hook_t)(uint8_t c);
+
+/**
+ * Invoke the given function upon every transmitted byte.
+ * By default bytes are written to stdout.
+ */
+void nrf51_model_uart_set_tx_hook(nrf51_model_uart_hook_t hook);
+
+/**
+ * Let the UART receive the given bytes at the configured baudrate
+ */
+bool nrf51_model_uart_inject(const uint8_t *data, uint16_t length);
+
+/*
+ * Random number generator
+ */
+
+/**
+ * Seed the generator (xorshift32), e.g. to tell several models apart;
+ * must not be 0
+ */
+void nrf51_model_rng_seed(uint32_t seed);
+
+/*
+ * Statistics, e.g. for benchmarks
+ */
+typedef struct
+{
+    uint64_t register_accesses;
+    uint32_t interrupts[32];
+    uint32_t radio_tx_packets;
+    uint32_t radio_rx_packets;
+    uint32_t radio_rx_missed;
+    uint64_t radio_active_cycles;   // not in state DISABLED
+} nrf51_model_stats_t;
+
+extern nrf51_model_stats_t nrf51_model_stats;
+
+#endif // NRF51_MODEL_H
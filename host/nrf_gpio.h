@@ -0,0 +1,40 @@
+/**
+ * Subset of the Nordic SDK's GPIO helpers used by the drivers,
+ * mapped onto gpio.h for builds without the SDK (see nrf51_model.h)
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ */
+
+#ifndef NRF_GPIO_H
+#define NRF_GPIO_H
+
+#include <stdint.h>
+
+#include "gpio.h"
+
+typedef enum
+{
+    NRF_GPIO_PIN_DIR_INPUT,
+    NRF_GPIO_PIN_DIR_OUTPUT
+} nrf_gpio_pin_dir_t;
+
+static inline void nrf_gpio_pin_set(uint32_t pin)
+{
+    gpio_set(pin);
+}
+
+static inline void nrf_gpio_pin_clear(uint32_t pin)
+{
+    gpio_clear(pin);
+}
+
+static inline void nrf_gpio_pin_dir_set(uint32_t pin, nrf_gpio_pin_dir_t direction)
+{
+    if (direction == NRF_GPIO_PIN_DIR_OUTPUT)
+        gpio_config_output(pin);
+    else
+        gpio_config_input(pin);
+}
+
+#endif
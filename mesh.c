@@ -0,0 +1,325 @@
+/**
+ * Managed flooding mesh
+ * for the Nordic Semiconductor nRF51 series
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ *
+ * Every node relays every packet it has not seen before,
+ * until its TTL is used up. Naive flooding makes all neighbours
+ * of a sender relay at once, so the copies collide and the channel
+ * is busy with redundant transmissions. Here
+ *   - the (source, sequence number) pairs seen recently are kept in a small
+ *     set-associative cache, so a packet is delivered and relayed only once,
+ *   - relays wait for a pseudo-random backoff, so neighbours spread out,
+ *   - a relay is cancelled, if the packet has been heard MESH_SUPPRESS times
+ *     during the backoff: the neighbourhood is covered already.
+ *
+ * The radio receives continuously. Sends are queued and paced by a timer
+ * of the timer library, so the CPU may sleep in between: the timer
+ * interrupt starts the transmission, the radio interrupt the receiver
+ * and the next backoff.
+ */
+
+#include "mesh.h"
+
+static volatile bool running = false;
+static uint16_t own_address = MESH_ADDRESS_NONE;
+static uint16_t own_seq = 0;
+static mesh_receive_callback_t receive_callback = NULL;
+static int8_t backoff_timer = -1;
+static volatile bool waiting = false;       // backoff_timer is running
+static mesh_statistics_t statistics;
+
+#define le16(p)             ((p)[0] | ((p)[1] << 8))
+
+#define mesh_key(source, seq)   (((uint32_t) (source) << 16) | (seq))
+
+static uint32_t cache[MESH_CACHE_SETS][MESH_CACHE_WAYS];
+static uint8_t cache_next[MESH_CACHE_SETS];
+
+/*
+ * FIFO of PDUs to be sent: the head is on air or waiting for its backoff.
+ * Only the radio and the timer interrupt touch it,
+ * or mesh_send() with interrupts disabled.
+ */
+static struct
+{
+    uint8_t pdu[RADIO_PDU_MAX];
+    uint8_t heard;              // copies received since it was queued
+    bool    cancelled;
+} queue[MESH_QUEUE_SIZE];
+static uint8_t queue_head = 0;
+static volatile uint8_t queue_count = 0;
+
+static void mesh_transmit();
+
+/**
+ * Pseudo-random backoff from the hardware random number generator
+ */
+static uint32_t mesh_backoff()
+{
+    return MESH_BACKOFF_MIN + (rng_get_byte() * MESH_BACKOFF_WINDOW) / 255;
+}
+
+/**
+ * Set of the cache, to which a key belongs (Fibonacci hashing)
+ */
+static uint8_t mesh_cache_set(uint32_t key)
+{
+    return ((key * 2654435761UL) >> 16) & (MESH_CACHE_SETS - 1);
+}
+
+/**
+ * Whether the key has been seen recently; if not, it is remembered
+ */
+static bool mesh_cache_seen(uint32_t key)
+{
+    uint8_t set = mesh_cache_set(key);
+
+    for (uint8_t way=0; way<MESH_CACHE_WAYS; way++)
+    {
+        if (cache[set][way] == key)
+            return true;
+    }
+
+    cache[set][cache_next[set]] = key;
+    if (++cache_next[set] == MESH_CACHE_WAYS)
+        cache_next[set] = 0;
+
+    return false;
+}
+
+/**
+ * Begin the backoff of the head of the queue
+ */
+static void mesh_schedule()
+{
+    if (!running || waiting || queue_count == 0)
+        return;
+
+    waiting = true;
+    timer_start(backoff_timer, mesh_backoff(), mesh_transmit);
+}
+
+/**
+ * Append a PDU to the queue, returns NULL if it is full
+ */
+static uint8_t* mesh_enqueue(uint16_t source, uint16_t seq, uint8_t ttl, const uint8_t *data, uint8_t length)
+{
+    if (queue_count == MESH_QUEUE_SIZE)
+    {
+        statistics.dropped++;
+        return NULL;
+    }
+
+    uint8_t index = (queue_head + queue_count) % MESH_QUEUE_SIZE;
+    uint8_t *pdu = queue[index].pdu;
+
+    pdu[0] = 0;
+    pdu[1] = MESH_OFFSET_DATA - 2 + length;
+    pdu[MESH_OFFSET_SOURCE]     = source;
+    pdu[MESH_OFFSET_SOURCE + 1] = source >> 8;
+    pdu[MESH_OFFSET_SEQ]        = seq;
+    pdu[MESH_OFFSET_SEQ + 1]    = seq >> 8;
+    pdu[MESH_OFFSET_TTL]        = ttl;
+    memcpy(&pdu[MESH_OFFSET_DATA], data, length);
+
+    queue[index].heard = 0;
+    queue[index].cancelled = false;
+    queue_count++;
+
+    return pdu;
+}
+
+/**
+ * A queued relay has been heard from a neighbour
+ */
+static void mesh_heard(uint16_t source, uint16_t seq)
+{
+    for (uint8_t i=0; i<queue_count; i++)
+    {
+        uint8_t index = (queue_head + i) % MESH_QUEUE_SIZE;
+        const uint8_t *pdu = queue[index].pdu;
+
+        if (le16(&pdu[MESH_OFFSET_SOURCE]) == source
+         && le16(&pdu[MESH_OFFSET_SEQ]) == seq
+         && source != own_address
+         && ++queue[index].heard >= MESH_SUPPRESS)
+            queue[index].cancelled = true;
+    }
+}
+
+/**
+ * Radio packet callback
+ */
+static void mesh_received(const radio_packet_t *packet, bool active)
+{
+    const uint8_t *pdu = packet->pdu;
+
+    (void) active;
+
+    if (packet->crc && pdu[1] >= MESH_OFFSET_DATA - 2 && pdu[1] <= MESH_OFFSET_DATA - 2 + MESH_DATA_MAX)
+    {
+        uint16_t source = le16(&pdu[MESH_OFFSET_SOURCE]);
+        uint16_t seq = le16(&pdu[MESH_OFFSET_SEQ]);
+        uint8_t ttl = pdu[MESH_OFFSET_TTL];
+        uint8_t length = pdu[1] - (MESH_OFFSET_DATA - 2);
+
+        if (source == MESH_ADDRESS_NONE)
+        {
+            // invalid
+        }
+        else if (mesh_cache_seen(mesh_key(source, seq)))
+        {
+            statistics.duplicates++;
+            mesh_heard(source, seq);
+        }
+        else
+        {
+            statistics.received++;
+            if (receive_callback)
+                receive_callback(source, &pdu[MESH_OFFSET_DATA], length);
+
+            if (ttl > 1 && mesh_enqueue(source, seq, ttl - 1, &pdu[MESH_OFFSET_DATA], length))
+                mesh_schedule();
+        }
+    }
+
+    radio_release_pdu(pdu);
+}
+
+/**
+ * Timer callback: the backoff is over, send the head of the queue
+ */
+static void mesh_transmit()
+{
+    waiting = false;
+
+    if (!running)
+        return;
+
+    // relays, that enough neighbours have sent already
+    while (queue_count > 0 && queue[queue_head].cancelled)
+    {
+        statistics.suppressed++;
+        queue_head = (queue_head + 1) % MESH_QUEUE_SIZE;
+        queue_count--;
+    }
+
+    if (queue_count == 0)
+        return;
+
+    if (radio_is_receiving())
+    {
+        mesh_schedule();
+        return;
+    }
+
+    radio_stop();
+    radio_send(queue[queue_head].pdu, 0);
+}
+
+/**
+ * Radio send callback: return to receiving and continue with the queue
+ */
+static void mesh_sent(bool active)
+{
+    (void) active;
+
+    statistics.sent++;
+    queue_head = (queue_head + 1) % MESH_QUEUE_SIZE;
+    queue_count--;
+
+    if (!running)
+        return;
+
+    radio_start_receiver();
+    mesh_schedule();
+}
+
+void mesh_init()
+{
+    if (backoff_timer < 0)
+    {
+        timer_init();
+        backoff_timer = timer_create(TIMER_SINGLESHOT);
+    }
+
+    rng_init();
+}
+
+/**
+ * Join the mesh with the given address; new packets are passed
+ * to the callback from the radio interrupt, the data is valid
+ * until it returns
+ *
+ * The radio must be initialized. It is taken over until mesh_stop().
+ */
+bool mesh_start(uint16_t address, mesh_receive_callback_t callback)
+{
+    if (backoff_timer < 0 || address == MESH_ADDRESS_NONE)
+        return false;
+
+    if (!radio_prepare(MESH_CHANNEL, MESH_ACCESS_ADDRESS, MESH_CRCINIT))
+        return false;
+
+    own_address = address;
+    receive_callback = callback;
+    queue_head = 0;
+    queue_count = 0;
+    waiting = false;
+    memset(&statistics, 0, sizeof(statistics));
+    memset(cache, 0xFF, sizeof(cache));
+    memset(cache_next, 0, sizeof(cache_next));
+
+    radio_set_event_handler(NULL);
+    radio_set_callbacks(NULL, mesh_sent);
+    radio_set_packet_callback(mesh_received);
+
+    running = true;
+    radio_start_receiver();
+
+    return true;
+}
+
+/**
+ * Flood up to MESH_DATA_MAX bytes across the given number of hops (1-255)
+ *
+ * The data is copied. Returns false, if the queue is full.
+ */
+bool mesh_send(const uint8_t *data, uint8_t length, uint8_t ttl)
+{
+    bool queued;
+
+    if (!running || length > MESH_DATA_MAX || ttl == 0)
+        return false;
+
+    // the radio and the timer interrupt use the queue as well
+    DINT;
+    mesh_cache_seen(mesh_key(own_address, own_seq));
+    queued = mesh_enqueue(own_address, own_seq, ttl, data, length) != NULL;
+    if (queued)
+    {
+        own_seq++;
+        mesh_schedule();
+    }
+    EINT;
+
+    return queued;
+}
+
+const mesh_statistics_t* mesh_get_statistics()
+{
+    return &statistics;
+}
+
+void mesh_stop()
+{
+    running = false;
+    timer_stop(backoff_timer);
+    waiting = false;
+    radio_stop();
+    radio_set_packet_callback(NULL);
+    radio_set_callbacks(NULL, NULL);
+}
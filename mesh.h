@@ -0,0 +1,109 @@
+/**
+ * Managed flooding mesh
+ * for the Nordic Semiconductor nRF51 series
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ *
+ * Requires:
+ *      Radio library
+ *      Timer library
+ *      Random Number Generator (RNG) library
+ */
+
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "radio.h"
+#include "timers.h"
+#include "random.h"
+
+/*
+ * Channel and address of the mesh
+ */
+#ifndef MESH_CHANNEL
+#define MESH_CHANNEL                10
+#endif
+
+#ifndef MESH_ACCESS_ADDRESS
+#define MESH_ACCESS_ADDRESS         0x4C7A93D5
+#endif
+
+#ifndef MESH_CRCINIT
+#define MESH_CRCINIT                0x555555
+#endif
+
+// no node may use this address
+#define MESH_ADDRESS_NONE           0xFFFF
+
+/*
+ * PDU: header and length, followed by the originator's address,
+ * its sequence number (little endian), the hops left (TTL) and the data
+ */
+#define MESH_OFFSET_SOURCE          2
+#define MESH_OFFSET_SEQ             4
+#define MESH_OFFSET_TTL             6
+#define MESH_OFFSET_DATA            7
+#define MESH_DATA_MAX               (RADIO_PDU_MAX - MESH_OFFSET_DATA)
+
+/*
+ * Cache of the (source, sequence number) pairs seen recently:
+ * a pair is hashed to one of MESH_CACHE_SETS sets of MESH_CACHE_WAYS entries,
+ * where it replaces the oldest one
+ */
+#ifndef MESH_CACHE_SETS
+#define MESH_CACHE_SETS             16
+#endif
+
+#ifndef MESH_CACHE_WAYS
+#define MESH_CACHE_WAYS             4
+#endif
+
+#if MESH_CACHE_SETS & (MESH_CACHE_SETS - 1)
+#error "MESH_CACHE_SETS must be a power of two"
+#endif
+
+// packets waiting to be sent or relayed
+#ifndef MESH_QUEUE_SIZE
+#define MESH_QUEUE_SIZE             8
+#endif
+
+/*
+ * Before a packet is sent, the node waits for MESH_BACKOFF_MIN plus
+ * a pseudo-random part of MESH_BACKOFF_WINDOW microseconds,
+ * in which neighbours relaying the same packet are heard
+ */
+#ifndef MESH_BACKOFF_MIN
+#define MESH_BACKOFF_MIN            200
+#endif
+
+#ifndef MESH_BACKOFF_WINDOW
+#define MESH_BACKOFF_WINDOW         5000
+#endif
+
+// a relay is cancelled, after the packet has been heard this often meanwhile
+#ifndef MESH_SUPPRESS
+#define MESH_SUPPRESS               2
+#endif
+
+typedef void (*mesh_receive_callback_t) (uint16_t source, const uint8_t *data, uint8_t length);
+
+typedef struct
+{
+    uint32_t received;          // new packets, delivered to the callback
+    uint32_t duplicates;        // packets found in the cache
+    uint32_t sent;              // originated and relayed packets
+    uint32_t suppressed;        // relays cancelled, as enough neighbours had relayed
+    uint32_t dropped;           // the queue was full
+} mesh_statistics_t;
+
+void mesh_init();
+bool mesh_start(uint16_t address, mesh_receive_callback_t callback);
+bool mesh_send(const uint8_t *data, uint8_t length, uint8_t ttl);
+const mesh_statistics_t* mesh_get_statistics();
+void mesh_stop();
+
+#endif
@@ -8,7 +8,9 @@
 /*
  * Power registers
  */
-#define POWER_BASE   0x4000000
+#ifndef POWER_BASE
+#define POWER_BASE   0x40000000
+#endif
 
 // configure power to RAM banks
 #define POWER_RAMON  (*(volatile uint32_t*) (POWER_BASE+0x524))
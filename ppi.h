@@ -12,7 +12,9 @@
 
 #include <stdint.h>
 
+#ifndef PPI_BASE
 #define PPI_BASE        0x4001F000
+#endif
 
 /*
  * Tasks
@@ -23,12 +25,12 @@ typedef struct
     uint32_t DISABLE;
 } ppi_chg_en_dis_t;
 
-#define PPI_TASK_CHG    ((volatile ppi_chg_en_dis_t[4]) {PPI_BASE+0x000})
+#define PPI_TASK_CHG    ((volatile ppi_chg_en_dis_t*) (PPI_BASE+0x000))   // [4]
 
 /*
  * Registers
  */
-// enable/disable PPI channels
+// enable/disable PPI channels (one bit per channel)
 #define PPI_CHEN        (*(volatile uint32_t*) (PPI_BASE+0x500))
 #define PPI_CHENSET     (*(volatile uint32_t*) (PPI_BASE+0x504))
 #define PPI_CHENCLR     (*(volatile uint32_t*) (PPI_BASE+0x508))
@@ -40,9 +42,9 @@ typedef struct
     uint32_t TEP;
 } ppi_ch_t;
 
-#define PPI_CH          ((volatile ppi_ch_t[16]) {PPI_BASE+0x510})
+#define PPI_CH          ((volatile ppi_ch_t*) (PPI_BASE+0x510))   // [16]
 
 // channel groups
-#define PPI_CHG         ((volatile uint32_t[4]) {PPI_BASE+0x800})
+#define PPI_CHG         ((volatile uint32_t*) (PPI_BASE+0x800))   // [4]
 
 #endif
@@ -53,19 +53,19 @@ void pwm_setup(
     // configure PPI connection between GPIOTE and Timer:
 
     // connect "Timer counter reaches zero"-event to "Switch GPIO pin to HIGH"-task
-    PPI_CH[pwm->ppi_channel0]->EEP = &TIMER_EVENT_COMPARE(pwm->timer)[pwm->timer_counter0];
-    PPI_CH[pwm->ppi_channel0]->TEP = &GPIOTE_TASK_OUT[pwm->gpiote_channel0];
+    PPI_CH[pwm->ppi_channel0].EEP = (uint32_t) &TIMER_EVENT_COMPARE(pwm->timer)[pwm->timer_counter0];
+    PPI_CH[pwm->ppi_channel0].TEP = (uint32_t) &GPIOTE_TASK_OUT[pwm->gpiote_channel0];
 
     // connect "Timer counter reaches counter1 value"-event to "Switch GPIO pin to LOW"-task
-    PPI_CH[pwm->ppi_channel1]->EEP = &TIMER_EVENT_COMPARE(pwm->timer)[pwm->timer_counter1];
-    PPI_CH[pwm->ppi_channel1]->TEP = &GPIOTE_TASK_OUT[pwm->gpiote_channel1];
+    PPI_CH[pwm->ppi_channel1].EEP = (uint32_t) &TIMER_EVENT_COMPARE(pwm->timer)[pwm->timer_counter1];
+    PPI_CH[pwm->ppi_channel1].TEP = (uint32_t) &GPIOTE_TASK_OUT[pwm->gpiote_channel1];
 }
 
 void pwm_start(pwm_t* pwm)
 {
     // enable the configured PPI channels
-    PPI_CHENSET(pwm->ppi_channel0) = 1;
-    PPI_CHENSET(pwm->ppi_channel1) = 1;
+    PPI_CHENSET = (1 << pwm->ppi_channel0)
+                | (1 << pwm->ppi_channel1);
 
     // enable Timer
     TIMER_START(pwm->timer) = 1;
@@ -80,8 +80,8 @@ void pwm_write(pwm_t* pwm, uint32_t value)
 void pwm_stop(pwm_t* pwm)
 {
     // disable the configured PPI channels
-    PPI_CHENCLR(pwm->ppi_channel0) = 1;
-    PPI_CHENCLR(pwm->ppi_channel1) = 1;
+    PPI_CHENCLR = (1 << pwm->ppi_channel0)
+                | (1 << pwm->ppi_channel1);
 
     // stop/shutdown Timer
     TIMER_SHUTDOWN(pwm->timer) = 1;
@@ -14,293 +14,1581 @@
 
 #include "radio.h"
 
-#define RADIO_BUFFER_LENGTH            RADIO_PDU_MAX
+#define RADIO_BUFFER_LENGTH            RADIO_RX_BUFFER_LENGTH
 #define MAX_PAYLOAD_LENGTH            (RADIO_PDU_MAX - 2)
 
-static uint8_t inbuf[RADIO_BUFFER_LENGTH] __attribute__ ((aligned));
-//static uint8_t *outbuf;
+#if RADIO_RX_BUFFER_LENGTH > RADIO_PACKET_MAX
+#error "RADIO_RX_BUFFER_LENGTH must not exceed RADIO_PACKET_MAX"
+#endif
+
+#if RADIO_RX_POOL_SIZE < 2
+#error "RADIO_RX_POOL_SIZE must be at least 2"
+#endif
+
+/*
+ * Receive buffer pool
+ *
+ * rx_current is the buffer the radio is receiving into,
+ * rx_next has already been written to RADIO_PACKETPTR (which is double-buffered)
+ * and is picked up by the radio upon the next START.
+ * The used flags are only set in the ISR and only cleared by radio_release_pdu(),
+ * so single byte stores suffice and no critical section is required.
+ */
+static uint8_t rx_pool[RADIO_RX_POOL_SIZE][RADIO_BUFFER_LENGTH] __attribute__ ((aligned));
+static volatile bool rx_pool_used[RADIO_RX_POOL_SIZE];
+static uint8_t *rx_current;
+static uint8_t *rx_next;
+static volatile uint32_t rx_dropped = 0;
 
 // internal state machine
 static volatile uint8_t status = 0;
 #define STATUS_INITIALIZED          1
 #define STATUS_RX                   2
 #define STATUS_TX                   4
+#define STATUS_TX_QUEUE             8
 #define STATUS_BUSY                (STATUS_RX | STATUS_TX)
 
+#if RADIO_TX_QUEUE_SIZE & (RADIO_TX_QUEUE_SIZE - 1)
+#error "RADIO_TX_QUEUE_SIZE must be a power of two"
+#endif
+
+/*
+ * Back-to-back transmit queue
+ *
+ * The entry at tx_tail is on air, tx_head is where the application appends.
+ * Both indices only ever increase and wrap around together with uint8_t.
+ */
+typedef struct
+{
+    const uint8_t *pdu;
+    uint8_t        frequency;
+} tx_entry_t;
+
+static tx_entry_t tx_queue[RADIO_TX_QUEUE_SIZE];
+static volatile uint8_t tx_head = 0;
+static volatile uint8_t tx_tail = 0;
+static volatile bool tx_repeat = false;
+static volatile uint32_t tx_sent = 0;
+
+#define tx_queue_count()        ((uint8_t) (tx_head - tx_tail))
+#define tx_queue_entry(i)       (&tx_queue[(uint8_t) (i) % RADIO_TX_QUEUE_SIZE])
+
+/*
+ * Device address whitelist
+ *
+ * While addresses are whitelisted, the receiver only interrupts upon DEVMATCH.
+ * Non-matching packets are received into rx_current over and over again
+ * without waking the CPU. Only upon DEVMATCH rx_next is queued up
+ * in RADIO_PACKETPTR and the END interrupt is enabled for this one packet.
+ */
+static uint8_t whitelist_count = 0;
+
+/*
+ * Hardware timestamps
+ *
+ * RADIO_TIMER runs at 1 MHz. PPI connects the ADDRESS and END events
+ * to its capture tasks 0 and 1, capture register 2 is used to read
+ * the current time and compare register 3 counts the 16 bit overflows.
+ */
+#define TIMER_CC_ADDRESS        0
+#define TIMER_CC_END            1
+#define TIMER_CC_NOW            2
+#define TIMER_CC_OVERFLOW       3
+
+static volatile uint16_t timer_overflows = 0;
+static bool timer_running = false;
+static bool timestamps_enabled = false;
+static uint8_t timestamp_ppi_address;
+static uint8_t timestamp_ppi_end;
+static uint32_t timestamp_address = 0;
+static uint32_t timestamp_end = 0;
+
+/*
+ * nRF51 Series Reference Manual v2.1, section 16.1.2, page 74
+ * nRF51 Series Reference Manual v2.1, sections 16.1.8, page 87
+ * nRF51 Series Reference Manual v2.1, section 16.2.9, page 88
+ * Link Layer specification section 2.3, Core 4.1, page 2504
+ * Link Layer specification section 2.4, Core 4.1, page 2511
+ *
+ * The nRF51822 has 3 fields before the payload field: S0, LENGTH and S1.
+ * The PDU header is stored in S0 and LENGTH. Data is whitened and sent
+ * LSB first, the access address has 4 bytes (3 bytes base + 1 byte prefix).
+ */
+const radio_packet_format_t radio_ble_packet_format =
+{
+    .length_bits    = 8,
+    .s0_bytes       = 1,
+    .s1_bits        = 0,
+    .max_length     = MAX_PAYLOAD_LENGTH,
+    .static_length  = 0,
+    .address_length = 4,
+    .msb_first      = false,
+    .whitening      = true
+};
+
+static radio_packet_format_t packet_format;
+
+/*
+ * Receive pipes
+ *
+ * Each of the 8 logical addresses consists of a prefix byte and a base address:
+ * pipe 0 uses BASE0, pipes 1-7 share BASE1. Received packets are routed
+ * by RADIO_RXMATCH to the callback of their pipe, if it has one,
+ * otherwise to the common receive callbacks.
+ */
+static uint8_t pipes_open = RADIO_RXADDR0;
+static radio_packet_callback_t pipe_callback[RADIO_PIPES];
+
+/*
+ * Early rejection
+ *
+ * The ADDRESS_BCSTART shortcut starts the bit counter with every address,
+ * so BCMATCH fires as soon as the first filter_bits bits following it
+ * have been received. If the filter rejects the partial packet, the reception
+ * is stopped and restarted into the same buffer: the receiver stays ramped up
+ * and the packet never reaches the END interrupt or the application.
+ */
+static radio_filter_t filter;
+static uint16_t filter_bits;
+static volatile uint32_t rx_filtered = 0;
+
+/*
+ * Transition latency instrumentation
+ *
+ * PPI captures the READY, ADDRESS, END and DISABLED events
+ * into the four capture registers of RADIO_LATENCY_TIMER, which counts
+ * at 16 MHz in 16 bit. The CPU clears the timer whenever it enables
+ * the radio (radio_latency_mark()), ramp-ups started by a shortcut
+ * are measured from the preceding DISABLED event.
+ * The radio interrupt picks up every capture register, which no longer
+ * holds LATENCY_IDLE, accounts the transition ending there and
+ * writes LATENCY_IDLE back (an event captured at exactly that tick is lost).
+ */
+#define LATENCY_CC_READY        0
+#define LATENCY_CC_ADDRESS      1
+#define LATENCY_CC_END          2
+#define LATENCY_CC_DISABLED     3
+#define LATENCY_IDLE            0xFFFF
+
+static bool latency_enabled = false;
+#ifdef RADIO_LATENCY_TIMER
+static uint8_t latency_ppi;
+static uint16_t latency_capture[4];
+static uint8_t latency_pending = 0;
+static uint16_t latency_origin;
+static bool latency_origin_valid = false;
+#endif
+static radio_latency_t latency[RADIO_TRANSITIONS];
+
+// reception statistics per channel
+static bool quality_enabled = false;
+static radio_channel_quality_t quality[RADIO_CHANNELS];
+
+static radio_packet_callback_t packet_callback;
 static radio_receive_callback_t receive_callback;
 static radio_send_callback_t send_callback;
+static radio_event_handler_t event_handler;
+
+/*
+ * Link Layer specification section 1.4.1, Core 4.1, page 2502
+ * nRF51 Series Reference Manual v2.1, section 16.2.19, page 91
+ *
+ * The nRF51822 is configured using the frequency offset from 2400 MHz:
+ * On air frequency = 2400 MHz + RADIO_FREQUENCY MHz
+ */
+static const uint8_t channel_frequency[RADIO_CHANNELS] = {
+    // data channels 0-10: 2404-2424 MHz
+     4,  6,  8, 10, 12, 14, 16, 18, 20, 22, 24,
+    // data channels 11-36: 2428-2478 MHz
+    28, 30, 32, 34, 36, 38, 40, 42, 44, 46, 48, 50, 52,
+    54, 56, 58, 60, 62, 64, 66, 68, 70, 72, 74, 76, 78,
+    // advertising channels 37-39: 2402, 2426 and 2480 MHz
+     2, 26, 80,
+};
 
 uint8_t radio_channel_to_frequency(uint8_t channel)
 {
-    /*
-     * Link Layer specification section 1.4.1, Core 4.1, page 2502
-     * nRF51 Series Reference Manual v2.1, section 16.2.19, page 91
-     *
-     * The nRF51822 is configured using the frequency offset from 2400 MHz:
-     * On air frequency = 2400 MHz + RADIO_FREQUENCY MHz
-     */
-    switch (channel)
-    {
-        // advertising channels
-        case 37:
-            return 2;   // 2402 MHz
-        case 38:
-            return 26;  // 2426 MHz
-        case 39:
-            return 80;  // 2480 MHz
-        // data channels
-        default:
-            // 0-10
-            if (channel < 11)
-                return 4 + (channel*2);
-            // 11-36
-            if (channel < 37)
-                return 6 + (channel*2);
-    }
+    // invalid channel, return first advertising channel
+    if (channel >= RADIO_CHANNELS)
+        return 2;
+
+    return channel_frequency[channel];
+}
+
+/**
+ * Retune the radio to a BLE channel index (0-39)
+ *
+ * Performs no checks and no output,
+ * so it may be used from interrupt context while the radio is disabled.
+ */
+void radio_set_channel(uint8_t channel)
+{
+    /*
+     * Data whitening initial value = Radio channel index
+     * Polynomial (hardwired into SoC): x^7 + x^4 + 1
+     *
+     * Bluetooth specification 4.1,
+     * Chapter 3.2, page 2523
+     */
+    RADIO_DATAWHITEIV = channel;
+
+    RADIO_FREQUENCY = radio_channel_to_frequency(channel);
+}
+
+/**
+ * Precompute the register values for one channel of a link
+ */
+void radio_profile_init(radio_channel_profile_t *profile, uint8_t channel, uint32_t access_address, uint32_t crcinit)
+{
+    profile->frequency = radio_channel_to_frequency(channel);
+    profile->whiteiv   = channel;
+    profile->prefix    = access_address >> 24;
+    profile->base      = access_address << 8;
+    profile->crcinit   = crcinit & 0xFFFFFF;
+}
+
+/**
+ * Precompute the register values for all channels of a link,
+ * so that a hop is a table lookup and radio_profile_apply()
+ */
+void radio_profiles_init(radio_channel_profile_t profiles[RADIO_CHANNELS], uint32_t access_address, uint32_t crcinit)
+{
+    for (uint8_t channel=0; channel<RADIO_CHANNELS; channel++)
+        radio_profile_init(&profiles[channel], channel, access_address, crcinit);
+}
+
+/**
+ * Retune the radio and set the address (pipe 0) and CRC of a link
+ *
+ * Performs no checks and no output, so it may be used from interrupt
+ * context while the radio is disabled, e.g. to hop within T_IFS.
+ */
+void radio_profile_apply(const radio_channel_profile_t *profile)
+{
+    RADIO_FREQUENCY   = profile->frequency;
+    RADIO_DATAWHITEIV = profile->whiteiv;
+    RADIO_BASE0       = profile->base;
+    RADIO_PREFIX0     = (RADIO_PREFIX0 & ~0xFFUL) | profile->prefix;
+    RADIO_CRCINIT     = profile->crcinit;
+}
+
+/**
+ * For debugging purposes:
+ * Print out a hex dump of the received packet via UART
+ */
+void print_packet(char *buffer, uint32_t length)
+{
+    uint32_t i;
+
+    nrf_gpio_pin_set(21);
+
+    // temporarily disable all interrupts
+    // prevents characters to be randomly injected into ongoing uart transmission
+    DINT;
+
+    // access address
+    uart_send("00 00 00 00 ", 12);
+
+    // header
+    for (i=0; i<2; i++)
+    {
+        char s[] = "   ";
+        char2hex(s, buffer++);
+        uart_send(s, 3);
+    }
+
+    uart_send("| ", 2);
+
+    // advertising address
+    for (i=2; i<8; i++)
+    {
+        char s[] = "   ";
+        char2hex(s, buffer++);
+        uart_send(s, 3);
+    }
+
+    uart_send("| ", 2);
+
+    // device address match?
+    if (RADIO_EVENT_DEVMATCH)
+        uart_send("MATCH ", 8);
+    if (RADIO_EVENT_DEVMISS)
+        uart_send("MISS ", 7);
+
+    uart_send("| ", 2);
+
+    // packet bytes
+    for (i=8; i<length; i++)
+    {
+        char s[] = "   ";
+        char2hex(s, buffer++);
+        uart_send(s, 3);
+    }
+
+    uart_send("| ", 2);
+
+    // CRC
+    for (i=0; i<3; i++)
+    {
+        char s[] = "   ";
+        char c = (RADIO_RXCRC >> (i*8)) & 0xFF;
+        char2hex(s, &c);
+        uart_send(s, 3);
+    }
+
+    uart_send("| ", 2);
+
+    // CRC ok?
+    if (RADIO_CRC_OK)
+        uart_send("OK", 2);
+    else
+        uart_send("ERROR", 5);
+
+    uart_send("\n", 1);
+
+    // re-enable interrupts
+    EINT;
+
+    nrf_gpio_pin_clear(21);
+}
+
+/**
+ * Print out a memory dump
+ * of all radio registers
+ */
+void print_memory()
+{
+    char s[] = "         ";
+    for (uint32_t address = RADIO_BASE+0x500; address < RADIO_BASE+0x540; address += 4)
+    {
+        uint32_t value = *((volatile uint32_t*) address);
+        char a = (value & 0xFF000000) >> 24;
+        char b = (value & 0x00FF0000) >> 16;
+        char c = (value & 0x0000FF00) >> 8;
+        char d = (value & 0x000000FF);
+        char2hex( &s[0], &a );
+        char2hex( &s[2], &b );
+        char2hex( &s[4], &c );
+        char2hex( &s[6], &d );
+        uart_send(s, 9);
+        if (address % 64 == 0)
+            uart_send("\n", 1);
+    }
+    uart_send("\n", 1);
+}
+
+/**
+ * Take a free buffer from the receive pool
+ *
+ * Returns NULL, if all buffers are in use
+ */
+static uint8_t* rx_pool_alloc()
+{
+    for (uint8_t i=0; i<RADIO_RX_POOL_SIZE; i++)
+    {
+        if (!rx_pool_used[i])
+        {
+            rx_pool_used[i] = true;
+            return rx_pool[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Return a received PDU to the pool
+ * after the application is done with it
+ */
+void radio_release_pdu(const uint8_t *pdu)
+{
+    if (pdu < rx_pool[0] || pdu >= rx_pool[0] + sizeof(rx_pool))
+        return;
+
+    rx_pool_used[(pdu - rx_pool[0]) / RADIO_BUFFER_LENGTH] = false;
+}
+
+/**
+ * Abort the packet being received into rx_current
+ * and listen for the next one
+ */
+static void radio_filter_reject()
+{
+    RADIO_TASK_STOP = 1;
+    RADIO_EVENT_END = 0;
+    RADIO_EVENT_ADDRESS = 0;
+
+    // START latches the packet pointer: receive into the same buffer again
+    RADIO_PACKETPTR = (uint32_t) rx_current;
+    RADIO_TASK_START = 1;
+
+    if (whitelist_count == 0)
+        RADIO_PACKETPTR = (uint32_t) rx_next;
+    else
+        RADIO_INTENCLR = RADIO_INTERRUPT_END;
+
+    rx_filtered++;
+}
+
+/**
+ * Number of packets rejected by the filter
+ */
+uint32_t radio_get_filtered_count()
+{
+    return rx_filtered;
+}
+
+/**
+ * Number of packets dropped,
+ * because the application held all pool buffers
+ */
+uint32_t radio_get_dropped_count()
+{
+    return rx_dropped;
+}
+
+/**
+ * Start RADIO_TIMER as free running microsecond counter
+ */
+static void radio_timer_start()
+{
+    if (timer_running)
+        return;
+
+    TIMER_TASK_STOP(RADIO_TIMER)  = 1;
+    TIMER_MODE(RADIO_TIMER)       = TIMER_MODE_TIMER;
+    TIMER_BITMODE(RADIO_TIMER)    = TIMER_BITMODE_16BIT;
+    TIMER_PRESCALER(RADIO_TIMER)  = 4;
+    TIMER_TASK_CLEAR(RADIO_TIMER) = 1;
+
+    // count wrap-arounds
+    TIMER_CC(RADIO_TIMER)[TIMER_CC_OVERFLOW] = 0;
+    TIMER_EVENT_COMPARE(RADIO_TIMER)[TIMER_CC_OVERFLOW] = 0;
+    TIMER_INTENCLR(RADIO_TIMER) = ~0;
+    timer_interrupt_upon_compare_enable(RADIO_TIMER, TIMER_CC_OVERFLOW);
+    interrupt_enable(RADIO_TIMER_INTERRUPT);
+    timer_overflows = 0;
+
+    TIMER_TASK_START(RADIO_TIMER) = 1;
+    timer_running = true;
+}
+
+static void radio_timer_stop()
+{
+    TIMER_TASK_STOP(RADIO_TIMER) = 1;
+    TIMER_INTENCLR(RADIO_TIMER) = ~0;
+    timer_running = false;
+}
+
+/**
+ * RADIO_TIMER interrupt handler
+ *
+ * Included in nrf51_startup.c
+ */
+void RADIO_TIMER_Handler()
+{
+    if (TIMER_EVENT_COMPARE(RADIO_TIMER)[TIMER_CC_OVERFLOW])
+    {
+        TIMER_EVENT_COMPARE(RADIO_TIMER)[TIMER_CC_OVERFLOW] = 0;
+        timer_overflows++;
+    }
+}
+
+/**
+ * Current time of the radio's microsecond counter
+ */
+uint32_t radio_get_time()
+{
+    uint16_t overflows;
+    uint16_t now;
+    bool pending;
+
+    do
+    {
+        overflows = timer_overflows;
+        TIMER_TASK_CAPTURE(RADIO_TIMER)[TIMER_CC_NOW] = 1;
+        now = TIMER_CC(RADIO_TIMER)[TIMER_CC_NOW];
+        pending = TIMER_EVENT_COMPARE(RADIO_TIMER)[TIMER_CC_OVERFLOW];
+    }
+    while (overflows != timer_overflows);
+
+    // wrapped around, but the interrupt has not been serviced yet
+    if (pending && now < 0x8000)
+        overflows++;
+
+    return ((uint32_t) overflows << 16) | now;
+}
+
+/**
+ * Convert the 16 bit captures of the last packet
+ * to the full width of the radio's microsecond counter
+ *
+ * The captures must not be older than 65 ms.
+ */
+static void radio_read_timestamps()
+{
+    if (!timestamps_enabled)
+        return;
+
+    uint32_t now = radio_get_time();
+    timestamp_address = now - (uint16_t) (now - TIMER_CC(RADIO_TIMER)[TIMER_CC_ADDRESS]);
+    timestamp_end     = now - (uint16_t) (now - TIMER_CC(RADIO_TIMER)[TIMER_CC_END]);
+}
+
+/**
+ * Timestamps of the last packet sent or received,
+ * e.g. for use in the send callback
+ */
+void radio_get_timestamps(uint32_t *address, uint32_t *end)
+{
+    *address = timestamp_address;
+    *end = timestamp_end;
+}
+
+/**
+ * Capture the time of every packet's ADDRESS and END event
+ * into RADIO_TIMER by the given two PPI channels
+ *
+ * Timestamps are taken by hardware and unaffected by interrupt latency.
+ */
+void radio_timestamps_enable(uint8_t ppi_channel_address, uint8_t ppi_channel_end)
+{
+    radio_timer_start();
+
+    timestamp_ppi_address = ppi_channel_address;
+    timestamp_ppi_end = ppi_channel_end;
+
+    PPI_CH[ppi_channel_address].EEP = (uint32_t) &RADIO_EVENT_ADDRESS;
+    PPI_CH[ppi_channel_address].TEP = (uint32_t) &TIMER_TASK_CAPTURE(RADIO_TIMER)[TIMER_CC_ADDRESS];
+    PPI_CH[ppi_channel_end].EEP     = (uint32_t) &RADIO_EVENT_END;
+    PPI_CH[ppi_channel_end].TEP     = (uint32_t) &TIMER_TASK_CAPTURE(RADIO_TIMER)[TIMER_CC_END];
+    PPI_CHENSET = (1 << ppi_channel_address)
+                | (1 << ppi_channel_end);
+
+    timestamps_enabled = true;
+}
+
+void radio_timestamps_disable()
+{
+    PPI_CHENCLR = (1 << timestamp_ppi_address)
+                | (1 << timestamp_ppi_end);
+
+    timestamps_enabled = false;
+    radio_timer_stop();
+}
+
+void radio_latency_reset()
+{
+    memset(latency, 0, sizeof(latency));
+}
+
+#ifdef RADIO_LATENCY_TIMER
+
+/**
+ * Capture the radio events into RADIO_LATENCY_TIMER
+ * through the given and the following three PPI channels
+ * and account the time between them (see radio_get_latency())
+ */
+void radio_latency_enable(uint8_t ppi_channel_first)
+{
+    volatile uint32_t* const events[4] = {
+        &RADIO_EVENT_READY,
+        &RADIO_EVENT_ADDRESS,
+        &RADIO_EVENT_END,
+        &RADIO_EVENT_DISABLED,
+    };
+
+    TIMER_TASK_STOP(RADIO_LATENCY_TIMER)  = 1;
+    TIMER_MODE(RADIO_LATENCY_TIMER)       = TIMER_MODE_TIMER;
+    TIMER_BITMODE(RADIO_LATENCY_TIMER)    = TIMER_BITMODE_16BIT;
+    TIMER_PRESCALER(RADIO_LATENCY_TIMER)  = 0;
+    TIMER_INTENCLR(RADIO_LATENCY_TIMER)   = ~0;
+    TIMER_TASK_CLEAR(RADIO_LATENCY_TIMER) = 1;
+
+    latency_ppi = ppi_channel_first;
+    for (uint8_t i=0; i<4; i++)
+    {
+        PPI_CH[latency_ppi + i].EEP = (uint32_t) events[i];
+        PPI_CH[latency_ppi + i].TEP = (uint32_t) &TIMER_TASK_CAPTURE(RADIO_LATENCY_TIMER)[i];
+        TIMER_CC(RADIO_LATENCY_TIMER)[i] = LATENCY_IDLE;
+    }
+    PPI_CHENSET = 0xF << latency_ppi;
+
+    latency_pending = 0;
+    latency_origin_valid = false;
+    radio_latency_reset();
+
+    TIMER_TASK_START(RADIO_LATENCY_TIMER) = 1;
+    latency_enabled = true;
+}
+
+void radio_latency_disable()
+{
+    latency_enabled = false;
+    PPI_CHENCLR = 0xF << latency_ppi;
+    TIMER_TASK_STOP(RADIO_LATENCY_TIMER) = 1;
+}
+
+static void radio_latency_account(uint8_t transition, uint16_t ticks)
+{
+    radio_latency_t *l = &latency[transition];
+    uint8_t bucket = 0;
+
+    while ((ticks >> bucket) > 1)
+        bucket++;
+
+    if (l->count == 0 || ticks < l->min)
+        l->min = ticks;
+    if (ticks > l->max)
+        l->max = ticks;
+    l->sum += ticks;
+    l->count++;
+    if (l->histogram[bucket] < 0xFFFF)
+        l->histogram[bucket]++;
+}
+
+/**
+ * Account the transitions, whose events
+ * have been captured since the last radio interrupt
+ */
+static void radio_latency_sample()
+{
+    uint8_t fresh = 0;
+
+    for (uint8_t i=0; i<4; i++)
+    {
+        uint16_t capture = TIMER_CC(RADIO_LATENCY_TIMER)[i];
+        if (capture != LATENCY_IDLE)
+        {
+            TIMER_CC(RADIO_LATENCY_TIMER)[i] = LATENCY_IDLE;
+            latency_capture[i] = capture;
+            fresh |= (1 << i);
+        }
+    }
+
+    // the events of one sequence occur in the order of the capture registers
+    if (fresh & (1 << LATENCY_CC_READY))
+    {
+        if (latency_origin_valid)
+            radio_latency_account(RADIO_TRANSITION_RAMPUP, latency_capture[LATENCY_CC_READY] - latency_origin);
+        latency_origin_valid = false;
+        latency_pending = (1 << LATENCY_CC_READY);
+    }
+
+    if (fresh & (1 << LATENCY_CC_ADDRESS))
+    {
+        if (latency_pending & (1 << LATENCY_CC_READY))
+            radio_latency_account(RADIO_TRANSITION_ADDRESS, latency_capture[LATENCY_CC_ADDRESS] - latency_capture[LATENCY_CC_READY]);
+        latency_pending = (1 << LATENCY_CC_ADDRESS);
+    }
+
+    if (fresh & (1 << LATENCY_CC_END))
+    {
+        if (latency_pending & (1 << LATENCY_CC_ADDRESS))
+            radio_latency_account(RADIO_TRANSITION_PACKET, latency_capture[LATENCY_CC_END] - latency_capture[LATENCY_CC_ADDRESS]);
+        latency_pending = (1 << LATENCY_CC_END);
+    }
+
+    if (fresh & (1 << LATENCY_CC_DISABLED))
+    {
+        if (latency_pending & (1 << LATENCY_CC_END))
+            radio_latency_account(RADIO_TRANSITION_DISABLE, latency_capture[LATENCY_CC_DISABLED] - latency_capture[LATENCY_CC_END]);
+        latency_pending = 0;
+
+        // a shortcut may ramp the radio up again from here
+        latency_origin = latency_capture[LATENCY_CC_DISABLED];
+        latency_origin_valid = true;
+    }
+}
+
+/**
+ * The CPU is about to enable the radio:
+ * the following ramp-up is measured from here
+ */
+void radio_latency_mark()
+{
+    if (!latency_enabled)
+        return;
+
+    // account what happened since the last radio interrupt first
+    radio_latency_sample();
+
+    TIMER_TASK_CLEAR(RADIO_LATENCY_TIMER) = 1;
+    latency_origin = 0;
+    latency_origin_valid = true;
+    latency_pending = 0;
+}
+
+#else
+
+// no RADIO_LATENCY_TIMER assigned, nothing is measured
+void radio_latency_enable(uint8_t ppi_channel_first)
+{
+    (void) ppi_channel_first;
+}
+
+void radio_latency_disable()
+{
+}
+
+static void radio_latency_sample()
+{
+}
+
+void radio_latency_mark()
+{
+}
+
+#endif
+
+/**
+ * Statistics of one transition type (RADIO_TRANSITION_*),
+ * all times in 1/16 us
+ */
+const radio_latency_t* radio_get_latency(uint8_t transition)
+{
+    if (transition >= RADIO_TRANSITIONS)
+        return NULL;
+    return &latency[transition];
+}
+
+/**
+ * Send a number in decimal, optionally of 1/16 units with one decimal place
+ */
+static void radio_print_number(uint32_t value, bool ticks)
+{
+    char s[12];
+    uint8_t i = sizeof(s) - 1;
+
+    s[i] = 0;
+    if (ticks)
+    {
+        value = (value * 10 + 8) / 16;
+        s[--i] = '0' + (value % 10);
+        s[--i] = '.';
+        value /= 10;
+    }
+    do
+    {
+        s[--i] = '0' + (value % 10);
+        value /= 10;
+    }
+    while (value > 0);
+
+    uart_send_string(&s[i]);
+}
+
+/**
+ * Dump the statistics of all transitions over UART,
+ * times in us, histogram buckets with counts from 2^n/16 us on
+ */
+void radio_latency_print()
+{
+    static char* const names[RADIO_TRANSITIONS] = {
+        "ramp-up  ",
+        "address  ",
+        "packet   ",
+        "disable  ",
+    };
+
+    for (uint8_t t=0; t<RADIO_TRANSITIONS; t++)
+    {
+        radio_latency_t *l = &latency[t];
+
+        uart_send_string(names[t]);
+        uart_send_string(" n=");
+        radio_print_number(l->count, false);
+        if (l->count > 0)
+        {
+            uart_send_string(" min=");
+            radio_print_number(l->min, true);
+            uart_send_string(" avg=");
+            radio_print_number(l->sum / l->count, true);
+            uart_send_string(" max=");
+            radio_print_number(l->max, true);
+            uart_send_string(" us |");
+            for (uint8_t b=0; b<RADIO_LATENCY_BUCKETS; b++)
+            {
+                uart_send_char(' ');
+                radio_print_number(l->histogram[b], false);
+            }
+        }
+        uart_send_char('\n');
+    }
+}
+
+/**
+ * Collect reception statistics per BLE channel (see radio_get_quality()),
+ * from every packet received by this library or a protocol driver
+ * calling radio_quality_record()
+ */
+void radio_quality_enable()
+{
+    radio_quality_reset();
+    quality_enabled = true;
+}
+
+void radio_quality_disable()
+{
+    quality_enabled = false;
+}
+
+void radio_quality_reset()
+{
+    memset(quality, 0, sizeof(quality));
+}
+
+/**
+ * Account the packet just received, to be called from the radio interrupt
+ *
+ * The channel is taken from RADIO_DATAWHITEIV, the RSSI from RADIO_RSSISAMPLE,
+ * so the ADDRESS_RSSISTART shortcut should be set while receiving.
+ */
+void radio_quality_record(bool crc)
+{
+    if (!quality_enabled)
+        return;
+
+    // bit 6 of DATAWHITEIV always reads as one
+    uint8_t channel = RADIO_DATAWHITEIV & 0x3F;
+    if (channel >= RADIO_CHANNELS)
+        return;
+
+    radio_channel_quality_t *q = &quality[channel];
+
+    // halve before overflowing, the error rate and the average are kept
+    if (q->packets == 0xFFFF)
+    {
+        q->packets /= 2;
+        q->crc_errors /= 2;
+        q->rssi_sum /= 2;
+    }
+
+    q->packets++;
+    if (!crc)
+        q->crc_errors++;
+    q->rssi_sum -= RADIO_RSSISAMPLE & 0x7F;
+}
+
+const radio_channel_quality_t* radio_get_quality(uint8_t channel)
+{
+    if (channel >= RADIO_CHANNELS)
+        return NULL;
+
+    return &quality[channel];
+}
+
+/**
+ * Hand the just filled buffer to the application
+ * and queue up a fresh one
+ *
+ * In continuous mode the END_START shortcut has already restarted
+ * the receiver into rx_next, so the fresh buffer is queued for the packet
+ * after the next. In single-shot mode (after a send with RADIO_FLAGS_RX_NEXT)
+ * the radio is disabling and the fresh buffer is used upon the next start.
+ */
+static void radio_receive_complete(bool continuous)
+{
+    uint8_t *pdu = rx_current;
+    bool crc = RADIO_CRC_OK;
+    int8_t rssi = -(int8_t) (RADIO_RSSISAMPLE & 0x7F);
+    uint8_t pipe = RADIO_RXMATCH;
+    uint8_t *fresh = rx_pool_alloc();
+
+    radio_read_timestamps();
+    radio_quality_record(crc);
+
+    if (fresh == NULL)
+    {
+        // no free buffer: discard this packet and receive into its buffer again
+        rx_dropped++;
+        if (continuous)
+        {
+            rx_current = rx_next;
+            rx_next = pdu;
+            if (whitelist_count == 0)
+                RADIO_PACKETPTR = (uint32_t) rx_next;
+        }
+        else
+        {
+            status &= ~STATUS_RX;
+        }
+        return;
+    }
+
+    if (continuous)
+    {
+        rx_current = rx_next;
+        rx_next = fresh;
+        if (whitelist_count == 0)
+            RADIO_PACKETPTR = (uint32_t) rx_next;
+    }
+    else
+    {
+        rx_current = fresh;
+        status &= ~STATUS_RX;
+    }
+
+    radio_packet_callback_t pcb = pipe_callback[pipe] ? pipe_callback[pipe] : packet_callback;
+
+    if (pcb)
+    {
+        radio_packet_t packet = {
+            .pdu  = pdu,
+            .crc  = crc,
+            .rssi = rssi,
+            .pipe = pipe,
+            .timestamped       = timestamps_enabled,
+            .timestamp_address = timestamp_address,
+            .timestamp_end     = timestamp_end,
+        };
+        pcb(&packet, continuous);
+    }
+    else if (receive_callback)
+        receive_callback(pdu, crc, continuous);
+    else
+        radio_release_pdu(pdu);
+}
+
+/**
+ * Transmission complete, radio is disabled
+ *
+ * With RADIO_FLAGS_RX_NEXT the DISABLED_RXEN shortcut has already
+ * started the receiver ramp-up, which leaves enough time to
+ * point it at a receive buffer.
+ */
+static void radio_send_complete()
+{
+    bool active = (RADIO_SHORTS & RADIO_SHORTCUT_DISABLED_RXEN) != 0;
+
+    status &= ~STATUS_TX;
+    radio_read_timestamps();
+
+    if (active)
+    {
+        RADIO_SHORTS &= ~RADIO_SHORTCUT_DISABLED_RXEN;
+        RADIO_PACKETPTR = (uint32_t) rx_current;
+        status |= STATUS_RX;
+    }
+
+    if (send_callback)
+        send_callback(active);
+}
+
+/**
+ * A packet of the transmit queue is on air
+ *
+ * Decide whether the next one can follow by hardware:
+ * If it uses the same frequency, it is queued up in the double-buffered
+ * RADIO_PACKETPTR and the DISABLED_TXEN shortcut stays in place,
+ * otherwise the chain is broken and restarted from the DISABLED interrupt.
+ */
+static void radio_queue_address()
+{
+    if (tx_repeat)
+        return;
+
+    if (tx_queue_count() >= 2)
+    {
+        const tx_entry_t *next = tx_queue_entry(tx_tail + 1);
+        if (next->frequency == RADIO_FREQUENCY_UNCHANGED
+         || next->frequency == RADIO_FREQUENCY)
+        {
+            RADIO_PACKETPTR = (uint32_t) next->pdu;
+            return;
+        }
+    }
+
+    RADIO_SHORTS &= ~RADIO_SHORTCUT_DISABLED_TXEN;
+}
+
+/**
+ * A packet of the transmit queue is complete
+ */
+static void radio_queue_disabled()
+{
+    tx_sent++;
+    radio_read_timestamps();
+
+    if (!tx_repeat)
+        tx_tail++;
+
+    if (tx_queue_count() == 0)
+    {
+        // the repetition may have ended after the ADDRESS event,
+        // when the shortcut was still in place: it has restarted the radio
+        RADIO_INTENCLR = ~0;
+        if (RADIO_SHORTS & RADIO_SHORTCUT_DISABLED_TXEN)
+        {
+            RADIO_SHORTS = 0;
+            RADIO_TASK_DISABLE = 1;
+            while (RADIO_STATE != RADIO_STATE_DISABLED)
+                NOP;
+            RADIO_EVENT_DISABLED = 0;
+        }
+
+        status &= ~(STATUS_TX | STATUS_TX_QUEUE);
+        if (send_callback)
+            send_callback(false);
+        return;
+    }
+
+    if (!(RADIO_SHORTS & RADIO_SHORTCUT_DISABLED_TXEN))
+    {
+        // chain was broken for a frequency change or a late append
+        const tx_entry_t *next = tx_queue_entry(tx_tail);
+        if (next->frequency != RADIO_FREQUENCY_UNCHANGED)
+            RADIO_FREQUENCY = next->frequency;
+        RADIO_PACKETPTR = (uint32_t) next->pdu;
+        RADIO_SHORTS |= RADIO_SHORTCUT_DISABLED_TXEN;
+        radio_latency_mark();
+        RADIO_TASK_TXEN = 1;
+    }
+
+    if (send_callback)
+        send_callback(true);
+}
+
+/**
+ * Radio interrupt handler
+ *
+ * Included in nrf51_startup.c
+ */
+void RADIO_Handler()
+{
+    if (latency_enabled)
+        radio_latency_sample();
+
+    // another protocol driver has taken over the radio
+    if (event_handler)
+    {
+        event_handler();
+        return;
+    }
+
+    if (RADIO_EVENT_READY && (status & STATUS_RX))
+    {
+        // START has latched rx_current, queue up the buffer for the following packet
+        RADIO_EVENT_READY = 0;
+        RADIO_INTENCLR = RADIO_INTERRUPT_READY;
+        RADIO_PACKETPTR = (uint32_t) rx_next;
+    }
+
+    if (RADIO_EVENT_ADDRESS && (status & STATUS_TX_QUEUE))
+    {
+        RADIO_EVENT_ADDRESS = 0;
+        radio_queue_address();
+    }
+
+    if (RADIO_EVENT_DEVMATCH && (status & STATUS_RX))
+    {
+        RADIO_EVENT_DEVMATCH = 0;
+
+        if (RADIO_EVENT_END)
+        {
+            // too late: the receiver has already restarted into the same buffer
+            RADIO_EVENT_END = 0;
+            rx_dropped++;
+        }
+        else
+        {
+            // a whitelisted device is being received: keep its buffer
+            RADIO_PACKETPTR = (uint32_t) rx_next;
+            RADIO_INTENSET = RADIO_INTERRUPT_END;
+        }
+    }
+
+    if (RADIO_EVENT_BCMATCH && (status & STATUS_RX))
+    {
+        RADIO_EVENT_BCMATCH = 0;
+
+        // a packet, that has already ended, is delivered regardless
+        if (filter && !RADIO_EVENT_END && !filter(rx_current))
+            radio_filter_reject();
+    }
+
+    if (RADIO_EVENT_END)
+    {
+        // clear
+        RADIO_EVENT_END = 0;
+
+        if (whitelist_count > 0)
+            RADIO_INTENCLR = RADIO_INTERRUPT_END;
+
+        // Reception complete
+        if ((status & STATUS_RX) && !(status & STATUS_TX))
+        {
+            // see radio_is_receiving()
+            RADIO_EVENT_ADDRESS = 0;
+            radio_receive_complete(RADIO_SHORTS & RADIO_SHORTCUT_END_START);
+        }
+    }
+
+    if (RADIO_EVENT_DISABLED)
+    {
+        RADIO_EVENT_DISABLED = 0;
+
+        // Transmission complete
+        if (status & STATUS_TX_QUEUE)
+        {
+            radio_queue_disabled();
+        }
+        else if (status & STATUS_TX)
+        {
+            radio_send_complete();
+        }
+    }
+}
+
+void radio_set_callbacks(radio_receive_callback_t rcb, radio_send_callback_t scb)
+{
+    receive_callback = rcb;
+    send_callback = scb;
+}
+
+/**
+ * Register a receive callback, which gets the packet's metadata
+ * (CRC status, RSSI) alongside the PDU
+ *
+ * Takes precedence over the receive callback of radio_set_callbacks().
+ * The PDU must be released with radio_release_pdu() as well.
+ */
+void radio_set_packet_callback(radio_packet_callback_t pcb)
+{
+    packet_callback = pcb;
+}
+
+/**
+ * Hand the radio interrupt over to a protocol driver,
+ * which operates the radio registers directly (e.g. esb.c)
+ *
+ * While a handler is set, the receive, packet and send callbacks
+ * are not invoked. NULL returns the interrupt to this library.
+ */
+void radio_set_event_handler(radio_event_handler_t handler)
+{
+    event_handler = handler;
+}
+
+static void radio_write_packet_format(const radio_packet_format_t *format)
+{
+    RADIO_PCNF0 = RADIO_LENGTH_LF(format->length_bits)
+                | RADIO_LENGTH_S0(format->s0_bytes)
+                | RADIO_LENGTH_S1(format->s1_bits);
 
-    // invalid channel, return first advertising channel
-    return 2;
+    RADIO_PCNF1 = (format->whitening ? RADIO_WHITENING_ENABLE : RADIO_WHITENING_DISABLE)
+                | (format->msb_first ? RADIO_MSB_FIRST : RADIO_LSB_FIRST)
+                | RADIO_MAX_PAYLOAD_LENGTH(format->max_length)
+                | RADIO_STATIC_LENGTH(format->static_length)
+                | RADIO_ACCESS_ADDRESS_SIZE(format->address_length);
+
+    packet_format = *format;
 }
 
 /**
- * For debugging purposes:
- * Print out a hex dump of the received packet via UART
+ * Configure the layout of packets in RAM and on air
+ *
+ * Packets received by radio_start_receiver() must fit into
+ * RADIO_RX_BUFFER_LENGTH bytes, buffers passed to radio_send()
+ * must hold radio_get_packet_length_max() bytes.
+ *
+ * Returns false, if the radio is busy or a field is out of range.
  */
-void print_packet(char *buffer, uint32_t length)
+bool radio_set_packet_format(const radio_packet_format_t *format)
 {
-    uint32_t i;
+    if (status & (STATUS_BUSY | STATUS_TX_QUEUE))
+        return false;
 
-    nrf_gpio_pin_set(21);
+    if (format->length_bits > 8
+     || format->s0_bytes > 1
+     || format->s1_bits > 8
+     || format->max_length > RADIO_PAYLOAD_MAX
+     || format->address_length < 3
+     || format->address_length > 5)
+        return false;
 
-    // temporarily disable all interrupts
-    // prevents characters to be randomly injected into ongoing uart transmission
-    DINT;
+    radio_write_packet_format(format);
 
-    // access address
-    uart_send("00 00 00 00 ", 12);
+    return true;
+}
 
-    // header
-    for (i=0; i<2; i++)
+/**
+ * Capture the radio's configuration, e.g. after radio_init()
+ * or esb_init(), to switch back to it with radio_config_restore()
+ */
+void radio_config_save(radio_config_t *config)
+{
+    for (uint8_t i=0; i<5; i++)
+        config->override[i] = RADIO_OVERRIDE[i];
+
+    config->pcnf0       = RADIO_PCNF0;
+    config->pcnf1       = RADIO_PCNF1;
+    config->base0       = RADIO_BASE0;
+    config->base1       = RADIO_BASE1;
+    config->prefix0     = RADIO_PREFIX0;
+    config->prefix1     = RADIO_PREFIX1;
+    config->crcpoly     = RADIO_CRCPOLY;
+    config->crcinit     = RADIO_CRCINIT;
+    config->shorts      = RADIO_SHORTS;
+    config->tifs        = RADIO_TIFS;
+    config->mode        = RADIO_MODE;
+    config->crccnf      = RADIO_CRCCNF;
+    config->txaddress   = RADIO_TXADDRESS;
+    config->rxaddresses = RADIO_RXADDRESSES;
+    config->frequency   = RADIO_FREQUENCY;
+    config->datawhiteiv = RADIO_DATAWHITEIV & 0x3F;
+    config->txpower     = RADIO_TXPOWER;
+    config->format      = packet_format;
+
+    config->whitelist_count = whitelist_count;
+    config->dacnf = RADIO_DACNF;
+    for (uint8_t i=0; i<RADIO_WHITELIST_SIZE; i++)
     {
-        char s[] = "   ";
-        char2hex(s, buffer++);
-        uart_send(s, 3);
+        config->dab[i] = RADIO_DAB[i];
+        config->dap[i] = RADIO_DAP[i];
     }
+}
 
-    uart_send("| ", 2);
+/**
+ * Switch to a configuration captured by radio_config_save()
+ *
+ * Every register is written once, nothing is read back and
+ * neither the clock nor the UART are touched, so this takes
+ * about a microsecond instead of the milliseconds of radio_init().
+ * Returns false, if the radio is busy.
+ */
+bool radio_config_restore(const radio_config_t *config)
+{
+    if (status & (STATUS_BUSY | STATUS_TX_QUEUE))
+        return false;
 
-    // advertising address
-    for (i=2; i<8; i++)
+    RADIO_MODE = config->mode;
+    for (uint8_t i=0; i<5; i++)
+        RADIO_OVERRIDE[i] = config->override[i];
+
+    RADIO_PCNF0       = config->pcnf0;
+    RADIO_PCNF1       = config->pcnf1;
+    RADIO_BASE0       = config->base0;
+    RADIO_BASE1       = config->base1;
+    RADIO_PREFIX0     = config->prefix0;
+    RADIO_PREFIX1     = config->prefix1;
+    RADIO_TXADDRESS   = config->txaddress;
+    RADIO_RXADDRESSES = config->rxaddresses;
+    RADIO_CRCCNF      = config->crccnf;
+    RADIO_CRCPOLY     = config->crcpoly;
+    RADIO_CRCINIT     = config->crcinit;
+    RADIO_TIFS        = config->tifs;
+    RADIO_FREQUENCY   = config->frequency;
+    RADIO_DATAWHITEIV = config->datawhiteiv;
+    RADIO_TXPOWER     = config->txpower;
+    RADIO_SHORTS      = config->shorts;
+
+    for (uint8_t i=0; i<config->whitelist_count; i++)
     {
-        char s[] = "   ";
-        char2hex(s, buffer++);
-        uart_send(s, 3);
+        RADIO_DAB[i] = config->dab[i];
+        RADIO_DAP[i] = config->dap[i];
     }
+    RADIO_DACNF = config->dacnf;
 
-    uart_send("| ", 2);
+    // the library's view of the registers
+    packet_format = config->format;
+    pipes_open = config->rxaddresses;
+    whitelist_count = config->whitelist_count;
 
-    // device address match?
-    if (RADIO_EVENT_DEVMATCH)
-        uart_send("MATCH ", 8);
-    if (RADIO_EVENT_DEVMISS)
-        uart_send("MISS ", 7);
+    return true;
+}
 
-    uart_send("| ", 2);
+/**
+ * Size of the largest packet in RAM (header fields and payload)
+ * with the current packet format
+ */
+uint16_t radio_get_packet_length_max()
+{
+    return RADIO_HEADER_LENGTH(&packet_format) + packet_format.max_length;
+}
 
-    // packet bytes
-    for (i=8; i<length; i++)
+/**
+ * Listen on an additional logical address
+ *
+ * base is written to RADIO_BASE0 (pipe 0) or RADIO_BASE1 (pipes 1-7),
+ * i.e. only its upper (address length - 1) bytes are used.
+ * All open pipes 1-7 must share the same base.
+ *
+ * Returns false, if the radio is busy, the pipe does not exist
+ * or the base conflicts with another open pipe.
+ */
+bool radio_open_pipe(uint8_t pipe, uint32_t base, uint8_t prefix)
+{
+    if (pipe >= RADIO_PIPES || (status & STATUS_BUSY))
+        return false;
+
+    if (pipe == 0)
     {
-        char s[] = "   ";
-        char2hex(s, buffer++);
-        uart_send(s, 3);
+        RADIO_BASE0 = base;
     }
-
-    uart_send("| ", 2);
-
-    // CRC
-    for (i=0; i<3; i++)
+    else
     {
-        char s[] = "   ";
-        char c = (RADIO_RXCRC >> (i*8)) & 0xFF;
-        char2hex(s, &c);
-        uart_send(s, 3);
+        if ((pipes_open & ~(RADIO_RXADDR0 | (1 << pipe))) && RADIO_BASE1 != base)
+            return false;
+        RADIO_BASE1 = base;
     }
 
-    uart_send("| ", 2);
+    radio_set_address_prefix(pipe, prefix);
 
-    // CRC ok?
-    if (RADIO_CRC_OK)
-        uart_send("OK", 2);
-    else
-        uart_send("ERROR", 5);
+    pipes_open |= (1 << pipe);
+    RADIO_RXADDRESSES = pipes_open;
 
-    uart_send("\n", 1);
+    return true;
+}
 
-    // re-enable interrupts
-    EINT;
+void radio_close_pipe(uint8_t pipe)
+{
+    if (pipe >= RADIO_PIPES)
+        return;
 
-    nrf_gpio_pin_clear(21);
+    pipes_open &= ~(1 << pipe);
+    RADIO_RXADDRESSES = pipes_open;
+    pipe_callback[pipe] = NULL;
 }
 
 /**
- * Print out a memory dump
- * of all radio registers
+ * Deliver the packets received on the given pipe to a callback of their own
+ *
+ * NULL routes them to the common receive callbacks again.
+ * The PDU must be released with radio_release_pdu().
  */
-void print_memory()
+void radio_set_pipe_callback(uint8_t pipe, radio_packet_callback_t pcb)
 {
-    char s[] = "         ";
-    for (uint32_t address = RADIO_BASE+0x500; address < RADIO_BASE+0x540; address += 4)
-    {
-        uint32_t value = *((volatile uint32_t*) address);
-        char a = (value & 0xFF000000) >> 24;
-        char b = (value & 0x00FF0000) >> 16;
-        char c = (value & 0x0000FF00) >> 8;
-        char d = (value & 0x000000FF);
-        char2hex( &s[0], &a );
-        char2hex( &s[2], &b );
-        char2hex( &s[4], &c );
-        char2hex( &s[6], &d );
-        uart_send(s, 9);
-        if (address % 64 == 0)
-            uart_send("\n", 1);
-    }
-    uart_send("\n", 1);
+    if (pipe < RADIO_PIPES)
+        pipe_callback[pipe] = pcb;
 }
 
 /**
- * Radio interrupt handler
+ * Tune the radio to a BLE channel and set the access address and CRC
+ * initial value of the link
  *
- * Included in nrf51_startup.c
+ * Returns false, if the radio is not initialized or busy.
+ * For repeated hops, precompute the profiles with radio_profiles_init()
+ * and use radio_profile_apply() instead.
  */
-void RADIO_Handler()
+bool radio_prepare(uint8_t channel, uint32_t addr, uint32_t crcinit)
 {
-    uart_send("i", 1);
-
-    if (RADIO_EVENT_END)
-    {
-        // Transmission complete
-        if (status & STATUS_TX)
-        {
-            status &= ~STATUS_TX;
-        }
-
-        // Reception complete
-        if (status & STATUS_RX)
-        {
-            if (RADIO_CRC_OK)
-            {
-                //print_packet((char*) inbuf, RADIO_BUFFER_LENGTH);
-                print_memory();
-            }
-            //status &= ~STATUS_RX;
+    radio_channel_profile_t profile;
 
-            // fill buffer with zeroes
-            memset(inbuf, 0, sizeof(inbuf));
-        }
+    if (!(status & STATUS_INITIALIZED) || (status & STATUS_BUSY))
+        return false;
 
-        // clear
-        RADIO_EVENT_END = 0;
-    }
-}
+    radio_profile_init(&profile, channel, addr, crcinit);
+    radio_profile_apply(&profile);
 
-void radio_set_callbacks(radio_receive_callback_t rcb, radio_send_callback_t scb)
-{
-    receive_callback = rcb;
-    send_callback = scb;
+    return true;
 }
 
-bool radio_prepare(uint8_t channel, uint32_t addr, uint32_t crcinit)
+/**
+ * Start the transmission of a PDU and return immediately
+ *
+ * Completion is signalled via the send callback from the radio interrupt.
+ * With RADIO_FLAGS_RX_NEXT the radio switches to receive mode right after
+ * the transmission (T_IFS), the send callback is then invoked with
+ * active = true and the response is delivered to the receive callback.
+ *
+ * The data buffer must remain untouched until the send callback is invoked.
+ *
+ * Returns false, if the radio is busy
+ */
+bool radio_send(const uint8_t *data, uint32_t flags)
 {
-    if (!(status & STATUS_INITIALIZED))
-    {
-        uart_send_string("radio_prepare() failed: Radio not initialized\n");
-        return false;
-    }
-
     if (status & STATUS_BUSY)
-    {
-        uart_send_string("radio_prepare() failed: Radio is busy\n");
         return false;
-    }
 
-    /*
-     * Data whitening initial value = Radio channel index
-     * Polynomial (hardwired into SoC): x^7 + x^4 + 1
-     *
-     * Bluetooth specification 4.1,
-     * Chapter 3.2, page 2523
-     */
-    RADIO_DATAWHITEIV = channel;
+    status |= STATUS_TX;
 
-    RADIO_CRCINIT = 0x555555;
+    // make sure, transmission is started after ramp-up is complete
+    // and the radio is disabled after the packet has been sent
+    RADIO_SHORTS = RADIO_SHORTCUT_READY_START
+                 | RADIO_SHORTCUT_END_DISABLE;
 
-    uint8_t frequency = radio_channel_to_frequency(channel);
-    RADIO_FREQUENCY = frequency;
+    // sample the response's RSSI as soon as its address has been received
+    if (flags & RADIO_FLAGS_RX_NEXT)
+        RADIO_SHORTS |= RADIO_SHORTCUT_DISABLED_RXEN
+                      | RADIO_SHORTCUT_ADDRESS_RSSISTART
+                      | RADIO_SHORTCUT_DISABLED_RSSISTOP;
 
-    // set lower 3 bytes of address as base address
-    radio_set_address_base(0, addr << 8);
+    // invoke radio interrupt, when transmission is complete
+    // and when the optional response has been received
+    RADIO_INTENCLR = ~0;
+    RADIO_INTENSET = RADIO_INTERRUPT_END
+                   | RADIO_INTERRUPT_DISABLED;
 
-    // set the highest byte of address as address prefix
-    radio_set_address_prefix(0, addr >> 24);
+    // clear all radio event flags
+    radio_clear_all_events;
 
-    //uart_send_string("Radio prepared.\n");
+    // initiate packet transmission
+    RADIO_PACKETPTR = (uint32_t) data;
+    radio_latency_mark();
+    RADIO_TASK_TXEN = 1;
 
     return true;
 }
 
-void radio_send(uint8_t *data)
+/**
+ * Append a PDU to the transmit queue
+ *
+ * Queued packets are sent back to back: the radio re-enables itself
+ * by the DISABLED_TXEN shortcut and the interrupt only swaps the packet pointer.
+ * A frequency change (RADIO_FREQUENCY value, or RADIO_FREQUENCY_UNCHANGED)
+ * costs one software-driven restart.
+ * The send callback is invoked after every packet, with active = true
+ * as long as more packets follow.
+ *
+ * Returns false, if the queue is full, the receiver is active
+ * or radio_send() is transmitting
+ */
+bool radio_send_queued(const uint8_t *pdu, uint8_t frequency)
 {
-    status |= STATUS_TX;
+    if (status & STATUS_RX)
+        return false;
 
-    // make sure, transmission is started after ramp-up is complete
+    // radio_send() is on air, its completion does not start the queue
+    if ((status & STATUS_TX) && !(status & STATUS_TX_QUEUE))
+        return false;
+
+    if (tx_queue_count() >= RADIO_TX_QUEUE_SIZE)
+        return false;
+
+    tx_entry_t *entry = tx_queue_entry(tx_head);
+    entry->pdu = pdu;
+    entry->frequency = frequency;
+    tx_head++;
+
+    // already running: the interrupt will pick it up
+    if (status & STATUS_TX_QUEUE)
+        return true;
+
+    status |= STATUS_TX | STATUS_TX_QUEUE;
+
+    // ramp-up, send, disable, ramp-up again...
     RADIO_SHORTS = RADIO_SHORTCUT_READY_START
-                 | RADIO_SHORTCUT_END_DISABLE;
+                 | RADIO_SHORTCUT_END_DISABLE
+                 | RADIO_SHORTCUT_DISABLED_TXEN;
 
-    // only invoke radio interrupt, when an END event happens
     RADIO_INTENCLR = ~0;
-    RADIO_INTENSET = RADIO_INTERRUPT_END;
+    RADIO_INTENSET = RADIO_INTERRUPT_ADDRESS
+                   | RADIO_INTERRUPT_DISABLED;
 
-    // clear all radio event flags
     radio_clear_all_events;
 
-    // initiate packet transmission
-    RADIO_PACKETPTR = (uint32_t) data;
+    entry = tx_queue_entry(tx_tail);
+    if (entry->frequency != RADIO_FREQUENCY_UNCHANGED)
+        RADIO_FREQUENCY = entry->frequency;
+    RADIO_PACKETPTR = (uint32_t) entry->pdu;
+    radio_latency_mark();
     RADIO_TASK_TXEN = 1;
 
-    uart_send(">", 1);
+    return true;
+}
 
-    // wait until READY flag is raised
-    while (!RADIO_EVENT_READY)
-        asm("nop");
-    uart_send("r", 1);
-/*
-    // wait until ADDRESS flag is raised
-    while (!RADIO_EVENT_ADDRESS)
-        asm("nop");
-    uart_send("a", 1);
-
-    uint32_t s = RADIO_STATE;
-
-    // wait until PAYLOAD flag is raised
-    while (!RADIO_EVENT_PAYLOAD)
-        asm("nop");
-    uart_send("p", 1);
-
-    // wait until END flag is raised
-    while (!RADIO_EVENT_END)
-        asm("nop");
-    uart_send("e", 1);
-*/
-    // wait until DISABLED flag is raised
-    while (!RADIO_EVENT_DISABLED)
-        asm("wfi");
-    uart_send("d", 1);
+/**
+ * Throughput measurement mode:
+ * Send the given PDU back to back for the given number of milliseconds
+ * and return the achieved number of packets per second
+ *
+ * Uses RADIO_TIMER as time base.
+ */
+uint32_t radio_measure_tx_rate(const uint8_t *pdu, uint32_t ms)
+{
+    if (ms == 0 || (status & STATUS_BUSY))
+        return 0;
 
-    uart_send("\n", 1);
+    radio_timer_start();
+
+    tx_sent = 0;
+    tx_repeat = true;
+    uint32_t start = radio_get_time();
+    radio_send_queued(pdu, RADIO_FREQUENCY_UNCHANGED);
+
+    uint32_t elapsed;
+    do
+        elapsed = radio_get_time() - start;
+    while (elapsed < ms * 1000UL);
+
+    // let the last packet go out
+    tx_repeat = false;
+    while (status & STATUS_TX_QUEUE)
+        NOP;
+
+    if (!timestamps_enabled)
+        radio_timer_stop();
+
+    return ((uint64_t) tx_sent * 1000000UL) / elapsed;
+}
+
+/**
+ * Add a device address (AdvA, LSB first as in the PDU)
+ * to the hardware whitelist
+ *
+ * With a non-empty whitelist radio_start_receiver() only delivers packets
+ * from whitelisted devices, other packets do not wake up the CPU.
+ * The random flag selects the TxAdd bit to be matched.
+ * Takes effect with the next radio_start_receiver().
+ *
+ * Returns false, if the whitelist is full
+ */
+bool radio_whitelist_add(const uint8_t *address, bool random)
+{
+    if (whitelist_count >= RADIO_WHITELIST_SIZE)
+        return false;
+
+    uint8_t n = whitelist_count++;
+
+    RADIO_DAB[n] = address[0]
+                 | (address[1] << 8)
+                 | (address[2] << 16)
+                 | ((uint32_t) address[3] << 24);
+    RADIO_DAP[n] = address[4]
+                 | (address[5] << 8);
+
+    RADIO_DACNF = (RADIO_DACNF & ~RADIO_DACNF_TXADD(n))
+                | RADIO_DACNF_ENA(n)
+                | (random ? RADIO_DACNF_TXADD(n) : 0);
+
+    return true;
+}
+
+/**
+ * Disable device address matching,
+ * all received packets are delivered again
+ */
+void radio_whitelist_clear()
+{
+    whitelist_count = 0;
+    RADIO_DACNF = 0;
 }
 
-void radio_start_receiver(uint32_t f)
+/**
+ * Inspect every packet after its first bits in order to reject it early
+ *
+ * bits counts from the end of the address, e.g. 16 for the header of a
+ * BLE PDU. The filter is invoked from the radio interrupt with the partially
+ * received packet and returns false to reject it. NULL disables filtering.
+ * Takes effect with the next radio_start_receiver().
+ */
+void radio_set_filter(uint16_t bits, radio_filter_t f)
+{
+    filter = f;
+    filter_bits = bits;
+}
+
+/**
+ * Receive into the buffer pool until radio_stop()
+ *
+ * Returns false, if packets of the current format
+ * may exceed RADIO_RX_BUFFER_LENGTH.
+ */
+bool radio_start_receiver()
 {
+    if (radio_get_packet_length_max() > RADIO_RX_BUFFER_LENGTH)
+        return false;
+
     // set RX status flag
     status |= STATUS_RX;
 
@@ -308,38 +1596,85 @@ void radio_start_receiver(uint32_t f)
     radio_clear_all_events;
 
     // reception starts, as soon as receiver is READY
-    // receiver shutdown, as soon as reception ENDs
+    // and restarts, as soon as reception ENDs;
+    // the RSSI of every packet is sampled, as soon as its address has been received
     RADIO_SHORTS = RADIO_SHORTCUT_READY_START
-                 | RADIO_SHORTCUT_END_START;
+                 | RADIO_SHORTCUT_END_START
+                 | RADIO_SHORTCUT_ADDRESS_RSSISTART
+                 | RADIO_SHORTCUT_DISABLED_RSSISTOP;
 
-    // only invoke radio interrupt, when reception is complete
     RADIO_INTENCLR = ~0;
-    RADIO_INTENSET = RADIO_INTERRUPT_END;
+    if (whitelist_count > 0)
+    {
+        // only wake up for whitelisted devices
+        RADIO_EVENT_DEVMATCH = 0;
+        RADIO_INTENSET = RADIO_INTERRUPT_DEVMATCH;
+    }
+    else
+    {
+        // invoke radio interrupt once after ramp-up to queue up the second buffer,
+        // then every time a reception is complete
+        RADIO_INTENSET = RADIO_INTERRUPT_READY
+                       | RADIO_INTERRUPT_END;
+    }
 
-    // fill buffer with zeroes
-    memset(inbuf, 0, sizeof(inbuf));
+    // count the bits following every address
+    if (filter)
+    {
+        RADIO_BCC = filter_bits;
+        RADIO_EVENT_BCMATCH = 0;
+        RADIO_SHORTS |= RADIO_SHORTCUT_ADDRESS_BCSTART;
+        RADIO_INTENSET = RADIO_INTERRUPT_BCMATCH;
+    }
 
     // receive
-    RADIO_PACKETPTR = (uint32_t) inbuf;
+    RADIO_PACKETPTR = (uint32_t) rx_current;
+    radio_latency_mark();
     RADIO_TASK_RXEN = 1;
+
+    return true;
 }
 
 void radio_stop()
 {
+    // no more interrupts and no more automatic restarts
+    RADIO_INTENCLR = ~0;
+    RADIO_SHORTS = 0;
+
     radio_clear_all_events;
 
-    // automatically disable radio as soon as current task is finished
-    RADIO_SHORTS |= RADIO_SHORTCUT_END_DISABLE;
+    // abort whatever the radio is currently doing
+    RADIO_TASK_DISABLE = 1;
 
-    // wait until radio is disabled
-    while (!RADIO_EVENT_DISABLED)
-        asm("nop");
+    // wait until radio is disabled (returns immediately, if it already was)
+    while (RADIO_STATE != RADIO_STATE_DISABLED)
+        NOP;
 
     // clear DISABLED event
     RADIO_EVENT_DISABLED = 0;
 
+    // drop what is left in the transmit queue, its buffers may be gone
+    tx_tail = tx_head;
+    tx_repeat = false;
+
     // clear STATUS_RX and STATUS_TX flags
-    status &= ~STATUS_BUSY;
+    status &= ~(STATUS_BUSY | STATUS_TX_QUEUE);
+}
+
+/**
+ * Whether the receiver has found an address and the packet is still on air,
+ * e.g. to defer a transmission, that would collide with it
+ *
+ * Only packets received with radio_start_receiver() are tracked,
+ * with a whitelist only those of whitelisted devices reliably.
+ */
+bool radio_is_receiving()
+{
+    if ((status & STATUS_BUSY) != STATUS_RX)
+        return false;
+
+    // the END interrupt clears ADDRESS, when the packet is over
+    return RADIO_EVENT_ADDRESS && !RADIO_EVENT_END;
 }
 
 void radio_init(void)
@@ -356,7 +1691,7 @@ void radio_init(void)
         uart_send_string("Starting high frequency clock... ");
         CLOCK_TASK_HFCLKSTART = 1;
         while (!CLOCK_EVENT_HFCLKSTARTED)
-            asm("nop");
+            NOP;
     }
     uart_send_string("[started]\n");
 
@@ -390,19 +1725,6 @@ void radio_init(void)
      */
     RADIO_TIFS = 150;
 
-    /*
-     *  nRF51 Series Reference Manual v2.1, section 16.2.9, page 88
-     *
-     * Enable data whitening,
-     * set air endianness to little endian i.e. LSB first,
-     * set the maximum payload length
-     * and set access address size to 4 (3 bytes base + 1 byte prefix)
-     */
-    RADIO_PCNF1 = RADIO_WHITENING_ENABLE
-                | RADIO_LSB_FIRST
-                | RADIO_MAX_PAYLOAD_LENGTH(MAX_PAYLOAD_LENGTH)
-                | RADIO_ACCESS_ADDRESS_SIZE(4);
-
     /*
      * nRF51 Series Reference Manual v2.1, section 16.1.4, page 74
      * nRF51 Series Reference Manual v2.1, section 16.2.14-15, pages 89-90
@@ -411,7 +1733,8 @@ void radio_init(void)
      * address 0, which is assembled by base address BASE0 and prefix byte
      * PREFIX0.AP0.
      */
-    RADIO_RXADDRESSES = RADIO_RXADDR0;
+    pipes_open = RADIO_RXADDR0;
+    RADIO_RXADDRESSES = pipes_open;
     RADIO_TXADDRESS   = RADIO_TXADDR0;
 
     /*
@@ -436,19 +1759,8 @@ void radio_init(void)
      */
     RADIO_CRCPOLY = 0x100065B;
 
-    /*
-     * nRF51 Series Reference Manual v2.1, section 16.1.2, page 74
-     * nRF51 Series Reference Manual v2.1, sections 16.1.8, page 87
-     * Link Layer specification section 2.3, Core 4.1, page 2504
-     * Link Layer specification section 2.4, Core 4.1, page 2511
-     *
-     * Configure the header size. The nRF51822 has 3 fields before the
-     * payload field: S0, LENGTH and S1. These fields can be used to store
-     * the PDU header.
-     */
-    RADIO_PCNF0 = RADIO_LENGTH_LF(8)
-                | RADIO_LENGTH_S0(1)
-                | RADIO_LENGTH_S1(0);
+    // S0, LENGTH and payload of BLE PDUs
+    radio_write_packet_format(&radio_ble_packet_format);
 
     // Clear all shortcuts
     RADIO_SHORTS = 0;
@@ -461,8 +1773,14 @@ void radio_init(void)
 
     RADIO_TXPOWER = RADIO_TXPOWER_0DBM;
 
+    // the radio permanently holds two buffers of the receive pool
+    for (uint8_t i=0; i<RADIO_RX_POOL_SIZE; i++)
+        rx_pool_used[i] = false;
+    rx_current = rx_pool_alloc();
+    rx_next = rx_pool_alloc();
+
     // to avoid faulty behaviour due to invalid pointer
-    RADIO_PACKETPTR = (uint32_t) inbuf;
+    RADIO_PACKETPTR = (uint32_t) rx_current;
 
     status |= STATUS_INITIALIZED;
 
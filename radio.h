@@ -24,6 +24,8 @@
 #include "nrf_gpio.h"
 #include "ficr.h"
 #include "clock.h"
+#include "timers.h"
+#include "ppi.h"
 #include "uart.h"
  
 /*
@@ -31,7 +33,9 @@
  * as specified in the nRF51 Series Reference Manual
  */
 
+#ifndef RADIO_BASE
 #define RADIO_BASE              0x40001000
+#endif
 
 // Tasks
 #define RADIO_TASK_TXEN         (*(volatile uint32_t*) (RADIO_BASE+0x000))   // Enable radio in TX mode
@@ -84,21 +88,23 @@
 #define RADIO_CRCCNF            (*(volatile uint32_t*) (RADIO_BASE+0x534))   // CRC configuration
 #define RADIO_CRCPOLY           (*(volatile uint32_t*) (RADIO_BASE+0x538))   // CRC polynomial
 #define RADIO_CRCINIT           (*(volatile uint32_t*) (RADIO_BASE+0x53C))   // CRC initial value
-#define RADIO_TIFS              (*(volatile uint32_t*) (RADIO_BASE+0x540))   // Test features enable register
-#define RADIO_TEST              (*(volatile uint32_t*) (RADIO_BASE+0x544))   // Inter Frame Spacing: Time interval in us between consecutive packets
+#define RADIO_TEST              (*(volatile uint32_t*) (RADIO_BASE+0x540))   // Test features enable register
+#define RADIO_TIFS              (*(volatile uint32_t*) (RADIO_BASE+0x544))   // Inter Frame Spacing: Time interval in us between consecutive packets
 #define RADIO_RSSISAMPLE        (*(volatile uint32_t*) (RADIO_BASE+0x548))   // RSSI sample
 #define RADIO_STATE             (*(volatile uint32_t*) (RADIO_BASE+0x550))   // Current radio state
 #define RADIO_DATAWHITEIV       (*(volatile uint32_t*) (RADIO_BASE+0x554))   // Data whitening initial value
 #define RADIO_BCC               (*(volatile uint32_t*) (RADIO_BASE+0x560))   // Bit counter compare
 /*
- * Arrays are always pointers in C, therefore no asterisk after uint32_t[x].
- * Accessing array elements by index (e.g. RADIO_DAB[5]) equals pointer dereferencing in C, therefore no asterisk before (volatile...)
- * => RADIO_DAB is a pointer to an array of 32bit unsigned integers, which has 8 elements and is located at memory address RADIO_BASE+0x600.
+ * Register arrays are pointers to their first register, therefore no asterisk before (volatile...).
+ * Accessing array elements by index (e.g. RADIO_DAB[5]) equals pointer dereferencing in C.
+ * => RADIO_DAB points to 8 consecutive 32bit registers located at memory address RADIO_BASE+0x600.
+ * (A compound literal like (volatile uint32_t[8]) {address} would instead create
+ *  a temporary array in RAM, whose first element holds the address.)
  */
-#define RADIO_DAB                ((volatile uint32_t[8]) {RADIO_BASE+0x600})   // Device address base
-#define RADIO_DAP                ((volatile uint32_t[8]) {RADIO_BASE+0x620})   // Device address prefix
+#define RADIO_DAB                ((volatile uint32_t*)   (RADIO_BASE+0x600))   // Device address base [8]
+#define RADIO_DAP                ((volatile uint32_t*)   (RADIO_BASE+0x620))   // Device address prefix [8]
 #define RADIO_DACNF             (*(volatile uint32_t*)   (RADIO_BASE+0x640))   // Device address match configuration
-#define RADIO_OVERRIDE           ((volatile uint32_t[5]) {RADIO_BASE+0x724})   // Trim value override
+#define RADIO_OVERRIDE           ((volatile uint32_t*)   (RADIO_BASE+0x724))   // Trim value override [5]
 #define RADIO_POWER             (*(volatile uint32_t*)   (RADIO_BASE+0xFFC))   // Peripheral power control
 
 
@@ -183,6 +189,10 @@
 #define RADIO_STATE_TX                      11
 #define RADIO_STATE_TXDISABLE               12
 
+// for RADIO_DACNF
+#define RADIO_DACNF_ENA(n)                 (1 << (n))
+#define RADIO_DACNF_TXADD(n)               (1 << ((n) + 8))
+
 // for RADIO_PCNF1
 #define RADIO_WHITENING_ENABLE             (1 << 25)
 #define RADIO_WHITENING_DISABLE             0
@@ -225,6 +235,7 @@
 #define radio_data_whitening_disable        RADIO_PCNF1 &= ~(1 << 25) // clear bit 
 
 #define RADIO_MAX_PAYLOAD_LENGTH(len)      ((len) & 0xFF)
+#define RADIO_STATIC_LENGTH(len)          (((len) & 0xFF) << 8)
 #define radio_get_max_payload_length       (RADIO_PCNF1 & 0x000000FF)
 #define radio_set_max_payload_length(len)   RADIO_PCNF1  = (RADIO_PCNF1 & 0xFFFFFF00) | RADIO_MAX_PAYLOAD_LENGTH(len)
 
@@ -242,12 +253,12 @@
  *  AP0-4: read from RADIO_PREFIX0
  *  AP5-7: read from RADIO_PREFIX1
  */
-#define radio_get_address_prefix(n)         (n < 4 ? \
-                                                 RADIO_PREFIX0 & (0xFF << (n*8))) \
-                                            :    RADIO_PREFIX1 & (0xFF << ((n%4)*8)))
-#define radio_set_address_prefix(n, val)    if (n < 4) \
-                                                 RADIO_PREFIX0 = (val & 0xFF) << (n*8); \
-                                            else RADIO_PREFIX1 = (val & 0xFF) << ((n%4)*8);
+#define radio_get_address_prefix(n)        (((n) < 4 ? \
+                                                 RADIO_PREFIX0 >> ((n)*8) \
+                                            :    RADIO_PREFIX1 >> (((n)%4)*8)) & 0xFF)
+#define radio_set_address_prefix(n, val)    if ((n) < 4) \
+                                                 RADIO_PREFIX0 = (RADIO_PREFIX0 & ~(0xFFUL << ((n)*8))) | ((uint32_t) ((val) & 0xFF) << ((n)*8)); \
+                                            else RADIO_PREFIX1 = (RADIO_PREFIX1 & ~(0xFFUL << (((n)%4)*8))) | ((uint32_t) ((val) & 0xFF) << (((n)%4)*8));
 
 /*
  * Link Layer
@@ -256,23 +267,295 @@
 #define RADIO_PDU_MAX            39
 #define RADIO_PDU_MIN            2
 
+/*
+ * Proprietary packet formats
+ *
+ * In RAM a packet consists of up to three header fields (S0, LENGTH, S1),
+ * one byte each, followed by up to RADIO_PAYLOAD_MAX bytes of payload.
+ */
+#define RADIO_PAYLOAD_MAX        254
+#define RADIO_PACKET_MAX        (3 + RADIO_PAYLOAD_MAX)
+
+/*
+ * Access address and CRC initial value of the advertising channels
+ * Link Layer specification section 2.1.2, Core 4.1, page 2504
+ */
+#define RADIO_ADVERTISING_ACCESS_ADDRESS    0x8E89BED6
+#define RADIO_ADVERTISING_CRCINIT           0x555555
+
+/*
+ * Advertising channel PDU header (first byte in RAM)
+ * Link Layer specification section 2.3, Core 4.1, page 2507
+ */
+#define RADIO_PDU_TYPE(pdu)                ((pdu)[0] & 0x0F)
+#define RADIO_PDU_TXADD                     0x40
+#define RADIO_PDU_RXADD                     0x80
+
+#define RADIO_PDU_TYPE_ADV_IND              0
+#define RADIO_PDU_TYPE_ADV_DIRECT_IND       1
+#define RADIO_PDU_TYPE_ADV_NONCONN_IND      2
+#define RADIO_PDU_TYPE_SCAN_REQ             3
+#define RADIO_PDU_TYPE_SCAN_RSP             4
+#define RADIO_PDU_TYPE_CONNECT_REQ          5
+#define RADIO_PDU_TYPE_ADV_SCAN_IND         6
+
 #define RADIO_FLAGS_RX_NEXT      1
 #define RADIO_FLAGS_TX_NEXT      2
 
+/*
+ * Number of PDU buffers the receiver rotates through.
+ * Two of them are always held by the radio (the one currently being received
+ * into and the one queued up for the next packet), the remainder can be held
+ * by the application at the same time.
+ */
+#ifndef RADIO_RX_POOL_SIZE
+#define RADIO_RX_POOL_SIZE       4
+#endif
+
+/*
+ * Size of every buffer in the receive pool;
+ * increase up to RADIO_PACKET_MAX for larger packet formats
+ */
+#ifndef RADIO_RX_BUFFER_LENGTH
+#define RADIO_RX_BUFFER_LENGTH   RADIO_PDU_MAX
+#endif
+
+/*
+ * Depth of the back-to-back transmit queue, must be a power of two
+ */
+#ifndef RADIO_TX_QUEUE_SIZE
+#define RADIO_TX_QUEUE_SIZE      8
+#endif
+
+// number of logical addresses (pipes) the receiver can listen on at once
+#define RADIO_PIPES              8
+
+// number of device addresses the hardware can match against
+#define RADIO_WHITELIST_SIZE     8
+
+// for radio_send_queued(): keep the frequency of the previous packet
+#define RADIO_FREQUENCY_UNCHANGED   0xFF
+
+/*
+ * TIMER used by the radio library for timestamps and measurements;
+ * must not be shared with the timer library (TIMER0).
+ * It counts microseconds in 16 bit, the overflows are counted in its interrupt.
+ * When overriding it, its interrupt and handler must be given as well.
+ */
+#ifndef RADIO_TIMER
+#define RADIO_TIMER              TIMER1
+#define RADIO_TIMER_INTERRUPT    TIMER1_INTERRUPT
+#define RADIO_TIMER_Handler      TIMER1_Handler
+#elif !defined(RADIO_TIMER_INTERRUPT) || !defined(RADIO_TIMER_Handler)
+#error "RADIO_TIMER requires RADIO_TIMER_INTERRUPT and RADIO_TIMER_Handler"
+#endif
+
+#if RADIO_TIMER_INTERRUPT == TIMER0_INTERRUPT
+#error "RADIO_TIMER must not be shared with the timer library"
+#endif
+
+/*
+ * TIMER used by radio_latency_enable(), counts at 16 MHz in 16 bit:
+ * transitions longer than 4.096 ms are accounted modulo that.
+ *
+ * No TIMER is left for it by default, TIMER2 serves the connection
+ * and the sniffer library. So the instrumentation is only built, if a TIMER
+ * and its interrupt number (to check for overlaps) are assigned, e.g.
+ *   -DRADIO_LATENCY_TIMER=TIMER2 -DRADIO_LATENCY_TIMER_INTERRUPT=TIMER2_INTERRUPT
+ * Otherwise radio_latency_enable() has no effect.
+ */
+#ifdef RADIO_LATENCY_TIMER
+#ifndef RADIO_LATENCY_TIMER_INTERRUPT
+#error "RADIO_LATENCY_TIMER requires RADIO_LATENCY_TIMER_INTERRUPT"
+#elif RADIO_LATENCY_TIMER_INTERRUPT == TIMER0_INTERRUPT || RADIO_LATENCY_TIMER_INTERRUPT == RADIO_TIMER_INTERRUPT
+#error "RADIO_LATENCY_TIMER must not be shared with the timer library or RADIO_TIMER"
+#endif
+#endif
+
+/*
+ * Transitions measured by radio_latency_enable()
+ *
+ * PAYLOAD is not captured: a TIMER has only four capture registers,
+ * and PAYLOAD to END is merely the CRC on air.
+ */
+#define RADIO_TRANSITION_RAMPUP     0   // TXEN/RXEN or the DISABLED before a shortcut to READY
+#define RADIO_TRANSITION_ADDRESS    1   // READY to ADDRESS; for RX including the wait for a packet
+#define RADIO_TRANSITION_PACKET     2   // ADDRESS to END
+#define RADIO_TRANSITION_DISABLE    3   // END to DISABLED
+#define RADIO_TRANSITIONS           4
+
+// histogram bucket n counts durations from 2^n up to 2^(n+1)-1 ticks
+#define RADIO_LATENCY_BUCKETS       16
+
+/*
+ * Statistics of one transition type, in 1/16 us
+ */
+typedef struct
+{
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint16_t histogram[RADIO_LATENCY_BUCKETS];
+} radio_latency_t;
+
+/*
+ * Reception statistics of one BLE channel, see radio_quality_enable()
+ */
+typedef struct
+{
+    uint16_t packets;
+    uint16_t crc_errors;
+    int32_t  rssi_sum;          // in dBm, over all packets
+} radio_channel_quality_t;
+
 
 /*
  * The active parameter informs if the radio is currently active (e.g. because
  * of a TX/RX_NEXT flag). So, if the callback implementation wants to operate
  * the radio, it will need to first stop the radio.
+ *
+ * The received PDU is not copied: the callback receives the buffer the radio
+ * has just filled and owns it until it is handed back with radio_release_pdu().
+ * While all pool buffers are held by the application, incoming packets are dropped.
  */
 typedef void (*radio_receive_callback_t) (const uint8_t *pdu, bool crc, bool active);
 typedef void (*radio_send_callback_t) (bool active);
 
+/*
+ * A received packet and the information
+ * the radio has collected about it
+ */
+typedef struct
+{
+    const uint8_t *pdu;
+    bool           crc;
+    int8_t         rssi;        // in dBm
+    uint8_t        pipe;        // logical address the packet was received on
+    bool           timestamped; // timestamps are enabled, the following are valid
+    uint32_t       timestamp_address;   // in us (radio_get_time()), may be 0 after a wrap
+    uint32_t       timestamp_end;
+} radio_packet_t;
+
+typedef void (*radio_packet_callback_t) (const radio_packet_t *packet, bool active);
+
+typedef void (*radio_event_handler_t) (void);
+
+// returns false to reject a partially received packet
+typedef bool (*radio_filter_t) (const uint8_t *pdu);
+
+/*
+ * Layout of packets in RAM and on air (RADIO_PCNF0 and RADIO_PCNF1)
+ */
+typedef struct
+{
+    uint8_t length_bits;        // size of the LENGTH field, 0-8 bits
+    uint8_t s0_bytes;           // size of the S0 field, 0-1 bytes
+    uint8_t s1_bits;            // size of the S1 field, 0-8 bits
+    uint8_t max_length;         // maximum payload length, up to RADIO_PAYLOAD_MAX
+    uint8_t static_length;      // bytes added to the LENGTH field
+    uint8_t address_length;     // base address and prefix, 3-5 bytes
+    bool    msb_first;          // on air endianness of S0, LENGTH, S1 and payload
+    bool    whitening;
+} radio_packet_format_t;
+
+/*
+ * Complete radio configuration, see radio_config_save()
+ */
+typedef struct
+{
+    uint32_t override[5];       // RADIO_OVERRIDE, trimming for the mode
+    uint32_t pcnf0;
+    uint32_t pcnf1;
+    uint32_t base0;
+    uint32_t base1;
+    uint32_t prefix0;
+    uint32_t prefix1;
+    uint32_t crcpoly;
+    uint32_t crcinit;
+    uint32_t shorts;
+    uint16_t tifs;
+    uint8_t  mode;
+    uint8_t  crccnf;
+    uint8_t  txaddress;
+    uint8_t  rxaddresses;
+    uint8_t  frequency;
+    uint8_t  datawhiteiv;
+    uint8_t  txpower;
+    radio_packet_format_t format;
+
+    // whitelist, see radio_whitelist_add()
+    uint32_t dab[RADIO_WHITELIST_SIZE];
+    uint16_t dap[RADIO_WHITELIST_SIZE];
+    uint16_t dacnf;
+    uint8_t  whitelist_count;
+} radio_config_t;
+
+// number of bytes before the payload in RAM
+#define RADIO_HEADER_LENGTH(format)    ((format)->s0_bytes + ((format)->length_bits > 0) + ((format)->s1_bits > 0))
+
+// BLE channel indices 0-39, 37-39 being the advertising channels
+#define RADIO_CHANNELS          40
+
+/*
+ * Register values for one channel of a link,
+ * precomputed by radio_profile_init() and written by radio_profile_apply()
+ */
+typedef struct
+{
+    uint8_t  frequency;         // RADIO_FREQUENCY
+    uint8_t  whiteiv;           // RADIO_DATAWHITEIV, the channel index
+    uint8_t  prefix;            // highest byte of the access address
+    uint32_t base;              // lower three bytes of the access address
+    uint32_t crcinit;
+} radio_channel_profile_t;
+
+// BLE advertising and data channel PDUs, configured by radio_init()
+extern const radio_packet_format_t radio_ble_packet_format;
+
 void radio_init();
+uint8_t radio_channel_to_frequency(uint8_t channel);
+void radio_set_channel(uint8_t channel);
 void radio_set_callbacks(radio_receive_callback_t recv_callback, radio_send_callback_t send_callback);
+void radio_set_packet_callback(radio_packet_callback_t packet_callback);
+void radio_set_event_handler(radio_event_handler_t handler);
+bool radio_set_packet_format(const radio_packet_format_t *format);
+uint16_t radio_get_packet_length_max();
+bool radio_open_pipe(uint8_t pipe, uint32_t base, uint8_t prefix);
+void radio_close_pipe(uint8_t pipe);
+void radio_set_pipe_callback(uint8_t pipe, radio_packet_callback_t packet_callback);
+void radio_set_filter(uint16_t bits, radio_filter_t filter);
+void radio_profile_init(radio_channel_profile_t *profile, uint8_t channel, uint32_t access_address, uint32_t crcinit);
+void radio_profiles_init(radio_channel_profile_t profiles[RADIO_CHANNELS], uint32_t access_address, uint32_t crcinit);
+void radio_profile_apply(const radio_channel_profile_t *profile);
 bool radio_prepare(uint8_t ch, uint32_t addr, uint32_t crcinit);
-void radio_send(uint8_t *data);
-void radio_start_receiver();
+bool radio_send(const uint8_t *data, uint32_t flags);
+bool radio_start_receiver();
 void radio_stop();
+bool radio_is_receiving();
+bool radio_send_queued(const uint8_t *pdu, uint8_t frequency);
+uint32_t radio_measure_tx_rate(const uint8_t *pdu, uint32_t ms);
+void radio_timestamps_enable(uint8_t ppi_channel_address, uint8_t ppi_channel_end);
+void radio_timestamps_disable();
+void radio_get_timestamps(uint32_t *address, uint32_t *end);
+uint32_t radio_get_time();
+void radio_latency_enable(uint8_t ppi_channel_first);
+void radio_latency_disable();
+void radio_latency_reset();
+void radio_latency_mark();
+const radio_latency_t* radio_get_latency(uint8_t transition);
+void radio_latency_print();
+void radio_config_save(radio_config_t *config);
+bool radio_config_restore(const radio_config_t *config);
+void radio_quality_enable();
+void radio_quality_disable();
+void radio_quality_reset();
+void radio_quality_record(bool crc);
+const radio_channel_quality_t* radio_get_quality(uint8_t channel);
+bool radio_whitelist_add(const uint8_t *address, bool random);
+void radio_whitelist_clear();
+void radio_release_pdu(const uint8_t *pdu);
+uint32_t radio_get_dropped_count();
+uint32_t radio_get_filtered_count();
 
 #endif
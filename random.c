@@ -3,12 +3,52 @@
 
 void srand(unsigned int seed)
 {
+    (void) seed;
+
     RNG_START = 1;
 }
 
 int rand()
 {
+    // rng_init() lets the generator stop after every value
     RNG_EVENT_VALRDY = 0;
+    RNG_START = 1;
     while (!RNG_EVENT_VALRDY);
     return RNG_VALUE;
 }
+
+static bool rng_running = false;
+static uint8_t rng_value = 0;
+
+/**
+ * Let the generator produce one byte at a time in the background,
+ * for rng_get_byte(); only the first call has an effect
+ */
+void rng_init()
+{
+    if (rng_running)
+        return;
+
+    RNG_SHORTS = RNG_SHORTCUT_VALRDY_STOP;
+    RNG_EVENT_VALRDY = 0;
+    RNG_START = 1;
+    rng_running = true;
+}
+
+/**
+ * Random byte without blocking, e.g. for a pseudo-random delay
+ *
+ * The generator stops after every value and is restarted here,
+ * so until the next value is ready, the previous one is returned again.
+ */
+uint8_t rng_get_byte()
+{
+    if (RNG_EVENT_VALRDY)
+    {
+        rng_value = RNG_VALUE;
+        RNG_EVENT_VALRDY = 0;
+        RNG_START = 1;
+    }
+
+    return rng_value;
+}
@@ -14,7 +14,9 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#ifndef RNG_BASE
 #define RNG_BASE                0x4000D000
+#endif
 
 #define RNG_START               (*(volatile uint32_t*)   (RNG_BASE+0x000))
 
@@ -30,4 +32,7 @@
 void srand(unsigned int);
 int rand();
 
+void rng_init();
+uint8_t rng_get_byte();
+
 #endif
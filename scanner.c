@@ -0,0 +1,247 @@
+/**
+ * Bluetooth Low Energy passive scanner
+ * for the Nordic Semiconductor nRF51 series
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ *
+ * Listens on channels 37, 38 and 39 in turn, one channel per scan interval,
+ * for scan window microseconds each.
+ * Advertisements are matched against a small hash table of recently seen
+ * advertiser addresses (PDU bytes 2-7). Only new advertisers or changed
+ * advertising data are passed on to the application's receive callback,
+ * repetitions are returned to the radio right away.
+ *
+ * If only some PDU types are of interest, the others are rejected
+ * by the radio's bit counter as soon as the PDU header has been received.
+ */
+
+#include "scanner.h"
+
+#if SCANNER_CACHE_SIZE & (SCANNER_CACHE_SIZE - 1)
+#error "SCANNER_CACHE_SIZE must be a power of two"
+#endif
+
+#define ADDRESS_LENGTH      6
+
+// bits from the end of the access address until the PDU header is complete
+#define HEADER_BITS         16
+
+typedef struct
+{
+    uint8_t  address[ADDRESS_LENGTH];
+    uint8_t  used;
+    uint8_t  generation;
+    uint32_t signature;
+} cache_entry_t;
+
+static cache_entry_t cache[SCANNER_CACHE_SIZE];
+
+// incremented every scan interval, used to age cache entries
+static volatile uint8_t generation = 0;
+
+static const uint8_t channels[] = {37, 38, 39};
+static uint8_t channel_index = 0;
+
+static uint32_t scan_window;
+static bool scan_continuous;
+static volatile bool scan_running = false;
+static radio_receive_callback_t scan_callback;
+static uint16_t scan_types = SCANNER_PDU_TYPES_ALL;
+static int8_t interval_timer = -1;
+static int8_t window_timer = -1;
+
+/**
+ * FNV-1a hash
+ */
+static uint32_t hash(uint32_t h, const uint8_t *data, uint8_t length)
+{
+    while (length--)
+    {
+        h ^= *data++;
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+#define HASH_INIT           2166136261UL
+
+/**
+ * Look up the advertiser of the given PDU
+ * and update its cache entry
+ *
+ * Returns true, if the advertiser is known and its data did not change
+ */
+static bool scanner_is_duplicate(const uint8_t *pdu)
+{
+    const uint8_t *address = pdu + 2;
+    uint8_t length = pdu[1] & 0x3F;
+
+    // PDU type and the complete payload make up the signature
+    uint32_t signature = hash(HASH_INIT, pdu, 1);
+    signature = hash(signature, pdu + 2, length);
+
+    uint32_t index = hash(HASH_INIT, address, ADDRESS_LENGTH);
+    cache_entry_t *victim = NULL;
+    uint8_t victim_age = 0;
+
+    for (uint8_t i=0; i<SCANNER_CACHE_WAYS; i++)
+    {
+        cache_entry_t *entry = &cache[(index + i) & (SCANNER_CACHE_SIZE - 1)];
+        uint8_t age = generation - entry->generation;
+
+        if (entry->used && memcmp(entry->address, address, ADDRESS_LENGTH) == 0)
+        {
+            bool duplicate = (entry->signature == signature)
+                          && (age < SCANNER_CACHE_LIFETIME);
+            entry->signature = signature;
+            if (!duplicate)
+                entry->generation = generation;
+            return duplicate;
+        }
+
+        // replace a free slot or else the stalest one
+        if (!entry->used)
+        {
+            age = 0xFF;
+        }
+        if (victim == NULL || age > victim_age)
+        {
+            victim = entry;
+            victim_age = age;
+        }
+    }
+
+    memcpy(victim->address, address, ADDRESS_LENGTH);
+    victim->used = 1;
+    victim->generation = generation;
+    victim->signature = signature;
+
+    return false;
+}
+
+/**
+ * Radio filter: decide upon the PDU header
+ */
+static bool scanner_filter(const uint8_t *pdu)
+{
+    return (scan_types & SCANNER_PDU_TYPE(pdu[0] & 0x0F)) != 0;
+}
+
+/**
+ * Radio receive callback
+ */
+static void scanner_received(const uint8_t *pdu, bool crc, bool active)
+{
+    if (!crc || !scanner_filter(pdu) || (pdu[1] & 0x3F) < ADDRESS_LENGTH || scanner_is_duplicate(pdu))
+    {
+        radio_release_pdu(pdu);
+        return;
+    }
+
+    scan_callback(pdu, crc, active);
+}
+
+/**
+ * End of the scan window
+ */
+static void scanner_window_end()
+{
+    radio_stop();
+}
+
+/**
+ * Begin of a scan interval: hop to the next advertising channel
+ */
+static void scanner_interval()
+{
+    if (!scan_running)
+        return;
+
+    radio_stop();
+
+    generation++;
+    channel_index = (channel_index + 1) % sizeof(channels);
+    radio_set_channel(channels[channel_index]);
+    radio_start_receiver();
+
+    if (!scan_continuous)
+        timer_start(window_timer, scan_window, scanner_window_end);
+}
+
+void scanner_init()
+{
+    if (interval_timer < 0)
+    {
+        timer_init();
+        interval_timer = timer_create(TIMER_REPEATED);
+        window_timer = timer_create(TIMER_SINGLESHOT);
+    }
+    scanner_flush_cache();
+}
+
+/**
+ * Forget all advertisers,
+ * so that every one of them is reported again
+ */
+void scanner_flush_cache()
+{
+    memset(cache, 0, sizeof(cache));
+}
+
+/**
+ * Report only the given PDU types (SCANNER_PDU_TYPE(), or SCANNER_PDU_TYPES_ALL),
+ * takes effect with the next scanner_start()
+ */
+void scanner_set_pdu_types(uint16_t types)
+{
+    scan_types = types;
+}
+
+/**
+ * Start scanning
+ *
+ * The callback receives each new or changed advertisement
+ * and has to release the PDU with radio_release_pdu().
+ * The radio must be initialized. Its callbacks are taken over until scanner_stop().
+ */
+bool scanner_start(uint32_t interval_us, uint32_t window_us, radio_receive_callback_t callback)
+{
+    if (interval_timer < 0 || window_timer < 0 || callback == NULL)
+        return false;
+
+    if (interval_us < SCANNER_INTERVAL_MIN || interval_us > SCANNER_INTERVAL_MAX)
+        return false;
+
+    if (window_us < SCANNER_INTERVAL_MIN || window_us > interval_us)
+        return false;
+
+    if (!radio_prepare(channels[0], RADIO_ADVERTISING_ACCESS_ADDRESS, RADIO_ADVERTISING_CRCINIT))
+        return false;
+
+    scan_window = window_us;
+    scan_continuous = (window_us == interval_us);
+    scan_callback = callback;
+    scan_running = true;
+
+    radio_set_callbacks(scanner_received, NULL);
+    if (scan_types != SCANNER_PDU_TYPES_ALL)
+        radio_set_filter(HEADER_BITS, scanner_filter);
+
+    // the first interval starts right away on channel 37
+    channel_index = sizeof(channels) - 1;
+    scanner_interval();
+    timer_start(interval_timer, interval_us, scanner_interval);
+
+    return true;
+}
+
+void scanner_stop()
+{
+    scan_running = false;
+    timer_stop(interval_timer);
+    timer_stop(window_timer);
+    radio_stop();
+    radio_set_callbacks(NULL, NULL);
+    radio_set_filter(0, NULL);
+}
@@ -0,0 +1,50 @@
+/**
+ * Bluetooth Low Energy passive scanner
+ * for the Nordic Semiconductor nRF51 series
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ *
+ * Requires:
+ *      Radio library
+ *      Timer library
+ */
+
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "radio.h"
+#include "timers.h"
+
+/*
+ * Duplicate suppression cache:
+ * number of remembered advertisers (power of two),
+ * number of slots probed per address
+ * and number of scan intervals after which an advertiser is reported again
+ */
+#ifndef SCANNER_CACHE_SIZE
+#define SCANNER_CACHE_SIZE          32
+#endif
+#define SCANNER_CACHE_WAYS          4
+#ifndef SCANNER_CACHE_LIFETIME
+#define SCANNER_CACHE_LIFETIME      32
+#endif
+
+// scanInterval and scanWindow: 2.5 ms up to 10.24 s
+#define SCANNER_INTERVAL_MIN        2500UL
+#define SCANNER_INTERVAL_MAX        TIMER_MILLIS(10240)
+
+// PDU types to report (bit n for type n), see scanner_set_pdu_types()
+#define SCANNER_PDU_TYPE(type)     (1 << (type))
+#define SCANNER_PDU_TYPES_ALL       0xFFFF
+
+void scanner_init();
+bool scanner_start(uint32_t interval_us, uint32_t window_us, radio_receive_callback_t callback);
+void scanner_flush_cache();
+void scanner_set_pdu_types(uint16_t types);
+void scanner_stop();
+
+#endif
@@ -0,0 +1,457 @@
+/**
+ * Bluetooth Low Energy packet sniffer
+ * for the Nordic Semiconductor nRF51 series
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ *
+ * Received packets are framed in the radio interrupt
+ * into a ring buffer, without disabling interrupts.
+ * sniffer_poll() moves the ring buffer's content to the UART
+ * one byte at a time, whenever the transmitter is ready,
+ * so it never blocks.
+ *
+ * sniffer_follow() listens on an advertising channel until a CONNECT_REQ
+ * passes and then follows that connection across the data channels:
+ * SNIFFER_TIMER retunes the receiver shortly before every anchor point,
+ * the hop sequence is taken from hopping.c. The ADDRESS of the first packet
+ * of an event is captured into the timer through PPI and becomes the anchor
+ * point, from which the next hop is scheduled. Channel map and connection
+ * parameter updates by the master are applied at their instant.
+ * When nothing has been received for the supervision timeout, the follower
+ * returns to the advertising channel.
+ */
+
+#include "sniffer.h"
+
+#if SNIFFER_BUFFER_SIZE & (SNIFFER_BUFFER_SIZE - 1)
+#error "SNIFFER_BUFFER_SIZE must be a power of two"
+#endif
+
+/*
+ * Single producer (radio interrupt), single consumer (sniffer_poll()):
+ * each index is only ever written by one side.
+ */
+static uint8_t buffer[SNIFFER_BUFFER_SIZE];
+static volatile uint16_t head = 0;
+static volatile uint16_t tail = 0;
+
+#define buffer_used()       ((uint16_t) (head - tail))
+#define buffer_free()       (SNIFFER_BUFFER_SIZE - buffer_used())
+
+static uint8_t sniffer_channel;
+static uint32_t sniffer_access_address;
+static volatile uint32_t dropped = 0;
+
+// capture/compare registers of SNIFFER_TIMER
+#define CC_HOP              0   // compare: retune for the next event
+#define CC_ADDRESS          1   // capture: ADDRESS of the last packet
+#define CC_NOW              2
+
+#define FOLLOW_OFF          0
+#define FOLLOW_SCANNING     1   // waiting for a CONNECT_REQ
+#define FOLLOW_CONNECTED    2
+
+/*
+ * LLData of a CONNECT_REQ and CtrData of LL control PDUs,
+ * offsets within the PDU (header and length first)
+ * Link Layer specification sections 2.3.3.1 and 2.4.2, Core 4.1
+ */
+#define LLDATA_AA           14
+#define LLDATA_CRCINIT      18
+#define LLDATA_WINOFFSET    22
+#define LLDATA_INTERVAL     24
+#define LLDATA_TIMEOUT      28
+#define LLDATA_CHM          30
+#define LLDATA_HOP          35
+#define CONNECT_REQ_LENGTH  34
+
+#define LL_CONNECTION_UPDATE_REQ    0x00
+#define LL_CHANNEL_MAP_REQ          0x01
+#define CTRDATA_OPCODE              2
+#define CTRDATA_UPDATE_WINOFFSET    4
+#define CTRDATA_UPDATE_INTERVAL     6
+#define CTRDATA_UPDATE_TIMEOUT      10
+#define CTRDATA_UPDATE_INSTANT      12
+#define CTRDATA_UPDATE_LENGTH       12
+#define CTRDATA_CHM                 3
+#define CTRDATA_CHANNEL_MAP_INSTANT 8
+#define CTRDATA_CHANNEL_MAP_LENGTH  8
+
+#define LLID_CONTROL        3
+
+#define le16(p)            ((uint16_t) ((p)[0] | ((p)[1] << 8)))
+#define le32(p)            ((p)[0] | ((p)[1] << 8) | ((p)[2] << 16) | ((uint32_t) (p)[3] << 24))
+
+// at 1 Mbit: preamble and access address before ADDRESS, header to CRC of a CONNECT_REQ after it
+#define ADDRESS_US          40
+#define CONNECT_REQ_US      (8 * (2 + CONNECT_REQ_LENGTH + 3))
+#define WINDOW_DELAY_US     1250
+#define UNIT_US             1250
+#define TIMEOUT_UNIT_US     10000
+#define JITTER_US           16
+
+// masterSCA in ppm
+static const uint16_t master_sca_ppm[8] = {500, 250, 150, 100, 75, 50, 30, 20};
+
+static volatile uint8_t follow = FOLLOW_OFF;
+static uint8_t follow_channel;
+static uint8_t ppi_address;
+
+// timing of the followed connection, all in microseconds
+static uint16_t anchor;             // anchor point of the current event, as received or expected
+static uint32_t interval;
+static uint32_t supervision;
+static uint32_t since_sync;         // from the last received anchor point to the current one
+static uint16_t sca_ppm;
+static uint16_t laps;               // compare matches to skip until the hop
+static bool synced;                 // a packet has been received in the current event
+static bool first_event;
+
+// connection parameter update, pending until its instant
+static bool update_pending;
+static uint16_t update_instant;
+static uint16_t update_winoffset;
+static uint32_t update_interval;
+static uint32_t update_supervision;
+
+/**
+ * Append one frame to the ring buffer
+ */
+static void sniffer_frame(const radio_packet_t *packet)
+{
+    uint8_t frame[SNIFFER_FRAME_MAX];
+    uint8_t pdu_length = 2 + (packet->pdu[1] & 0x3F);
+    uint32_t crc = RADIO_RXCRC;
+    uint8_t i = 0;
+
+    if (pdu_length > RADIO_PDU_MAX)
+        pdu_length = RADIO_PDU_MAX;
+
+    frame[i++] = SNIFFER_FRAME_MAGIC;
+    frame[i++] = SNIFFER_HEADER_LENGTH + pdu_length;
+    frame[i++] = (packet->crc ? SNIFFER_FLAG_CRC_OK : 0)
+               | (packet->timestamped ? SNIFFER_FLAG_TIMESTAMP : 0);
+    frame[i++] = sniffer_channel;
+    frame[i++] = (uint8_t) packet->rssi;
+    for (uint8_t b=0; b<4; b++)
+        frame[i++] = packet->timestamp_address >> (b*8);
+    for (uint8_t b=0; b<4; b++)
+        frame[i++] = sniffer_access_address >> (b*8);
+    for (uint8_t b=0; b<3; b++)
+        frame[i++] = crc >> (b*8);
+    memcpy(&frame[i], packet->pdu, pdu_length);
+    i += pdu_length;
+
+    uint8_t checksum = 0;
+    for (uint8_t b=1; b<i; b++)
+        checksum += frame[b];
+    frame[i++] = checksum;
+
+    // drop whole frames only, so the stream stays in sync
+    if (buffer_free() < i)
+    {
+        dropped++;
+        return;
+    }
+
+    uint16_t h = head;
+    for (uint8_t b=0; b<i; b++)
+        buffer[(h++) & (SNIFFER_BUFFER_SIZE - 1)] = frame[b];
+    head = h;
+}
+
+/**
+ * Retune the receiver at the given offset from the current anchor point,
+ * which lies less than 32 ms back or ahead
+ */
+static void sniffer_schedule(int32_t offset)
+{
+    TIMER_TASK_CAPTURE(SNIFFER_TIMER)[CC_NOW] = 1;
+    uint16_t now = TIMER_CC(SNIFFER_TIMER)[CC_NOW];
+    int32_t delay = offset - (int16_t) (now - anchor);
+
+    if (delay < JITTER_US)
+        delay = JITTER_US;
+
+    laps = (delay - 1) >> 16;
+    TIMER_CC(SNIFFER_TIMER)[CC_HOP] = (uint16_t) (now + delay);
+    TIMER_EVENT_COMPARE(SNIFFER_TIMER)[CC_HOP] = 0;
+    timer_interrupt_upon_compare_enable(SNIFFER_TIMER, CC_HOP);
+}
+
+/**
+ * Schedule the hop to the event after the current one
+ */
+static void sniffer_schedule_next()
+{
+    int32_t widening = ((uint64_t) sca_ppm * (since_sync + interval)) / 1000000 + JITTER_US;
+
+    sniffer_schedule((int32_t) interval - widening - SNIFFER_GUARD_US);
+}
+
+/**
+ * Listen for CONNECT_REQs on the advertising channel
+ */
+static void sniffer_scan()
+{
+    radio_stop();
+    timer_interrupt_upon_compare_disable(SNIFFER_TIMER, CC_HOP);
+
+    radio_prepare(follow_channel, RADIO_ADVERTISING_ACCESS_ADDRESS, RADIO_ADVERTISING_CRCINIT);
+    sniffer_channel = follow_channel;
+    sniffer_access_address = RADIO_ADVERTISING_ACCESS_ADDRESS;
+    follow = FOLLOW_SCANNING;
+
+    radio_start_receiver();
+}
+
+/**
+ * Derive the connection's parameters from a CONNECT_REQ
+ * and schedule the hop to the first data channel
+ */
+static void sniffer_connect(const uint8_t *pdu)
+{
+    uint16_t interval_units = le16(&pdu[LLDATA_INTERVAL]);
+    uint32_t access_address = le32(&pdu[LLDATA_AA]);
+    uint32_t crcinit = pdu[LLDATA_CRCINIT]
+                     | (pdu[LLDATA_CRCINIT + 1] << 8)
+                     | ((uint32_t) pdu[LLDATA_CRCINIT + 2] << 16);
+
+    if (interval_units == 0 || le16(&pdu[LLDATA_TIMEOUT]) == 0
+     || !hopping_init(pdu[LLDATA_HOP] & 0x1F, &pdu[LLDATA_CHM], access_address, crcinit))
+        return;
+
+    interval = interval_units * UNIT_US;
+    supervision = le16(&pdu[LLDATA_TIMEOUT]) * TIMEOUT_UNIT_US;
+    sca_ppm = master_sca_ppm[pdu[LLDATA_HOP] >> 5] + SNIFFER_SCA_PPM;
+    sniffer_access_address = access_address;
+    update_pending = false;
+
+    // the first event is expected at the start of the transmit window
+    since_sync = WINDOW_DELAY_US + le16(&pdu[LLDATA_WINOFFSET]) * UNIT_US;
+    anchor = TIMER_CC(SNIFFER_TIMER)[CC_ADDRESS] + CONNECT_REQ_US + since_sync;
+    first_event = true;
+    follow = FOLLOW_CONNECTED;
+
+    int32_t widening = ((uint64_t) sca_ppm * since_sync) / 1000000 + JITTER_US;
+    sniffer_schedule(-widening - SNIFFER_GUARD_US);
+}
+
+/**
+ * Apply the LL control PDUs, which change the hopping or the timing
+ */
+static void sniffer_control(const uint8_t *pdu)
+{
+    uint8_t length = pdu[1] & 0x1F;
+
+    if (pdu[CTRDATA_OPCODE] == LL_CHANNEL_MAP_REQ && length == CTRDATA_CHANNEL_MAP_LENGTH)
+    {
+        // retransmissions are refused as pending
+        hopping_set_channel_map(&pdu[CTRDATA_CHM], le16(&pdu[CTRDATA_CHANNEL_MAP_INSTANT]));
+    }
+    else if (pdu[CTRDATA_OPCODE] == LL_CONNECTION_UPDATE_REQ && length == CTRDATA_UPDATE_LENGTH
+          && !update_pending)
+    {
+        update_instant     = le16(&pdu[CTRDATA_UPDATE_INSTANT]);
+        update_winoffset   = le16(&pdu[CTRDATA_UPDATE_WINOFFSET]);
+        update_interval    = le16(&pdu[CTRDATA_UPDATE_INTERVAL]) * UNIT_US;
+        update_supervision = le16(&pdu[CTRDATA_UPDATE_TIMEOUT]) * TIMEOUT_UNIT_US;
+        update_pending     = (update_interval > 0) && (update_supervision > 0)
+                          && (uint16_t) (update_instant - hopping_get_event_counter() - 1) < 32767;
+    }
+}
+
+/**
+ * Radio packet callback
+ */
+static void sniffer_received(const radio_packet_t *packet, bool active)
+{
+    (void) active;
+
+    sniffer_frame(packet);
+
+    if (follow == FOLLOW_SCANNING)
+    {
+        if (packet->crc
+         && RADIO_PDU_TYPE(packet->pdu) == RADIO_PDU_TYPE_CONNECT_REQ
+         && (packet->pdu[1] & 0x3F) == CONNECT_REQ_LENGTH)
+            sniffer_connect(packet->pdu);
+    }
+    else if (follow == FOLLOW_CONNECTED)
+    {
+        // the master's packet opens the event
+        if (!synced)
+        {
+            anchor = TIMER_CC(SNIFFER_TIMER)[CC_ADDRESS] - ADDRESS_US;
+            since_sync = 0;
+            synced = true;
+            sniffer_schedule_next();
+        }
+
+        if (packet->crc && (packet->pdu[0] & 0x03) == LLID_CONTROL)
+            sniffer_control(packet->pdu);
+    }
+
+    radio_release_pdu(packet->pdu);
+}
+
+/**
+ * Retune to the data channel of the next event
+ */
+static void sniffer_hop()
+{
+    if (!first_event)
+    {
+        hopping_advance();
+        anchor += interval;
+        since_sync += interval;
+
+        if (update_pending && hopping_get_event_counter() == update_instant)
+        {
+            // the new interval counts from the start of the transmit window
+            update_pending = false;
+            anchor += update_winoffset * UNIT_US;
+            since_sync += update_winoffset * UNIT_US;
+            interval = update_interval;
+            supervision = update_supervision;
+        }
+    }
+    first_event = false;
+
+    if (since_sync > supervision)
+    {
+        sniffer_scan();
+        return;
+    }
+
+    radio_stop();
+    radio_profile_apply(hopping_get_profile());
+    sniffer_channel = hopping_get_channel();
+    synced = false;
+    radio_start_receiver();
+
+    sniffer_schedule_next();
+}
+
+/**
+ * SNIFFER_TIMER interrupt handler
+ *
+ * Included in nrf51_startup.c
+ */
+void SNIFFER_TIMER_Handler()
+{
+    if (!TIMER_EVENT_COMPARE(SNIFFER_TIMER)[CC_HOP])
+        return;
+    TIMER_EVENT_COMPARE(SNIFFER_TIMER)[CC_HOP] = 0;
+
+    if (laps > 0)
+    {
+        laps--;
+        return;
+    }
+
+    timer_interrupt_upon_compare_disable(SNIFFER_TIMER, CC_HOP);
+    if (follow == FOLLOW_CONNECTED)
+        sniffer_hop();
+}
+
+/**
+ * Continuously receive on the given channel
+ *
+ * For timestamps, enable them with radio_timestamps_enable() beforehand.
+ * The radio must be initialized. Its callbacks are taken over until sniffer_stop().
+ */
+bool sniffer_start(uint8_t channel, uint32_t access_address, uint32_t crcinit)
+{
+    if (!radio_prepare(channel, access_address, crcinit))
+        return false;
+
+    sniffer_channel = channel;
+    sniffer_access_address = access_address;
+
+    radio_set_packet_callback(sniffer_received);
+    radio_start_receiver();
+
+    return true;
+}
+
+/**
+ * Listen on the given advertising channel (37-39) until a connection
+ * is established and follow it, then return to the advertising channel
+ *
+ * SNIFFER_TIMER captures the packets' ADDRESS through the given PPI channel.
+ * The radio must be initialized. Its callbacks are taken over until sniffer_stop().
+ */
+bool sniffer_follow(uint8_t channel, uint8_t ppi_channel)
+{
+    if (channel < 37 || channel >= RADIO_CHANNELS
+     || !radio_prepare(channel, RADIO_ADVERTISING_ACCESS_ADDRESS, RADIO_ADVERTISING_CRCINIT))
+        return false;
+
+    TIMER_TASK_STOP(SNIFFER_TIMER)  = 1;
+    TIMER_MODE(SNIFFER_TIMER)       = TIMER_MODE_TIMER;
+    TIMER_BITMODE(SNIFFER_TIMER)    = TIMER_BITMODE_16BIT;
+    TIMER_PRESCALER(SNIFFER_TIMER)  = 4;
+    TIMER_INTENCLR(SNIFFER_TIMER)   = ~0;
+    TIMER_TASK_CLEAR(SNIFFER_TIMER) = 1;
+    interrupt_enable(SNIFFER_TIMER_INTERRUPT);
+
+    ppi_address = ppi_channel;
+    PPI_CH[ppi_address].EEP = (uint32_t) &RADIO_EVENT_ADDRESS;
+    PPI_CH[ppi_address].TEP = (uint32_t) &TIMER_TASK_CAPTURE(SNIFFER_TIMER)[CC_ADDRESS];
+    PPI_CHENSET = (1 << ppi_address);
+
+    TIMER_TASK_START(SNIFFER_TIMER) = 1;
+
+    follow_channel = channel;
+    radio_set_packet_callback(sniffer_received);
+    sniffer_scan();
+
+    return true;
+}
+
+/**
+ * Whether a connection is being followed at the moment
+ */
+bool sniffer_is_following()
+{
+    return follow == FOLLOW_CONNECTED;
+}
+
+/**
+ * Feed the UART from the ring buffer, to be called from the main loop
+ *
+ * Returns immediately, if the UART transmitter is still busy.
+ */
+void sniffer_poll()
+{
+    while (buffer_used() > 0 && UART_EVENT_TXDRDY)
+    {
+        UART_EVENT_TXDRDY = 0;
+        uart_write(buffer[tail & (SNIFFER_BUFFER_SIZE - 1)]);
+        tail++;
+    }
+}
+
+/**
+ * Number of frames, which did not fit into the ring buffer
+ */
+uint32_t sniffer_get_dropped_count()
+{
+    return dropped;
+}
+
+void sniffer_stop()
+{
+    if (follow != FOLLOW_OFF)
+    {
+        follow = FOLLOW_OFF;
+        TIMER_INTENCLR(SNIFFER_TIMER) = ~0;
+        TIMER_TASK_STOP(SNIFFER_TIMER) = 1;
+        PPI_CHENCLR = (1 << ppi_address);
+    }
+
+    radio_stop();
+    radio_set_packet_callback(NULL);
+}
@@ -0,0 +1,98 @@
+/**
+ * Bluetooth Low Energy packet sniffer
+ * for the Nordic Semiconductor nRF51 series
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ *
+ * Requires:
+ *      Radio library
+ *      UART library
+ *      Hopping library, PPI and one TIMER (SNIFFER_TIMER) for sniffer_follow()
+ */
+
+#ifndef SNIFFER_H
+#define SNIFFER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "radio.h"
+#include "hopping.h"
+#include "timers.h"
+#include "ppi.h"
+#include "uart.h"
+
+/*
+ * Capture stream format
+ *
+ * Every received packet is sent as one binary frame, all fields little endian:
+ *
+ *  magic           1 byte      SNIFFER_FRAME_MAGIC
+ *  length          1 byte      number of bytes from flags up to and including the PDU
+ *  flags           1 byte      SNIFFER_FLAG_*
+ *  channel         1 byte      BLE channel index (0-39)
+ *  rssi            1 byte      signed, in dBm
+ *  timestamp       4 bytes     ADDRESS event in us (radio_get_time()),
+ *                              valid with SNIFFER_FLAG_TIMESTAMP
+ *  access address  4 bytes
+ *  crc             3 bytes     as read from RADIO_RXCRC
+ *  pdu             n bytes     header, length, payload
+ *  checksum        1 byte      sum of all bytes from length up to the PDU, modulo 256
+ *
+ * tools/sniffer2pcap converts the stream into a pcap file for Wireshark.
+ */
+#define SNIFFER_FRAME_MAGIC         0xA5
+#define SNIFFER_HEADER_LENGTH       14
+#define SNIFFER_FRAME_MAX          (3 + SNIFFER_HEADER_LENGTH + RADIO_PDU_MAX)
+
+#define SNIFFER_FLAG_CRC_OK         (1 << 0)
+#define SNIFFER_FLAG_TIMESTAMP      (1 << 1)
+
+// frames waiting for the UART, must be a power of two
+#ifndef SNIFFER_BUFFER_SIZE
+#define SNIFFER_BUFFER_SIZE         1024
+#endif
+
+/*
+ * TIMER scheduling the hops of a followed connection, counts microseconds
+ * in 16 bit; must not be shared with the timer library (TIMER0), RADIO_TIMER,
+ * RADIO_LATENCY_TIMER or, in the same firmware, CONNECTION_TIMER
+ * (checked, where both headers are included)
+ */
+#ifndef SNIFFER_TIMER
+#define SNIFFER_TIMER               TIMER2
+#define SNIFFER_TIMER_INTERRUPT     TIMER2_INTERRUPT
+#define SNIFFER_TIMER_Handler       TIMER2_Handler
+#elif !defined(SNIFFER_TIMER_INTERRUPT) || !defined(SNIFFER_TIMER_Handler)
+#error "SNIFFER_TIMER requires SNIFFER_TIMER_INTERRUPT and SNIFFER_TIMER_Handler"
+#endif
+
+#if SNIFFER_TIMER_INTERRUPT == TIMER0_INTERRUPT || SNIFFER_TIMER_INTERRUPT == RADIO_TIMER_INTERRUPT
+#error "SNIFFER_TIMER must not be shared with the timer library or RADIO_TIMER"
+#endif
+#if defined(RADIO_LATENCY_TIMER_INTERRUPT) && SNIFFER_TIMER_INTERRUPT == RADIO_LATENCY_TIMER_INTERRUPT
+#error "SNIFFER_TIMER must not be shared with RADIO_LATENCY_TIMER"
+#endif
+#if defined(CONNECTION_TIMER_INTERRUPT) && SNIFFER_TIMER_INTERRUPT == CONNECTION_TIMER_INTERRUPT
+#error "SNIFFER_TIMER must not be shared with CONNECTION_TIMER"
+#endif
+
+// accuracy of our clock, added to the master's for the window widening
+#ifndef SNIFFER_SCA_PPM
+#define SNIFFER_SCA_PPM             50
+#endif
+
+// the receiver is retuned this long plus the window widening before an anchor point
+#ifndef SNIFFER_GUARD_US
+#define SNIFFER_GUARD_US            250
+#endif
+
+bool sniffer_start(uint8_t channel, uint32_t access_address, uint32_t crcinit);
+bool sniffer_follow(uint8_t channel, uint8_t ppi_channel);
+bool sniffer_is_following();
+void sniffer_poll();
+uint32_t sniffer_get_dropped_count();
+void sniffer_stop();
+
+#endif
@@ -0,0 +1,240 @@
+/**
+ * 2.4 GHz spectrum survey
+ * for the Nordic Semiconductor nRF51 series
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ *
+ * The sweep runs in the radio interrupt: READY triggers the first
+ * RSSI sample on a frequency, every RSSIEND the next one. After the last
+ * sample the following frequency is written and the radio disabled;
+ * the DISABLED_RXEN shortcut ramps it up again right away.
+ * A step therefore takes one receiver ramp-up (130 us) plus the samples,
+ * a sweep across all 84 frequencies about 11 ms.
+ *
+ * In continuous mode completed sweeps are framed into a ring buffer,
+ * which survey_poll() moves to the UART like sniffer_poll().
+ */
+
+#include "survey.h"
+
+#if SURVEY_BUFFER_SIZE & (SURVEY_BUFFER_SIZE - 1)
+#error "SURVEY_BUFFER_SIZE must be a power of two"
+#endif
+
+static survey_result_t *results;
+static survey_result_t sweep[SURVEY_FREQUENCIES];
+static volatile bool running = false;
+static bool continuous;
+static uint8_t sequence = 0;
+
+// the frequency being sampled
+static uint8_t frequency;
+static uint8_t samples;
+static uint8_t sample;
+static int16_t sum;
+static int8_t max;
+
+static uint8_t buffer[SURVEY_BUFFER_SIZE];
+static volatile uint16_t head = 0;
+static volatile uint16_t tail = 0;
+static volatile uint32_t dropped = 0;
+
+#define buffer_used()       ((uint16_t) (head - tail))
+#define buffer_free()       (SURVEY_BUFFER_SIZE - buffer_used())
+
+/**
+ * Append the completed sweep to the ring buffer
+ */
+static void survey_frame()
+{
+    uint8_t frame[SURVEY_FRAME_LENGTH];
+    uint8_t i = 0;
+
+    frame[i++] = SURVEY_FRAME_MAGIC;
+    frame[i++] = SURVEY_HEADER_LENGTH + 2*SURVEY_FREQUENCIES;
+    frame[i++] = sequence;
+    frame[i++] = 0;
+    frame[i++] = SURVEY_FREQUENCIES;
+    for (uint8_t f=0; f<SURVEY_FREQUENCIES; f++)
+    {
+        frame[i++] = (uint8_t) sweep[f].max;
+        frame[i++] = (uint8_t) sweep[f].avg;
+    }
+
+    uint8_t checksum = 0;
+    for (uint8_t b=1; b<i; b++)
+        checksum += frame[b];
+    frame[i++] = checksum;
+
+    // drop whole frames only, so the stream stays in sync
+    if (buffer_free() < i)
+    {
+        dropped++;
+        return;
+    }
+
+    uint16_t h = head;
+    for (uint8_t b=0; b<i; b++)
+        buffer[(h++) & (SURVEY_BUFFER_SIZE - 1)] = frame[b];
+    head = h;
+}
+
+/**
+ * Continue on the given frequency after the ramp-up
+ */
+static void survey_retune(uint8_t f)
+{
+    frequency = f;
+    sample = 0;
+    sum = 0;
+    max = -128;
+
+    // takes effect with the RXEN following DISABLED
+    RADIO_FREQUENCY = f;
+    RADIO_TASK_DISABLE = 1;
+}
+
+/**
+ * Radio interrupt handler, while surveying
+ */
+static void survey_radio_event()
+{
+    if (RADIO_EVENT_READY)
+    {
+        RADIO_EVENT_READY = 0;
+        RADIO_TASK_RSSISTART = 1;
+    }
+
+    if (!RADIO_EVENT_RSSIEND)
+        return;
+    RADIO_EVENT_RSSIEND = 0;
+
+    int8_t rssi = -(int8_t) (RADIO_RSSISAMPLE & 0x7F);
+    sum += rssi;
+    if (rssi > max)
+        max = rssi;
+
+    if (++sample < samples)
+    {
+        RADIO_TASK_RSSISTART = 1;
+        return;
+    }
+
+    results[frequency].max = max;
+    results[frequency].avg = sum / samples;
+
+    if (frequency + 1 < SURVEY_FREQUENCIES)
+    {
+        survey_retune(frequency + 1);
+        return;
+    }
+
+    // sweep complete
+    if (continuous)
+    {
+        survey_frame();
+        sequence++;
+        survey_retune(0);
+    }
+    else
+    {
+        RADIO_SHORTS = 0;
+        RADIO_TASK_DISABLE = 1;
+        running = false;
+    }
+}
+
+static void survey_begin(survey_result_t *r, uint8_t n, bool cont)
+{
+    radio_stop();
+
+    results = r;
+    samples = n;
+    continuous = cont;
+    running = true;
+
+    radio_set_event_handler(survey_radio_event);
+
+    RADIO_EVENT_READY = 0;
+    RADIO_EVENT_RSSIEND = 0;
+    RADIO_SHORTS = RADIO_SHORTCUT_READY_START
+                 | RADIO_SHORTCUT_DISABLED_RXEN;
+    RADIO_INTENSET = RADIO_INTERRUPT_READY
+                   | RADIO_INTERRUPT_RSSIEND;
+
+    frequency = 0;
+    sample = 0;
+    sum = 0;
+    max = -128;
+    RADIO_FREQUENCY = 0;
+    radio_latency_mark();
+    RADIO_TASK_RXEN = 1;
+}
+
+/**
+ * Sweep across all frequencies once and return the maximum and average
+ * of the given number of RSSI samples per frequency in results
+ * (SURVEY_FREQUENCIES entries, indexed by RADIO_FREQUENCY)
+ *
+ * Blocks until the sweep is complete, must not be called from an interrupt.
+ * The radio must be initialized, whatever it was doing is stopped.
+ */
+bool survey_run(survey_result_t *r, uint8_t n)
+{
+    if (r == NULL || n == 0 || running)
+        return false;
+
+    survey_begin(r, n, false);
+
+    while (running)
+        NOP;
+
+    survey_stop();
+
+    return true;
+}
+
+/**
+ * Sweep continuously until survey_stop(),
+ * the results are streamed by survey_poll()
+ */
+bool survey_start(uint8_t n)
+{
+    if (n == 0 || running)
+        return false;
+
+    survey_begin(sweep, n, true);
+
+    return true;
+}
+
+/**
+ * Feed the UART from the ring buffer, to be called from the main loop
+ *
+ * Returns immediately, if the UART transmitter is still busy.
+ */
+void survey_poll()
+{
+    while (buffer_used() > 0 && UART_EVENT_TXDRDY)
+    {
+        UART_EVENT_TXDRDY = 0;
+        uart_write(buffer[tail & (SURVEY_BUFFER_SIZE - 1)]);
+        tail++;
+    }
+}
+
+/**
+ * Number of sweeps, which did not fit into the ring buffer
+ */
+uint32_t survey_get_dropped_count()
+{
+    return dropped;
+}
+
+void survey_stop()
+{
+    running = false;
+    radio_stop();
+    radio_set_event_handler(NULL);
+}
@@ -0,0 +1,62 @@
+/**
+ * 2.4 GHz spectrum survey
+ * for the Nordic Semiconductor nRF51 series
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ *
+ * Requires:
+ *      Radio library
+ *      UART library
+ */
+
+#ifndef SURVEY_H
+#define SURVEY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "radio.h"
+#include "uart.h"
+
+// RADIO_FREQUENCY 0-83, i.e. 2400 MHz up to 2483 MHz
+#define SURVEY_FREQUENCIES          84
+
+/*
+ * Signal strength on one frequency in dBm
+ */
+typedef struct
+{
+    int8_t max;
+    int8_t avg;
+} survey_result_t;
+
+/*
+ * Sweep stream format
+ *
+ * In continuous mode every completed sweep is sent as one binary frame:
+ *
+ *  magic           1 byte      SURVEY_FRAME_MAGIC
+ *  length          1 byte      number of bytes from sequence up to the last result
+ *  sequence        1 byte      incremented with every sweep
+ *  frequency       1 byte      RADIO_FREQUENCY of the first result
+ *  count           1 byte      number of results
+ *  results         2*count     max and avg per frequency, signed, in dBm
+ *  checksum        1 byte      sum of all bytes from length up to the results, modulo 256
+ */
+#define SURVEY_FRAME_MAGIC          0x5A
+#define SURVEY_HEADER_LENGTH        3
+#define SURVEY_FRAME_LENGTH        (3 + SURVEY_HEADER_LENGTH + 2*SURVEY_FREQUENCIES)
+
+// frames waiting for the UART, must be a power of two
+#ifndef SURVEY_BUFFER_SIZE
+#define SURVEY_BUFFER_SIZE          512
+#endif
+
+bool survey_run(survey_result_t *results, uint8_t samples);
+bool survey_start(uint8_t samples);
+void survey_poll();
+uint32_t survey_get_dropped_count();
+void survey_stop();
+
+#endif
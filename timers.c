@@ -52,6 +52,7 @@ typedef struct
 
 static cc_t timer_cc[COUNTERS_PER_TIMER];
 static uint8_t ccs_active = 0;
+static bool initialized = false;
 
 static __inline uint32_t us2ticks(uint64_t us)
 {
@@ -89,8 +90,12 @@ static __inline void set_timer(uint8_t id, uint32_t ticks)
     timer_interrupt_upon_compare_enable(TIMER0, id);
 }
 
-//void TIMER0_Handler()
-void stub()
+/**
+ * TIMER0 interrupt handler
+ *
+ * Included in nrf51_startup.c
+ */
+void TIMER0_Handler()
 {
     uint32_t curr = get_curr_ticks();
     uint8_t id_mask = 0;
@@ -137,9 +142,16 @@ void stub()
 
 /**
  * Initialize and configure TIMER0
+ *
+ * Every module using timers calls this from its init function:
+ * only the first call has an effect, later ones keep the timers
+ * created so far.
  */
 bool timer_init()
 {
+    if (initialized)
+        return 0;
+
     // configure 16MHz crystal frequency
     CLOCK_XTALFREQ = 0xFF;
 
@@ -151,7 +163,7 @@ bool timer_init()
     {
         CLOCK_TASK_HFCLKSTART = 1;
         while (!CLOCK_EVENT_HFCLKSTARTED)
-            asm("nop");
+            NOP;
     }
 
     TIMER_MODE(TIMER0)      = TIMER_MODE_TIMER;
@@ -163,6 +175,7 @@ bool timer_init()
 
     // initialize counters
     memset(timer_cc, 0, sizeof(timer_cc));
+    initialized = true;
 
     return 0;
 }
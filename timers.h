@@ -23,9 +23,11 @@
 #include "clock.h"
 
 // BASE
+#ifndef TIMER0
 #define TIMER0 0x40008000
 #define TIMER1 0x40009000
 #define TIMER2 0x4000A000
+#endif
 
 // Tasks
 #define TIMER_TASK_START(timer)         (*(volatile uint32_t*) (timer+0x000))  // Start Timer
@@ -33,10 +35,10 @@
 #define TIMER_TASK_COUNT(timer)         (*(volatile uint32_t*) (timer+0x008))  // Increment Timer (Counter mode only)
 #define TIMER_TASK_CLEAR(timer)         (*(volatile uint32_t*) (timer+0x00C))  // Clear time
 #define TIMER_TASK_SHUTDOWN(timer)      (*(volatile uint32_t*) (timer+0x010))  // Shut down timer
-#define TIMER_TASK_CAPTURE(timer)      ((volatile uint32_t[4]) {timer+0x040})  // Capture Timer value to CC[0] register
+#define TIMER_TASK_CAPTURE(timer)       ((volatile uint32_t*) (timer+0x040))   // Capture Timer value to CC[n] register
 
 // Events
-#define TIMER_EVENT_COMPARE(timer)     ((volatile uint32_t[4]) {timer+0x140})  // Compare event on CC[0] match
+#define TIMER_EVENT_COMPARE(timer)      ((volatile uint32_t*) (timer+0x140))   // Compare event on CC[n] match
 
 // Registers
 #define TIMER_SHORTCUTS(timer)          (*(volatile uint32_t*) (timer+0x200))  // Shortcut register
@@ -45,7 +47,7 @@
 #define TIMER_MODE(timer)               (*(volatile uint32_t*) (timer+0x504))  // Timer mode selection
 #define TIMER_BITMODE(timer)            (*(volatile uint32_t*) (timer+0x508))  // Configure the number of bits used by the TIMER
 #define TIMER_PRESCALER(timer)          (*(volatile uint32_t*) (timer+0x510))  // Timer prescaler register
-#define TIMER_CC(timer)                ((volatile uint32_t[4]) {timer+0x540})  // Capture/Compare register 0
+#define TIMER_CC(timer)                 ((volatile uint32_t*) (timer+0x540))   // Capture/Compare register n
 
 // Shortcuts
 #define TIMER_SHORTCUT_COMPARE_CLEAR(compare_number)                (1 << compare_number)
@@ -0,0 +1,567 @@
+/**
+ * Flooding time synchronization
+ * for the Nordic Semiconductor nRF51 series
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ *
+ * Follows the Flooding Time Synchronization Protocol (FTSP):
+ * the node with the lowest ID becomes the root, its clock is the global time.
+ * It sends a beacon every period and increments the sequence number,
+ * every synchronized node forwards the latest sequence number with a beacon
+ * of its own, so the global time floods the network hop by hop.
+ * A node estimates offset and skew of its clock against the global time
+ * by linear regression over the latest reference points,
+ * taking only the first reference point of every sequence number.
+ * When the root falls silent, the others take over after TIMESYNC_ROOT_TIMEOUT
+ * periods and continue the global time with their estimates,
+ * until again the lowest ID has prevailed.
+ *
+ * The ADDRESS event of every beacon is captured by PPI
+ * into the radio's microsecond TIMER (radio_timestamps_enable()),
+ * on the sender and on all receivers at the same instant.
+ * As the capture on the sender is taken while the packet is on air,
+ * every beacon carries the global time of the sender's previous beacon
+ * (like the follow-up message of IEEE 1588). A receiver remembers
+ * when it received a neighbour's last beacon, and pairs it with that time.
+ *
+ * The 32 bit microsecond counter of the radio library is extended to 64 bit.
+ */
+
+#include "timesync.h"
+
+#define le16(p)             ((p)[0] | ((p)[1] << 8))
+
+static volatile bool running = false;
+static uint16_t node = TIMESYNC_NODE_NONE;
+static uint32_t period;
+static int8_t period_timer = -1;
+static int8_t backoff_timer = -1;
+
+static uint16_t root = TIMESYNC_NODE_NONE;
+static uint16_t seq;                // latest sequence number of the root
+static uint8_t heartbeats;          // periods since the sequence number advanced
+
+// 64 bit local clock, updated from interrupts only
+static volatile uint32_t clock_epoch = 0;
+static volatile uint32_t clock_last = 0;
+static volatile uint8_t clock_version = 0;
+
+/*
+ * Reference points: local time of a beacon's ADDRESS event
+ * and the offset of the global time to it, oldest first
+ */
+static struct
+{
+    uint64_t local;
+    int64_t  offset;
+} entries[TIMESYNC_ENTRIES];
+static uint8_t entry_count = 0;
+static uint8_t errors = 0;
+static bool point_seq_valid = false;
+static uint16_t point_seq;
+
+/*
+ * Estimate: global = local + offset + skew * (local - anchor),
+ * skew in units of 2^-32; updated from interrupts only
+ */
+static volatile uint8_t estimate_version = 0;
+static uint64_t anchor_local = 0;
+static int64_t anchor_offset = 0;
+static int32_t skew = 0;
+
+// the last beacon received from each neighbour
+static struct
+{
+    uint16_t id;
+    uint16_t seq;
+    uint8_t  count;
+    uint64_t local;
+} neighbors[TIMESYNC_NEIGHBORS];
+
+static uint8_t beacon[2 + TIMESYNC_PDU_LENGTH];
+static uint8_t tx_count = 0;
+static bool tx_valid = false;       // tx_global belongs to beacon tx_count
+static uint64_t tx_global;
+
+/**
+ * Pseudo-random beacon delay from the hardware random number generator
+ */
+static uint32_t timesync_delay()
+{
+    return (rng_get_byte() * TIMESYNC_DELAY_MAX) / 255;
+}
+
+/**
+ * Count the wrap-arounds of the radio's 32 bit microsecond counter
+ */
+static void timesync_clock_update()
+{
+    uint32_t now = radio_get_time();
+
+    if (now < clock_last)
+        clock_epoch++;
+    clock_last = now;
+    clock_version++;
+}
+
+/**
+ * Local time in microseconds, the radio's counter
+ * extended to 64 bit, unaffected by synchronization
+ */
+uint64_t timesync_get_local_time()
+{
+    uint32_t epoch, last, now;
+    uint8_t version;
+
+    // retry, if an interrupt updated the clock meanwhile
+    do
+    {
+        version = clock_version;
+        epoch = clock_epoch;
+        last = clock_last;
+        now = radio_get_time();
+    }
+    while (version != clock_version);
+
+    if (now < last)
+        epoch++;
+
+    return ((uint64_t) epoch << 32) | now;
+}
+
+/**
+ * Extend a timestamp of the radio library (in the past) to 64 bit
+ */
+static uint64_t timesync_extend(uint32_t timestamp)
+{
+    uint64_t now = timesync_get_local_time();
+
+    return now - (uint32_t) ((uint32_t) now - timestamp);
+}
+
+/**
+ * Convert a local time to the global time of the root
+ *
+ * Before the first synchronization the global time is the local time.
+ */
+uint64_t timesync_local_to_global(uint64_t local)
+{
+    uint64_t anchor;
+    int64_t offset;
+    int32_t rate;
+    uint8_t version;
+
+    do
+    {
+        version = estimate_version;
+        anchor = anchor_local;
+        offset = anchor_offset;
+        rate = skew;
+    }
+    while (version != estimate_version);
+
+    int64_t elapsed = (int64_t) (local - anchor);
+
+    return local + offset + ((elapsed * rate) >> 32);
+}
+
+/**
+ * Global time in microseconds
+ */
+uint64_t timesync_get_time()
+{
+    return timesync_local_to_global(timesync_get_local_time());
+}
+
+/**
+ * num / den in units of 2^-32, limited to TIMESYNC_SKEW_MAX ppm
+ *
+ * The Cortex-M0 lacks a 128 bit product,
+ * so the fraction is computed bit by bit.
+ */
+static int32_t timesync_divide(int64_t num, uint64_t den)
+{
+    const uint64_t limit = ((uint64_t) TIMESYNC_SKEW_MAX << 32) / 1000000;
+    uint64_t remainder = (num < 0) ? -num : num;
+    uint64_t quotient = limit;
+
+    if (remainder < den)
+    {
+        quotient = 0;
+        for (uint8_t i=0; i<32; i++)
+        {
+            remainder <<= 1;
+            quotient <<= 1;
+            if (remainder >= den)
+            {
+                remainder -= den;
+                quotient |= 1;
+            }
+        }
+        if (quotient > limit)
+            quotient = limit;
+    }
+
+    return (num < 0) ? -(int32_t) quotient : (int32_t) quotient;
+}
+
+/**
+ * Least squares fit of the offset over the local time
+ *
+ * Times are taken relative to the latest reference point, and
+ * the span of the reference points is limited to TIMESYNC_SPAN_MAX,
+ * so the sums fit into 64 bit.
+ */
+static void timesync_regression()
+{
+    const uint64_t local_ref = entries[entry_count - 1].local;
+    const int64_t offset_ref = entries[entry_count - 1].offset;
+    int64_t sum_x = 0;
+    int64_t sum_y = 0;
+
+    for (uint8_t i=0; i<entry_count; i++)
+    {
+        sum_x += (int32_t) (entries[i].local - local_ref);
+        sum_y += entries[i].offset - offset_ref;
+    }
+
+    int64_t mean_x = sum_x / entry_count;
+    int64_t mean_y = sum_y / entry_count;
+    int64_t num = 0;
+    uint64_t den = 0;
+
+    for (uint8_t i=0; i<entry_count; i++)
+    {
+        int64_t dx = (int32_t) (entries[i].local - local_ref) - mean_x;
+        int64_t dy = entries[i].offset - offset_ref - mean_y;
+        num += dx * dy;
+        den += dx * dx;
+    }
+
+    // a single reference point leaves the skew as it was
+    anchor_local = local_ref + mean_x;
+    anchor_offset = offset_ref + mean_y;
+    if (den > 0)
+        skew = timesync_divide(num, den);
+    estimate_version++;
+}
+
+/**
+ * Forget reference points and neighbours
+ */
+static void timesync_clear()
+{
+    entry_count = 0;
+    errors = 0;
+    point_seq_valid = false;
+    tx_valid = false;
+
+    for (uint8_t i=0; i<TIMESYNC_NEIGHBORS; i++)
+        neighbors[i].id = TIMESYNC_NODE_NONE;
+}
+
+/**
+ * Add a reference point: the ADDRESS of a beacon was received at local time
+ * and sent at global time
+ */
+static void timesync_add_point(uint64_t local, uint64_t global)
+{
+    if (entry_count >= TIMESYNC_ENTRIES_MIN)
+    {
+        int64_t error = (int64_t) (timesync_local_to_global(local) - global);
+
+        if (error > TIMESYNC_ERROR_LIMIT || error < -TIMESYNC_ERROR_LIMIT)
+        {
+            // one outlier is ignored, a series means the estimate is wrong
+            if (++errors <= TIMESYNC_ERRORS_MAX)
+                return;
+            entry_count = 0;
+        }
+    }
+    errors = 0;
+
+    // drop the oldest and those beyond the span
+    while (entry_count > 0
+        && (entry_count == TIMESYNC_ENTRIES || local - entries[0].local > TIMESYNC_SPAN_MAX))
+    {
+        entry_count--;
+        for (uint8_t i=0; i<entry_count; i++)
+            entries[i] = entries[i+1];
+    }
+
+    entries[entry_count].local = local;
+    entries[entry_count].offset = (int64_t) (global - local);
+    entry_count++;
+
+    timesync_regression();
+}
+
+/**
+ * Evaluate a beacon, whose ADDRESS was received at the given local time
+ */
+static void timesync_beacon_received(const uint8_t *pdu, uint64_t local)
+{
+    uint16_t beacon_root = le16(&pdu[TIMESYNC_OFFSET_ROOT]);
+    uint16_t beacon_seq = le16(&pdu[TIMESYNC_OFFSET_SEQ]);
+    uint16_t sender = le16(&pdu[TIMESYNC_OFFSET_SENDER]);
+    uint8_t count = pdu[TIMESYNC_OFFSET_COUNT];
+
+    if (sender == node || beacon_root == TIMESYNC_NODE_NONE)
+        return;
+
+    if (beacon_root < root)
+    {
+        // the lowest ID wins, a root steps down as well;
+        // a new root continues the global time, so the reference points remain valid
+        root = beacon_root;
+        seq = beacon_seq;
+        heartbeats = 0;
+        point_seq_valid = false;
+    }
+    else if (beacon_root != root || root == node)
+    {
+        return;
+    }
+    else if ((int16_t) (beacon_seq - seq) > 0)
+    {
+        seq = beacon_seq;
+        heartbeats = 0;
+    }
+
+    // pair the sender's previous beacon with the time it reports for it
+    uint8_t n;
+    for (n=0; n<TIMESYNC_NEIGHBORS; n++)
+    {
+        if (neighbors[n].id == sender)
+            break;
+    }
+
+    if (n < TIMESYNC_NEIGHBORS)
+    {
+        if ((pdu[TIMESYNC_OFFSET_FLAGS] & TIMESYNC_FLAG_PREVIOUS)
+         && neighbors[n].count == (uint8_t) (count - 1)
+         && (!point_seq_valid || (int16_t) (neighbors[n].seq - point_seq) > 0))
+        {
+            uint64_t previous = 0;
+            for (uint8_t i=0; i<8; i++)
+                previous |= (uint64_t) pdu[TIMESYNC_OFFSET_PREVIOUS + i] << (i * 8);
+
+            point_seq = neighbors[n].seq;
+            point_seq_valid = true;
+            timesync_add_point(neighbors[n].local, previous);
+        }
+    }
+    else
+    {
+        // replace the neighbour with the oldest sequence number, if this one is newer:
+        // the first beacons of a sequence number yield its reference point
+        n = 0;
+        for (uint8_t i=0; i<TIMESYNC_NEIGHBORS; i++)
+        {
+            if (neighbors[i].id == TIMESYNC_NODE_NONE)
+            {
+                n = i;
+                break;
+            }
+            if ((int16_t) (neighbors[i].seq - neighbors[n].seq) < 0)
+                n = i;
+        }
+        if (neighbors[n].id != TIMESYNC_NODE_NONE && (int16_t) (beacon_seq - neighbors[n].seq) <= 0)
+            return;
+        neighbors[n].id = sender;
+    }
+
+    neighbors[n].seq = beacon_seq;
+    neighbors[n].count = count;
+    neighbors[n].local = local;
+}
+
+/**
+ * Radio packet callback
+ */
+static void timesync_received(const radio_packet_t *packet, bool active)
+{
+    (void) active;
+
+    if (packet->crc && packet->pdu[1] == TIMESYNC_PDU_LENGTH)
+        timesync_beacon_received(packet->pdu, timesync_extend(packet->timestamp_address));
+
+    radio_release_pdu(packet->pdu);
+}
+
+/**
+ * Send a beacon, unless a packet is being received
+ */
+static void timesync_transmit()
+{
+    if (!running)
+        return;
+
+    if (radio_is_receiving())
+    {
+        timer_start(backoff_timer, TIMESYNC_BACKOFF + timesync_delay() / 8, timesync_transmit);
+        return;
+    }
+
+    beacon[0] = 0;
+    beacon[1] = TIMESYNC_PDU_LENGTH;
+    beacon[TIMESYNC_OFFSET_ROOT]       = root;
+    beacon[TIMESYNC_OFFSET_ROOT + 1]   = root >> 8;
+    beacon[TIMESYNC_OFFSET_SEQ]        = seq;
+    beacon[TIMESYNC_OFFSET_SEQ + 1]    = seq >> 8;
+    beacon[TIMESYNC_OFFSET_SENDER]     = node;
+    beacon[TIMESYNC_OFFSET_SENDER + 1] = node >> 8;
+    beacon[TIMESYNC_OFFSET_COUNT]      = ++tx_count;
+    beacon[TIMESYNC_OFFSET_FLAGS]      = tx_valid ? TIMESYNC_FLAG_PREVIOUS : 0;
+    for (uint8_t i=0; i<8; i++)
+        beacon[TIMESYNC_OFFSET_PREVIOUS + i] = tx_global >> (i * 8);
+
+    tx_valid = false;
+    radio_stop();
+    radio_send(beacon, 0);
+}
+
+/**
+ * Radio send callback: remember when the beacon went on air
+ * and return to receiving
+ */
+static void timesync_sent(bool active)
+{
+    uint32_t address, end;
+
+    (void) active;
+
+    radio_get_timestamps(&address, &end);
+    tx_global = timesync_local_to_global(timesync_extend(address));
+    tx_valid = true;
+
+    if (running)
+        radio_start_receiver();
+}
+
+/**
+ * Timer callback, once per period
+ */
+static void timesync_period()
+{
+    if (!running)
+        return;
+
+    timesync_clock_update();
+    timer_stop(backoff_timer);
+    timer_start(period_timer, period + timesync_delay(), timesync_period);
+
+    if (root != node && ++heartbeats >= TIMESYNC_ROOT_TIMEOUT)
+    {
+        // no root known or it has fallen silent: take over with the current estimate
+        root = node;
+        heartbeats = 0;
+    }
+
+    if (root == node)
+        seq++;
+
+    // only synchronized nodes forward the time
+    if (timesync_is_synchronized())
+        timesync_transmit();
+}
+
+void timesync_init()
+{
+    if (period_timer < 0)
+    {
+        timer_init();
+        period_timer = timer_create(TIMER_SINGLESHOT);
+        backoff_timer = timer_create(TIMER_SINGLESHOT);
+    }
+
+    rng_init();
+}
+
+/**
+ * Join the network with the given ID and send beacons
+ * every period_us microseconds plus a pseudo-random delay
+ *
+ * The node with the lowest ID becomes the root.
+ * The radio must be initialized. It is taken over until timesync_stop(),
+ * and the given two PPI channels capture its timestamps.
+ */
+bool timesync_start(uint16_t node_id, uint32_t period_us, uint8_t ppi_channel_address, uint8_t ppi_channel_end)
+{
+    if (period_timer < 0 || backoff_timer < 0 || node_id == TIMESYNC_NODE_NONE)
+        return false;
+
+    if (period_us < TIMESYNC_PERIOD_MIN || period_us > TIMESYNC_PERIOD_MAX)
+        return false;
+
+    if (!radio_prepare(TIMESYNC_CHANNEL, TIMESYNC_ACCESS_ADDRESS, TIMESYNC_CRCINIT))
+        return false;
+
+    node = node_id;
+    period = period_us;
+    root = TIMESYNC_NODE_NONE;
+    heartbeats = 0;
+    timesync_clear();
+
+    anchor_local = 0;
+    anchor_offset = 0;
+    skew = 0;
+    estimate_version++;
+
+    radio_timestamps_enable(ppi_channel_address, ppi_channel_end);
+    clock_epoch = 0;
+    clock_last = radio_get_time();
+    clock_version++;
+
+    radio_set_event_handler(NULL);
+    radio_set_callbacks(NULL, timesync_sent);
+    radio_set_packet_callback(timesync_received);
+
+    running = true;
+    radio_start_receiver();
+    if (!timer_start(period_timer, period + timesync_delay(), timesync_period))
+    {
+        timesync_stop();
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Whether the global time is known: this node is the root
+ * or has enough reference points
+ */
+bool timesync_is_synchronized()
+{
+    return (root == node) || (entry_count >= TIMESYNC_ENTRIES_MIN);
+}
+
+/**
+ * ID of the root, TIMESYNC_NODE_NONE if none is known yet
+ */
+uint16_t timesync_get_root()
+{
+    return root;
+}
+
+/**
+ * Estimated rate of the global time relative to the local clock
+ * in parts per billion
+ */
+int32_t timesync_get_skew_ppb()
+{
+    return ((int64_t) skew * 1000000000) >> 32;
+}
+
+void timesync_stop()
+{
+    running = false;
+    timer_stop(period_timer);
+    timer_stop(backoff_timer);
+    radio_stop();
+    radio_set_packet_callback(NULL);
+    radio_set_callbacks(NULL, NULL);
+    radio_timestamps_disable();
+}
@@ -0,0 +1,116 @@
+/**
+ * Flooding time synchronization
+ * for the Nordic Semiconductor nRF51 series
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ *
+ * Requires:
+ *      Radio library
+ *      Timer library
+ *      Random Number Generator (RNG) library
+ */
+
+#ifndef TIMESYNC_H
+#define TIMESYNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "radio.h"
+#include "timers.h"
+#include "random.h"
+
+/*
+ * Channel and address the beacons are exchanged on
+ */
+#ifndef TIMESYNC_CHANNEL
+#define TIMESYNC_CHANNEL            36
+#endif
+
+#ifndef TIMESYNC_ACCESS_ADDRESS
+#define TIMESYNC_ACCESS_ADDRESS     0x5B6D3A29
+#endif
+
+#ifndef TIMESYNC_CRCINIT
+#define TIMESYNC_CRCINIT            0x555555
+#endif
+
+// pseudo-random delay of a beacon, 0-8 ms, so neighbours do not collide
+#define TIMESYNC_DELAY_MAX          TIMER_MILLIS(8)
+
+// beacon interval; together with the delay within the range of timer_start()
+#define TIMESYNC_PERIOD_MIN         TIMER_MILLIS(100)
+#define TIMESYNC_PERIOD_MAX        (TIMER_SECONDS(16) - TIMESYNC_DELAY_MAX)
+
+// retry, after the channel was found busy
+#define TIMESYNC_BACKOFF            1000
+
+// no node may use this ID, no root is known
+#define TIMESYNC_NODE_NONE          0xFFFF
+
+// reference points kept for the regression
+#ifndef TIMESYNC_ENTRIES
+#define TIMESYNC_ENTRIES            8
+#endif
+
+// reference points required to be synchronized and to forward the time
+#ifndef TIMESYNC_ENTRIES_MIN
+#define TIMESYNC_ENTRIES_MIN        3
+#endif
+
+// senders, whose last beacon is remembered
+#ifndef TIMESYNC_NEIGHBORS
+#define TIMESYNC_NEIGHBORS          4
+#endif
+
+// beacon intervals without news from the root, before a node takes over
+#ifndef TIMESYNC_ROOT_TIMEOUT
+#define TIMESYNC_ROOT_TIMEOUT       4
+#endif
+
+// reference points further off the estimate are considered wrong ...
+#ifndef TIMESYNC_ERROR_LIMIT
+#define TIMESYNC_ERROR_LIMIT        1000
+#endif
+
+// ... and this many in a row discard the estimate
+#define TIMESYNC_ERRORS_MAX         3
+
+// the span of the reference points keeps the regression within 64 bit
+#define TIMESYNC_SPAN_MAX           (1UL << 29)
+
+// plausible clock rate difference in ppm, e.g. of two crystals at 50 ppm
+#define TIMESYNC_SKEW_MAX           1000
+
+#if TIMESYNC_ENTRIES_MIN < 1 || TIMESYNC_ENTRIES_MIN > TIMESYNC_ENTRIES
+#error "TIMESYNC_ENTRIES_MIN must be between 1 and TIMESYNC_ENTRIES"
+#endif
+
+/*
+ * Beacon PDU: header and length, followed by
+ * the root's ID and sequence number, the sender's ID, its beacon counter
+ * and the global time of its previous beacon's ADDRESS event (little endian)
+ */
+#define TIMESYNC_PDU_LENGTH         16
+#define TIMESYNC_OFFSET_ROOT        2
+#define TIMESYNC_OFFSET_SEQ         4
+#define TIMESYNC_OFFSET_SENDER      6
+#define TIMESYNC_OFFSET_COUNT       8
+#define TIMESYNC_OFFSET_FLAGS       9
+#define TIMESYNC_OFFSET_PREVIOUS    10
+
+// the time of the previous beacon is included
+#define TIMESYNC_FLAG_PREVIOUS      1
+
+void timesync_init();
+bool timesync_start(uint16_t node_id, uint32_t period_us, uint8_t ppi_channel_address, uint8_t ppi_channel_end);
+void timesync_stop();
+uint64_t timesync_get_local_time();
+uint64_t timesync_local_to_global(uint64_t local);
+uint64_t timesync_get_time();
+bool timesync_is_synchronized();
+uint16_t timesync_get_root();
+int32_t timesync_get_skew_ppb();
+
+#endif
@@ -0,0 +1,238 @@
+/**
+ * Benchmark of the software CRC24 and whitening implementations
+ *
+ * Verifies all variants against a known advertising packet and each other,
+ * and reports their throughput.
+ * Built by "make tools" for the host.
+ * For the nRF51, compile with the firmware toolchain and link with
+ * nrf51_startup.o, uart.o, delay.o, crc24.o and whitening.o:
+ * the results are then printed in CPU cycles per byte via UART.
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "crc24.h"
+#include "whitening.h"
+
+#ifdef __arm__
+
+#include "uart.h"
+#include "timers.h"
+
+// an advertising PDU of maximum length, and a larger block
+#define PDU_LENGTH      39
+#define BLOCK_LENGTH    4096
+#define ROUNDS          4
+
+static void report(const char *name, uint32_t length, uint64_t cycles)
+{
+    char s[16];
+    uint32_t value = (uint32_t) ((cycles * 100) / length);
+    uint8_t i = sizeof(s) - 1;
+    uint8_t digits = 0;
+
+    // two decimal places
+    s[i] = 0;
+    do
+    {
+        if (digits == 2)
+            s[--i] = '.';
+        s[--i] = '0' + (value % 10);
+        value /= 10;
+        digits++;
+    }
+    while (value > 0 || digits < 3);
+
+    uart_send_string((char*) name);
+    uart_send_string(&s[i]);
+    uart_send_string(" cycles/byte\n");
+}
+
+static void clock_start()
+{
+    TIMER_MODE(TIMER0)      = TIMER_MODE_TIMER;
+    TIMER_BITMODE(TIMER0)   = TIMER_BITMODE_32BIT;
+    TIMER_PRESCALER(TIMER0) = 0;
+    TIMER_TASK_CLEAR(TIMER0) = 1;
+    TIMER_TASK_START(TIMER0) = 1;
+}
+
+static uint64_t clock_now()
+{
+    TIMER_TASK_CAPTURE(TIMER0)[0] = 1;
+    return TIMER_CC(TIMER0)[0];
+}
+
+#else
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define PDU_LENGTH      39
+#define BLOCK_LENGTH    (64UL << 20)
+#define ROUNDS          1
+
+static void report(const char *name, uint32_t length, uint64_t nanoseconds)
+{
+    printf("%s%8.1f MB/s\n", name, (double) length * 1000.0 / nanoseconds);
+}
+
+static void clock_start()
+{
+}
+
+static uint64_t clock_now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+#endif
+
+static uint8_t block[BLOCK_LENGTH];
+static uint8_t copy[256];
+
+typedef uint32_t (*crc_function_t)(uint32_t init, const uint8_t *data, uint32_t length);
+typedef void (*whitening_function_t)(uint8_t iv, uint8_t *data, uint32_t length);
+
+static volatile uint32_t sink;
+
+/*
+ * ADV_IND with TxAdd, AdvA A6:A5:A4:A3:A2:A1 and flags 0x06, its CRC
+ * with the advertising CRCINIT, and the packet whitened for channel 37,
+ * worked out bit by bit with the shift registers of the Core specification,
+ * Vol 6, Part B, 3.1.1 and 3.2
+ */
+static const uint8_t known_pdu[] = {
+    0x40, 0x09, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0x02, 0x01, 0x06
+};
+#define KNOWN_CRC       0x075AAE
+static const uint8_t known_crc_air[3] = {0xE0, 0x5A, 0x75};
+#define KNOWN_CHANNEL   37
+static const uint8_t known_whitened[sizeof(known_pdu) + 3] = {
+    0xCD, 0xDB, 0xF6, 0x03, 0x9E, 0x03, 0xC3, 0x16, 0x77, 0x30, 0x17, 0xA8, 0xCC, 0x02
+};
+
+static bool verify_known()
+{
+    uint8_t packet[sizeof(known_whitened)];
+
+    if (crc24_bitwise(CRC24_ADVERTISING_INIT, known_pdu, sizeof(known_pdu)) != KNOWN_CRC
+     || crc24(CRC24_ADVERTISING_INIT, known_pdu, sizeof(known_pdu)) != KNOWN_CRC
+     || crc24_slice4(CRC24_ADVERTISING_INIT, known_pdu, sizeof(known_pdu)) != KNOWN_CRC)
+        return false;
+
+    memcpy(packet, known_pdu, sizeof(known_pdu));
+    crc24_to_air(KNOWN_CRC, &packet[sizeof(known_pdu)]);
+    if (memcmp(&packet[sizeof(known_pdu)], known_crc_air, 3) != 0)
+        return false;
+
+    whitening_apply_bitwise(KNOWN_CHANNEL, packet, sizeof(packet));
+    if (memcmp(packet, known_whitened, sizeof(packet)) != 0)
+        return false;
+
+    // dewhitening
+    whitening_apply(KNOWN_CHANNEL, packet, sizeof(packet));
+    return memcmp(packet, known_pdu, sizeof(known_pdu)) == 0
+        && memcmp(&packet[sizeof(known_pdu)], known_crc_air, 3) == 0;
+}
+
+static void benchmark_crc(const char *name, crc_function_t f, uint32_t length)
+{
+    uint32_t rounds = ROUNDS * (BLOCK_LENGTH / length);
+    uint64_t start = clock_now();
+
+    for (uint32_t i=0; i<rounds; i++)
+        sink = f(CRC24_ADVERTISING_INIT, block, length);
+
+    report(name, rounds * length, clock_now() - start);
+}
+
+static void benchmark_whitening(const char *name, whitening_function_t f, uint32_t length)
+{
+    uint32_t rounds = ROUNDS * (BLOCK_LENGTH / length);
+    uint64_t start = clock_now();
+
+    for (uint32_t i=0; i<rounds; i++)
+        f(37, block, length);
+
+    report(name, rounds * length, clock_now() - start);
+}
+
+static bool verify()
+{
+    if (!verify_known())
+        return false;
+
+    // every length, alignment and whitening start state
+    for (uint32_t length=0; length<64; length++)
+    {
+        for (uint8_t offset=0; offset<4; offset++)
+        {
+            uint32_t a = crc24_bitwise(0x123456, block + offset, length);
+            if (crc24(0x123456, block + offset, length) != a
+             || crc24_slice4(0x123456, block + offset, length) != a)
+                return false;
+        }
+    }
+
+    for (uint8_t iv=0; iv<64; iv++)
+    {
+        memcpy(copy, block, 200);
+        whitening_apply_bitwise(iv, copy, 200);
+        whitening_apply(iv, block, 200);
+        if (memcmp(copy, block, 200) != 0)
+            return false;
+        whitening_apply(iv, block, 200);
+    }
+
+    return true;
+}
+
+int main()
+{
+    uint32_t seed = 1;
+    for (uint32_t i=0; i<BLOCK_LENGTH; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        block[i] = seed >> 16;
+    }
+
+#ifdef __arm__
+    uart_init(1, 2, UART_PIN_DISABLE, UART_PIN_DISABLE, UART_BAUD_115200, false, false);
+    uart_send_string(verify() ? "verified\n" : "MISMATCH\n");
+#else
+    if (!verify())
+    {
+        printf("MISMATCH\n");
+        return 1;
+    }
+    printf("verified\n");
+#endif
+
+    clock_start();
+
+    benchmark_crc(      "crc24_bitwise,   PDU:   ", crc24_bitwise, PDU_LENGTH);
+    benchmark_crc(      "crc24,           PDU:   ", crc24,         PDU_LENGTH);
+    benchmark_crc(      "crc24_slice4,    PDU:   ", crc24_slice4,  PDU_LENGTH);
+    benchmark_crc(      "crc24_bitwise,   block: ", crc24_bitwise, BLOCK_LENGTH);
+    benchmark_crc(      "crc24,           block: ", crc24,         BLOCK_LENGTH);
+    benchmark_crc(      "crc24_slice4,    block: ", crc24_slice4,  BLOCK_LENGTH);
+
+    benchmark_whitening("whitening_bitwise, PDU: ", whitening_apply_bitwise, PDU_LENGTH);
+    benchmark_whitening("whitening,         PDU: ", whitening_apply,         PDU_LENGTH);
+    benchmark_whitening("whitening_bitwise, block:", whitening_apply_bitwise, BLOCK_LENGTH);
+    benchmark_whitening("whitening,         block:", whitening_apply,         BLOCK_LENGTH);
+
+#ifdef __arm__
+    while (1);
+#endif
+    return 0;
+}
@@ -0,0 +1,395 @@
+/**
+ * Host simulation of a BLE connection between the connection library
+ * (slave) and a scripted master
+ *
+ * The firmware side advertises connectable, accepts the CONNECT_REQ and
+ * exchanges numbered data PDUs. The master is emulated on the radio medium
+ * of the peripheral model with a clock running CLOCK_DRIFT_PPM fast;
+ * the script lets it skip events, corrupt packets and lose responses.
+ * All packets on one channel are corrupted, which the slave's channel
+ * assessment is to find; the master then moves the link off that channel
+ * with LL_CHANNEL_MAP_REQ. Finally it sends nothing but corrupted packets,
+ * which must not keep the connection from its supervision timeout.
+ *
+ * Built by "make tools", exits with 0 if all checks passed.
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "advertiser.h"
+#include "connection.h"
+
+#define ACCESS_ADDRESS      0x50654ADEUL
+#define CRCINIT             0x8A3C19UL
+#define INTERVAL            80          // 100 ms, further than the TIMER reaches in one lap
+#define WINOFFSET           2
+#define WINSIZE             3
+#define TIMEOUT             100         // 1 s
+#define HOP                 7
+#define MASTER_SCA          5           // 50 ppm
+#define CLOCK_DRIFT_PPM     40
+
+#define EVENTS              700
+#define EVENTS_CORRUPTED    (TIMEOUT * 8 / INTERVAL + 2)
+#define MESSAGES            40
+
+// the channel assessment, after every channel has been visited often enough
+#define ASSESSMENT          630
+#define INSTANT             (ASSESSMENT + 10)
+#define POLLUTED            9
+
+// script actions per event number
+#define SKIPPED(event)      ((event) >= 20 && (event) < 24)
+#define CORRUPTED(event)    ((event) % 11 == 5 || channel == POLLUTED)
+#define LOST(event)         ((event) % 7 == 3)
+
+// channel map without 3, 4, 5 and 17
+static uint8_t channel_map[5] = {0xC7, 0xFF, 0xFD, 0xFF, 0x1F};
+static uint8_t channel_map_new[5];
+
+static uint8_t adv_ind[] = {
+    RADIO_PDU_TYPE_ADV_IND | RADIO_PDU_TXADD, 9,
+    0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6,
+    2, 1, 6
+};
+
+// the master
+static uint64_t connect_req_end = 0;
+static uint64_t first_anchor;
+static uint8_t last_unmapped = 0;
+static uint8_t channel;
+static uint8_t master_sn = 0;
+static uint8_t master_nesn = 0;
+static int master_sent = 0;         // messages acknowledged by the slave
+static int master_received = 0;     // messages received from the slave
+static bool control_pending = false;
+static bool control_sent = false;   // the LL_CHANNEL_MAP_REQ is on air, not acknowledged
+static bool control_done = false;
+static int event;
+static bool event_more;
+static uint64_t response_end;
+
+// the slave
+static int slave_received = 0;
+static int slave_sent = 0;
+static bool connected = false;
+static uint8_t slave_state = 0xFF;
+static uint64_t lost_at;
+
+// statistics
+static int errors = 0;
+static int64_t turnaround_min = 1000000, turnaround_max = 0;
+static uint64_t packet_end;
+
+#define us(cycles)          ((cycles) / 16)
+
+static uint64_t master_anchor(int event)
+{
+    return first_anchor
+         + NRF51_MODEL_CYCLES((uint64_t) event * INTERVAL * 1250 * (1000000 - CLOCK_DRIFT_PPM) / 1000000);
+}
+
+static uint8_t master_next_channel()
+{
+    uint8_t used[37], count = 0;
+
+    for (uint8_t c=0; c<37; c++)
+        if (channel_map[c >> 3] & (1 << (c & 7)))
+            used[count++] = c;
+
+    last_unmapped = (last_unmapped + HOP) % 37;
+    if (channel_map[last_unmapped >> 3] & (1 << (last_unmapped & 7)))
+        return last_unmapped;
+    return used[last_unmapped % count];
+}
+
+static uint8_t frequency(uint8_t c)
+{
+    return (c < 11) ? 4 + 2*c : 6 + 2*c;
+}
+
+static void master_transmit(uint64_t time, bool corrupt)
+{
+    nrf51_model_packet_t p = {0};
+    bool data = (master_sent < MESSAGES);
+
+    p.time = time;
+    p.frequency = frequency(channel);
+    p.address = ACCESS_ADDRESS;
+    p.rssi = -50;
+    p.crc_ok = !corrupt;
+
+    // an unacknowledged control PDU is sent again, like data
+    control_sent = control_pending;
+    if (control_sent)
+    {
+        p.data[0] = CONNECTION_LLID_CONTROL
+                  | (master_nesn ? CONNECTION_NESN : 0)
+                  | (master_sn ? CONNECTION_SN : 0);
+        p.data[1] = 8;
+        p.data[2] = 0x01;   // LL_CHANNEL_MAP_REQ
+        memcpy(&p.data[3], channel_map_new, 5);
+        p.data[8] = (uint8_t) INSTANT;
+        p.data[9] = (uint8_t) (INSTANT >> 8);
+        p.length = 10;
+        event_more = false;
+        packet_end = time + NRF51_MODEL_CYCLES(8 * (1 + 4 + p.length + 3));
+        nrf51_model_radio_inject(&p);
+        return;
+    }
+
+    p.data[0] = (data ? CONNECTION_LLID_START : CONNECTION_LLID_CONTINUATION)
+              | (master_nesn ? CONNECTION_NESN : 0)
+              | (master_sn ? CONNECTION_SN : 0)
+              | ((data && master_sent + 1 < MESSAGES && master_sent % 4 == 0) ? CONNECTION_MD : 0);
+    p.data[1] = data ? 2 : 0;
+    p.data[2] = 'M';
+    p.data[3] = master_sent;
+    p.length = 2 + p.data[1];
+    event_more = (p.data[0] & CONNECTION_MD) != 0;
+
+    packet_end = time + NRF51_MODEL_CYCLES(8 * (1 + 4 + p.length + 3));
+    nrf51_model_radio_inject(&p);
+}
+
+static void connect_request(uint64_t time)
+{
+    nrf51_model_packet_t p = {0};
+
+    p.time = time;
+    p.frequency = 2;
+    p.address = RADIO_ADVERTISING_ACCESS_ADDRESS;
+    p.rssi = -50;
+    p.crc_ok = true;
+
+    uint8_t *d = p.data;
+    d[0] = RADIO_PDU_TYPE_CONNECT_REQ | RADIO_PDU_RXADD;
+    d[1] = 34;
+    for (uint8_t i=0; i<6; i++)
+    {
+        d[2 + i] = 0x10 + i;
+        d[8 + i] = adv_ind[2 + i];
+    }
+    d[14] = (uint8_t) ACCESS_ADDRESS;
+    d[15] = (uint8_t) (ACCESS_ADDRESS >> 8);
+    d[16] = (uint8_t) (ACCESS_ADDRESS >> 16);
+    d[17] = (uint8_t) (ACCESS_ADDRESS >> 24);
+    d[18] = (uint8_t) CRCINIT;
+    d[19] = (uint8_t) (CRCINIT >> 8);
+    d[20] = (uint8_t) (CRCINIT >> 16);
+    d[21] = WINSIZE;
+    d[22] = WINOFFSET;
+    d[23] = 0;
+    d[24] = (uint8_t) INTERVAL;
+    d[25] = (uint8_t) (INTERVAL >> 8);
+    d[26] = 0;
+    d[27] = 0;
+    d[28] = (uint8_t) TIMEOUT;
+    d[29] = (uint8_t) (TIMEOUT >> 8);
+    memcpy(&d[30], channel_map, 5);
+    d[35] = HOP | (MASTER_SCA << 5);
+    p.length = 36;
+
+    connect_req_end = time + NRF51_MODEL_CYCLES(8 * (1 + 4 + 36 + 3));
+    nrf51_model_radio_inject(&p);
+}
+
+/**
+ * Every packet the slave transmits
+ */
+static void transmitted(const nrf51_model_packet_t *p)
+{
+    uint64_t now = nrf51_model_time();
+
+    if (connect_req_end == 0)
+    {
+        if (RADIO_PDU_TYPE(p->data) == RADIO_PDU_TYPE_ADV_IND && p->frequency == 2)
+            connect_request(now + NRF51_MODEL_CYCLES(150));
+        return;
+    }
+
+    int64_t turnaround = (int64_t) us(p->time - packet_end);
+    if (turnaround < turnaround_min)
+        turnaround_min = turnaround;
+    if (turnaround > turnaround_max)
+        turnaround_max = turnaround;
+
+    if (p->frequency != frequency(channel))
+    {
+        printf("event %d: response on %u MHz instead of %u MHz\n", event, 2400 + p->frequency, 2400 + frequency(channel));
+        errors++;
+    }
+
+    response_end = now;
+    if (LOST(event))
+        return;
+
+    uint8_t header = p->data[0];
+    bool acknowledged = ((header & CONNECTION_NESN) != 0) != master_sn;
+    if (acknowledged)
+    {
+        master_sn ^= 1;
+        if (control_sent)
+        {
+            control_pending = false;
+            control_done = true;
+        }
+        else if (master_sent < MESSAGES)
+            master_sent++;
+    }
+
+    if (((header & CONNECTION_SN) != 0) == master_nesn)
+    {
+        master_nesn ^= 1;
+        if (p->data[1] > 0)
+        {
+            if (p->data[2] != 'S' || p->data[3] != master_received)
+            {
+                printf("event %d: master received S%u, expected S%d\n", event, p->data[3], master_received);
+                errors++;
+            }
+            master_received++;
+        }
+    }
+
+    // continue the event
+    if (event_more || (header & CONNECTION_MD))
+        master_transmit(now + NRF51_MODEL_CYCLES(150), false);
+}
+
+static void slave_receive(const uint8_t *pdu)
+{
+    if (pdu[2] != 'M' || pdu[3] != slave_received)
+    {
+        printf("event %d: slave received M%u, expected M%d\n", event, pdu[3], slave_received);
+        errors++;
+    }
+    slave_received++;
+}
+
+static void slave_state_changed(uint8_t state)
+{
+    slave_state = state;
+    if (state == CONNECTION_CONNECTED)
+        connected = true;
+    else
+        lost_at = nrf51_model_time();
+}
+
+static void slave_connect(const uint8_t *connect_req)
+{
+    if (!connection_start(connect_req))
+    {
+        printf("CONNECT_REQ rejected\n");
+        errors++;
+    }
+}
+
+static void slave_queue()
+{
+    uint8_t pdu[4] = {CONNECTION_LLID_START, 2, 'S', 0};
+
+    while (slave_sent < MESSAGES)
+    {
+        pdu[3] = slave_sent;
+        if (!connection_send(pdu))
+            break;
+        slave_sent++;
+    }
+}
+
+static void discard(uint8_t c)
+{
+    (void) c;
+}
+
+int main()
+{
+    uart_init(1, 2, 0, 0, UART_BAUD_1M, false, false);
+    nrf51_model_uart_set_tx_hook(discard);
+    radio_init();
+    radio_quality_enable();
+    advertiser_init();
+    connection_init(4);
+    connection_set_callbacks(slave_receive, slave_state_changed);
+
+    nrf51_model_radio_set_tx_hook(transmitted);
+    advertiser_set_connect_callback(slave_connect);
+    advertiser_start(adv_ind, TIMER_MILLIS(20));
+
+    // until the CONNECT_REQ is on air
+    for (uint8_t i=0; i<30 && connect_req_end == 0; i++)
+        nrf51_model_run(1000);
+    if (connect_req_end == 0)
+    {
+        printf("no advertising\n");
+        return 1;
+    }
+
+    // the master's first packet in the middle of the transmit window
+    first_anchor = connect_req_end
+                 + NRF51_MODEL_CYCLES(1250 + WINOFFSET*1250 + WINSIZE*1250/2);
+
+    for (event=0; event<EVENTS; event++)
+    {
+        uint64_t anchor = master_anchor(event);
+        if (event == INSTANT)
+            memcpy(channel_map, channel_map_new, 5);
+        channel = master_next_channel();
+        if (event >= INSTANT && channel == POLLUTED)
+        {
+            printf("event %d: still hopping to channel %d\n", event, POLLUTED);
+            errors++;
+        }
+
+        // the slave's assessment is passed to the master
+        if (event == ASSESSMENT)
+        {
+            if (!hopping_assess(channel_map_new))
+                printf("the assessment keeps the channel map\n");
+            printf("assessed channel map %02X %02X %02X %02X %02X\n", channel_map_new[0],
+                channel_map_new[1], channel_map_new[2], channel_map_new[3], channel_map_new[4]);
+            if (memcmp(channel_map_new, (uint8_t[5]) {0xC7, 0xFD, 0xFD, 0xFF, 0x1F}, 5) != 0)
+                errors++;
+            control_pending = true;
+        }
+
+        slave_queue();
+        if (!SKIPPED(event))
+            master_transmit(anchor, CORRUPTED(event));
+        nrf51_model_run_until(anchor + NRF51_MODEL_CYCLES(INTERVAL * 1250 / 2));
+    }
+
+    printf("events %d, missed by the slave %u (%d skipped by the master)\n",
+        EVENTS, (unsigned) connection_get_missed_count(), 4);
+    printf("channel map update %s\n", control_done ? "acknowledged" : "pending");
+
+    // corrupted packets until the supervision timeout
+    uint64_t last_valid = nrf51_model_time();
+    for (; event<EVENTS+EVENTS_CORRUPTED; event++)
+    {
+        uint64_t anchor = master_anchor(event);
+        channel = master_next_channel();
+        master_transmit(anchor, true);
+        nrf51_model_run_until(anchor + NRF51_MODEL_CYCLES(INTERVAL * 1250 / 2));
+    }
+
+    printf("master -> slave: %d of %d messages\n", slave_received, MESSAGES);
+    printf("slave -> master: %d of %d messages\n", master_received, MESSAGES);
+    printf("response T_IFS: %lld - %lld us\n", (long long) turnaround_min, (long long) turnaround_max);
+    printf("connection lost %llu ms after the last valid packet\n", (unsigned long long) us(lost_at - last_valid) / 1000);
+
+    if (!connected || slave_state != CONNECTION_LOST || !control_done)
+        errors++;
+    if (slave_received != MESSAGES || master_received != MESSAGES)
+        errors++;
+    if (turnaround_min < 149 || turnaround_max > 151)
+        errors++;
+
+    printf(errors ? "FAILED\n" : "passed\n");
+    return errors ? 1 : 0;
+}
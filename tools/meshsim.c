@@ -0,0 +1,292 @@
+/**
+ * Host simulation of the managed flooding mesh
+ * on a network of nRF51 nodes
+ *
+ * Every node runs the firmware against an instance of the peripheral model
+ * of its own, in a process of its own. This process is the medium:
+ * it advances all nodes in lockstep and relays every packet, as soon as
+ * it goes on air, to the nodes in range: in a line only the neighbours,
+ * or all of them. A packet has to arrive before its address is complete
+ * (40 us). While no radio is about to transmit, the next transmission
+ * is at least a ramp-up (130 us) ahead, so the nodes may advance further
+ * at a time.
+ *
+ * Node 1 floods a numbered packet every INTERVAL with a TTL reaching
+ * across the line. Every other node has to receive every packet exactly
+ * once. In the full topology all nodes hear each other,
+ * so most relays have to be suppressed.
+ *
+ * Usage: meshsim [nodes [packets [line|all]]]
+ * Built by "make tools", exits with 0 if all packets were delivered.
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "mesh.h"
+
+#define NODES_MAX           16
+#define INTERVAL            TIMER_MILLIS(50)
+#define TTL                 NODES_MAX
+#define DRAIN               TIMER_MILLIS(200)   // after the last packet
+
+// lockstep in microseconds
+#define STEP_IDLE           150         // ramp-up plus part of the address
+#define STEP_TX             20          // less than preamble and address
+
+#define PACKETS_MAX         4
+
+/*
+ * Messages between the medium and the nodes,
+ * sent up to the last packet used
+ */
+typedef struct
+{
+    uint64_t until;                 // run until this time (CPU cycles)
+    uint8_t  stop;
+    uint8_t  send;                  // originate the next packet first
+    uint8_t  packets;               // to be received
+    nrf51_model_packet_t packet[PACKETS_MAX];
+} command_t;
+
+typedef struct
+{
+    mesh_statistics_t statistics;
+    uint32_t delivered;             // in order and with the expected content
+    uint8_t  transmitting;          // radio ramping up for or on air
+    uint8_t  packets;               // went on air
+    nrf51_model_packet_t packet[PACKETS_MAX];
+} report_t;
+
+#define message_length(type, m)     (offsetof(type, packet) + (m)->packets * sizeof(nrf51_model_packet_t))
+
+static struct
+{
+    int socket;
+    command_t command;
+    report_t report;
+} nodes[NODES_MAX];
+
+static uint8_t node_count = 8;
+static bool line = false;
+
+/*
+ * Node side
+ */
+static report_t report;
+static uint32_t next_number = 0;
+
+static void node_on_air(const nrf51_model_packet_t *packet)
+{
+    if (report.packets < PACKETS_MAX)
+        report.packet[report.packets++] = *packet;
+}
+
+static void node_received(uint16_t source, const uint8_t *data, uint8_t length)
+{
+    uint32_t number;
+
+    if (source != 1 || length != sizeof(number))
+        return;
+
+    memcpy(&number, data, sizeof(number));
+    if (number == report.delivered)
+        report.delivered++;
+}
+
+static void node_uart(uint8_t c)
+{
+    (void) c;
+}
+
+static void node_main(int socket, uint16_t id)
+{
+    static command_t command;
+
+    nrf51_model_rng_seed(0x9E3779B9 * id);
+    nrf51_model_uart_set_tx_hook(node_uart);
+    uart_init(1, 2, 0, 0, UART_BAUD_1M, false, false);
+    radio_init();
+    mesh_init();
+    if (!mesh_start(id, node_received))
+    {
+        fprintf(stderr, "node %u: mesh_start() failed\n", id);
+        exit(1);
+    }
+    nrf51_model_radio_set_tx_start_hook(node_on_air);
+
+    while (read(socket, &command, sizeof(command)) > 0 && !command.stop)
+    {
+        for (uint8_t i=0; i<command.packets; i++)
+            nrf51_model_radio_inject(&command.packet[i]);
+
+        if (command.send)
+        {
+            if (mesh_send((const uint8_t*) &next_number, sizeof(next_number), TTL))
+                next_number++;
+            else
+                fprintf(stderr, "node %u: mesh_send() failed\n", id);
+        }
+
+        report.packets = 0;
+        nrf51_model_run_until(command.until);
+
+        report.statistics = *mesh_get_statistics();
+        report.transmitting = RADIO_STATE >= RADIO_STATE_TXRU;
+
+        if (write(socket, &report, message_length(report_t, &report)) < 0)
+            break;
+    }
+
+    exit(0);
+}
+
+/*
+ * Medium side
+ */
+static bool in_range(uint8_t a, uint8_t b)
+{
+    return a != b && (!line || a == b + 1 || b == a + 1);
+}
+
+static void relay(uint8_t from, const nrf51_model_packet_t *packet)
+{
+    for (uint8_t n=0; n<node_count; n++)
+    {
+        if (!in_range(from, n))
+            continue;
+
+        command_t *command = &nodes[n].command;
+        if (command->packets == PACKETS_MAX)
+            continue;
+
+        nrf51_model_packet_t *p = &command->packet[command->packets++];
+        *p = *packet;
+        p->rssi = -60;
+    }
+}
+
+static void stop(uint8_t n)
+{
+    command_t command = {.stop = 1};
+
+    if (write(nodes[n].socket, &command, message_length(command_t, &command)) < 0)
+        perror("write");
+    close(nodes[n].socket);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t packets = 100;
+
+    if (argc > 1)
+        node_count = atoi(argv[1]);
+    if (argc > 2)
+        packets = atoi(argv[2]);
+    if (argc > 3)
+        line = strcmp(argv[3], "all") != 0;
+
+    if (node_count < 2 || node_count > NODES_MAX || packets < 1)
+    {
+        fprintf(stderr, "usage: %s [nodes (2-%u) [packets (1-) [line|all]]]\n", argv[0], NODES_MAX);
+        return 2;
+    }
+
+    for (uint8_t n=0; n<node_count; n++)
+    {
+        int sockets[2];
+
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets) < 0)
+        {
+            perror("socketpair");
+            return 2;
+        }
+
+        fflush(stdout);
+        if (fork() == 0)
+        {
+            close(sockets[0]);
+            node_main(sockets[1], n + 1);
+        }
+        close(sockets[1]);
+        nodes[n].socket = sockets[0];
+    }
+    printf("%u nodes, %s topology, %u packets every %u ms\n",
+        node_count, line ? "line" : "full", packets, (unsigned) (INTERVAL / 1000));
+
+    const uint64_t end = (uint64_t) packets * INTERVAL + DRAIN;
+    uint64_t now = 0;
+    uint64_t next_send = 0;
+    uint32_t sent = 0;
+    bool transmitting = false;
+
+    while (now < end)
+    {
+        now += transmitting ? STEP_TX : STEP_IDLE;
+        transmitting = false;
+
+        if (sent < packets && now >= next_send)
+        {
+            nodes[0].command.send = 1;
+            next_send += INTERVAL;
+            sent++;
+        }
+
+        for (uint8_t n=0; n<node_count; n++)
+        {
+            command_t *command = &nodes[n].command;
+            command->until = NRF51_MODEL_CYCLES(now);
+            if (write(nodes[n].socket, command, message_length(command_t, command)) < 0)
+            {
+                perror("write");
+                return 2;
+            }
+            command->packets = 0;
+            command->send = 0;
+        }
+
+        for (uint8_t n=0; n<node_count; n++)
+        {
+            report_t *r = &nodes[n].report;
+            if (read(nodes[n].socket, r, sizeof(*r)) <= 0)
+            {
+                fprintf(stderr, "node %u has quit\n", n + 1);
+                return 2;
+            }
+            transmitting |= r->transmitting;
+            for (uint8_t i=0; i<r->packets; i++)
+                relay(n, &r->packet[i]);
+        }
+    }
+
+    uint32_t transmissions = 0;
+    uint32_t missing = 0;
+    for (uint8_t n=0; n<node_count; n++)
+    {
+        const mesh_statistics_t *s = &nodes[n].report.statistics;
+
+        printf("node %2u: delivered %4u, duplicates %5u, sent %4u, suppressed %4u, dropped %u\n",
+            n + 1, nodes[n].report.delivered, s->duplicates, s->sent, s->suppressed, s->dropped);
+        transmissions += s->sent;
+        if (n > 0 && (nodes[n].report.delivered != packets || s->received != packets))
+            missing++;
+        stop(n);
+    }
+    while (wait(NULL) > 0);
+
+    printf("%.2f transmissions per packet, %u nodes missed packets\n",
+        (double) transmissions / packets, missing);
+
+    bool passed = missing == 0;
+    printf("%s\n", passed ? "passed" : "FAILED");
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,251 @@
+/**
+ * Converts the binary capture stream of the nRF51 sniffer (see sniffer.h)
+ * into a pcap file with link type LINKTYPE_BLE_LL_WITH_PHDR,
+ * which can be opened with Wireshark.
+ *
+ * Usage:
+ *      sniffer2pcap <capture stream or serial port> <pcap file>
+ *      use - for stdin or stdout respectively
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// must match sniffer.h
+#define SNIFFER_FRAME_MAGIC         0xA5
+#define SNIFFER_HEADER_LENGTH       14
+#define SNIFFER_FLAG_CRC_OK         (1 << 0)
+#define SNIFFER_FLAG_TIMESTAMP      (1 << 1)
+
+#define LINKTYPE_BLE_LL_WITH_PHDR   256
+
+// flags of the BLE LL pseudo header
+#define PHDR_DEWHITENED             0x0001
+#define PHDR_SIGNAL_VALID           0x0002
+#define PHDR_REFERENCE_AA_VALID     0x0010
+#define PHDR_CRC_CHECKED            0x0400
+#define PHDR_CRC_VALID              0x0800
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint8_t reverse_bits(uint8_t b)
+{
+    b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+    b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+    b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+    return b;
+}
+
+/**
+ * BLE channel index -> RF channel (2402 MHz + 2 MHz * RF channel)
+ */
+static uint8_t rf_channel(uint8_t channel)
+{
+    if (channel == 37)
+        return 0;
+    if (channel == 38)
+        return 12;
+    if (channel == 39)
+        return 39;
+    if (channel < 11)
+        return channel + 1;
+    return channel + 2;
+}
+
+static void write_header(FILE *out)
+{
+    uint8_t header[24];
+
+    put32(&header[0], 0xA1B2C3D4);
+    put16(&header[4], 2);
+    put16(&header[6], 4);
+    put32(&header[8], 0);
+    put32(&header[12], 0);
+    put32(&header[16], 65535);
+    put32(&header[20], LINKTYPE_BLE_LL_WITH_PHDR);
+
+    fwrite(header, sizeof(header), 1, out);
+}
+
+/**
+ * Write one record from a frame without magic, length and checksum
+ */
+static void write_record(FILE *out, const uint8_t *frame, uint8_t length, uint64_t timestamp)
+{
+    uint8_t record[16 + 10 + 4 + 255 + 3];
+    uint8_t flags    = frame[0];
+    uint8_t channel  = frame[1];
+    int8_t  rssi     = (int8_t) frame[2];
+    uint32_t aa      = get32(&frame[7]);
+    const uint8_t *crc = &frame[11];
+    const uint8_t *pdu = &frame[SNIFFER_HEADER_LENGTH];
+    uint8_t pdu_length = length - SNIFFER_HEADER_LENGTH;
+    uint32_t packet_length = 10 + 4 + pdu_length + 3;
+    uint8_t *p = &record[16];
+
+    // record header
+    put32(&record[0], timestamp / 1000000);
+    put32(&record[4], timestamp % 1000000);
+    put32(&record[8], packet_length);
+    put32(&record[12], packet_length);
+
+    // pseudo header
+    p[0] = rf_channel(channel);
+    p[1] = (uint8_t) rssi;
+    p[2] = 0;
+    p[3] = 0;
+    put32(&p[4], aa);
+    put16(&p[8], PHDR_DEWHITENED
+               | PHDR_SIGNAL_VALID
+               | PHDR_REFERENCE_AA_VALID
+               | PHDR_CRC_CHECKED
+               | ((flags & SNIFFER_FLAG_CRC_OK) ? PHDR_CRC_VALID : 0));
+    p += 10;
+
+    // link layer packet: access address, PDU, CRC in order of transmission
+    put32(p, aa);
+    p += 4;
+    memcpy(p, pdu, pdu_length);
+    p += pdu_length;
+    p[0] = reverse_bits(crc[2]);
+    p[1] = reverse_bits(crc[1]);
+    p[2] = reverse_bits(crc[0]);
+
+    fwrite(record, 16 + packet_length, 1, out);
+}
+
+/*
+ * Input window: a frame is only consumed once it has been validated,
+ * so that after a corrupt one the search continues right behind its magic byte
+ */
+static uint8_t buffer[2 + 255 + 1];
+static int buffered = 0;
+
+/**
+ * Read until the window holds n bytes, returns false at the end of the input
+ */
+static bool fill(FILE *in, int n)
+{
+    while (buffered < n)
+    {
+        int c = fgetc(in);
+        if (c == EOF)
+            return false;
+        buffer[buffered++] = c;
+    }
+    return true;
+}
+
+/**
+ * Drop the first n bytes of the window
+ */
+static void consume(int n)
+{
+    buffered -= n;
+    memmove(buffer, &buffer[n], buffered);
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *in, *out;
+    uint64_t time = 0;
+    uint32_t last = 0;
+    uint32_t frames = 0, errors = 0;
+
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s <capture stream> <pcap file>\n", argv[0]);
+        return 1;
+    }
+
+    in  = strcmp(argv[1], "-") ? fopen(argv[1], "rb") : stdin;
+    out = strcmp(argv[2], "-") ? fopen(argv[2], "wb") : stdout;
+    if (in == NULL || out == NULL)
+    {
+        perror("sniffer2pcap");
+        return 1;
+    }
+
+    write_header(out);
+
+    while (fill(in, 1))
+    {
+        if (buffer[0] != SNIFFER_FRAME_MAGIC)
+        {
+            consume(1);
+            continue;
+        }
+
+        if (!fill(in, 2))
+            break;
+
+        int length = buffer[1];
+        if (length < SNIFFER_HEADER_LENGTH + 2)
+        {
+            errors++;
+            consume(1);
+            continue;
+        }
+
+        // magic, length, frame fields and checksum;
+        // a corrupt length may claim more bytes than are left
+        if (!fill(in, 2 + length + 1))
+        {
+            consume(1);
+            continue;
+        }
+
+        const uint8_t *frame = &buffer[2];
+        uint8_t checksum = length;
+        for (int i=0; i<length; i++)
+            checksum += frame[i];
+        if (checksum != frame[length])
+        {
+            // the length may be corrupt: resynchronize right behind the magic byte
+            errors++;
+            consume(1);
+            continue;
+        }
+
+        // extend the 32 bit microsecond timestamps
+        if (frame[0] & SNIFFER_FLAG_TIMESTAMP)
+        {
+            uint32_t timestamp = get32(&frame[3]);
+            time += (uint32_t) (timestamp - last);
+            last = timestamp;
+        }
+
+        write_record(out, frame, length, time);
+        frames++;
+        consume(2 + length + 1);
+    }
+
+    fprintf(stderr, "%u frames converted, %u corrupt frames skipped\n", frames, errors);
+
+    if (in != stdin)
+        fclose(in);
+    if (out != stdout)
+        fclose(out);
+
+    return 0;
+}
@@ -0,0 +1,359 @@
+/**
+ * Host simulation of the time synchronization library
+ * on a network of nRF51 nodes
+ *
+ * Every node runs the firmware against an instance of the peripheral model
+ * of its own, in a process of its own. The nodes boot at different times
+ * and their crystals are off by up to CLOCK_DRIFT_PPM.
+ * This process is the medium: it advances all nodes in lockstep
+ * and relays every packet, as soon as it goes on air, to the nodes in range:
+ * in a line only the neighbours, or all of them. A packet has to arrive
+ * before its address is complete (40 us). While no radio is
+ * about to transmit, the next transmission is at least a ramp-up
+ * (130 us) ahead, so the nodes may advance further at a time.
+ *
+ * The root drops out after two thirds of the time, and another node
+ * takes over. Every 100 ms the global times of all nodes are compared,
+ * and once settled, they have to agree within AGREEMENT_US.
+ *
+ * Usage: timesim [nodes [seconds [line|all]]]
+ * Built by "make tools", exits with 0 if the nodes agreed.
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "timesync.h"
+
+#define NODES_MAX           16
+#define PERIOD              TIMER_MILLIS(500)
+#define CLOCK_DRIFT_PPM     40
+#define BOOT_MAX            2000000     // us
+#define AGREEMENT_US        50
+#define SETTLE              15000000    // us, after booting and after the root dropped out
+#define SAMPLE              100000      // us
+#define REPORT              5000000     // us
+
+// lockstep in microseconds of the medium's time
+#define STEP_IDLE           150         // ramp-up plus part of the address
+#define STEP_TX             20          // less than preamble and address
+
+#define PACKETS_MAX         4
+
+/*
+ * Messages between the medium and the nodes,
+ * sent up to the last packet used
+ */
+typedef struct
+{
+    uint64_t until;                 // run until this local time (CPU cycles)
+    uint8_t  stop;
+    uint8_t  packets;               // to be received
+    nrf51_model_packet_t packet[PACKETS_MAX];
+} command_t;
+
+typedef struct
+{
+    uint64_t global;                // us
+    int32_t  skew_ppb;
+    uint16_t root;
+    uint8_t  synchronized;
+    uint8_t  transmitting;          // radio ramping up for or on air
+    uint8_t  packets;               // went on air
+    nrf51_model_packet_t packet[PACKETS_MAX];
+} report_t;
+
+#define message_length(type, m)     (offsetof(type, packet) + (m)->packets * sizeof(nrf51_model_packet_t))
+
+static struct
+{
+    int socket;
+    bool alive;
+    double rate;                    // local clock per medium clock
+    uint64_t boot;                  // us of the medium's time
+    command_t command;
+    report_t report;
+} nodes[NODES_MAX];
+
+static uint8_t node_count = 6;
+static bool line = true;
+
+/*
+ * Node side
+ */
+static report_t report;
+
+static void node_on_air(const nrf51_model_packet_t *packet)
+{
+    if (report.packets < PACKETS_MAX)
+        report.packet[report.packets++] = *packet;
+}
+
+static void node_uart(uint8_t c)
+{
+    (void) c;
+}
+
+static void node_main(int socket, uint16_t id)
+{
+    static command_t command;
+
+    nrf51_model_rng_seed(0x9E3779B9 * id);
+    nrf51_model_uart_set_tx_hook(node_uart);
+    uart_init(1, 2, 0, 0, UART_BAUD_1M, false, false);
+    radio_init();
+    timesync_init();
+    if (!timesync_start(id, PERIOD, 0, 1))
+    {
+        fprintf(stderr, "node %u: timesync_start() failed\n", id);
+        exit(1);
+    }
+    nrf51_model_radio_set_tx_start_hook(node_on_air);
+
+    while (read(socket, &command, sizeof(command)) > 0 && !command.stop)
+    {
+        for (uint8_t i=0; i<command.packets; i++)
+            nrf51_model_radio_inject(&command.packet[i]);
+
+        report.packets = 0;
+        nrf51_model_run_until(command.until);
+
+        report.global = timesync_get_time();
+        report.skew_ppb = timesync_get_skew_ppb();
+        report.root = timesync_get_root();
+        report.synchronized = timesync_is_synchronized();
+        report.transmitting = RADIO_STATE >= RADIO_STATE_TXRU;
+
+        if (write(socket, &report, message_length(report_t, &report)) < 0)
+            break;
+    }
+
+    exit(0);
+}
+
+/*
+ * Medium side
+ */
+static uint64_t local_cycles(uint8_t n, uint64_t us)
+{
+    return (uint64_t) ((us - nodes[n].boot) * nodes[n].rate * NRF51_MODEL_CYCLES(1));
+}
+
+// time of the medium in us, at which node n's clock shows the given cycles
+static double medium_time(uint8_t n, uint64_t cycles)
+{
+    return nodes[n].boot + cycles / (nodes[n].rate * NRF51_MODEL_CYCLES(1));
+}
+
+static bool in_range(uint8_t a, uint8_t b)
+{
+    return a != b && (!line || a == b + 1 || b == a + 1);
+}
+
+static void relay(uint8_t from, const nrf51_model_packet_t *packet)
+{
+    double time = medium_time(from, packet->time);
+
+    for (uint8_t n=0; n<node_count; n++)
+    {
+        if (!in_range(from, n) || !nodes[n].alive || time < nodes[n].boot)
+            continue;
+
+        command_t *command = &nodes[n].command;
+        if (command->packets == PACKETS_MAX)
+            continue;
+
+        nrf51_model_packet_t *p = &command->packet[command->packets++];
+        *p = *packet;
+        p->time = (uint64_t) ((time - nodes[n].boot) * nodes[n].rate * NRF51_MODEL_CYCLES(1));
+        p->rssi = -60;
+    }
+}
+
+static void stop(uint8_t n)
+{
+    command_t command = {.stop = 1};
+
+    if (write(nodes[n].socket, &command, message_length(command_t, &command)) < 0)
+        perror("write");
+    nodes[n].alive = false;
+    close(nodes[n].socket);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t seconds = 60;
+    uint32_t random = 0x2545F491;
+
+    if (argc > 1)
+        node_count = atoi(argv[1]);
+    if (argc > 2)
+        seconds = atoi(argv[2]);
+    if (argc > 3)
+        line = strcmp(argv[3], "all") != 0;
+
+    if (node_count < 2 || node_count > NODES_MAX || seconds < 30)
+    {
+        fprintf(stderr, "usage: %s [nodes (2-%u) [seconds (30-) [line|all]]]\n", argv[0], NODES_MAX);
+        return 2;
+    }
+
+    for (uint8_t n=0; n<node_count; n++)
+    {
+        int sockets[2];
+
+        // xorshift32
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        int32_t ppm = (int32_t) (random % (2 * CLOCK_DRIFT_PPM + 1)) - CLOCK_DRIFT_PPM;
+        nodes[n].rate = 1.0 + ppm / 1e6;
+        nodes[n].boot = (n == 0) ? 0 : random % BOOT_MAX;
+        nodes[n].alive = true;
+        printf("node %u: %+d ppm, boots at %llu ms\n", n + 1, ppm, (unsigned long long) nodes[n].boot / 1000);
+
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets) < 0)
+        {
+            perror("socketpair");
+            return 2;
+        }
+
+        fflush(stdout);
+        if (fork() == 0)
+        {
+            close(sockets[0]);
+            node_main(sockets[1], n + 1);
+        }
+        close(sockets[1]);
+        nodes[n].socket = sockets[0];
+    }
+    printf("%s topology, a beacon every %u ms\n", line ? "line" : "full", (unsigned) (PERIOD / 1000));
+
+    const uint64_t end = (uint64_t) seconds * 1000000;
+    const uint64_t dropout = end * 2 / 3;
+    uint64_t now = 0;
+    uint64_t next_sample = SAMPLE;
+    bool transmitting = false;
+    int64_t worst = 0;
+    int64_t worst_transition = 0;
+    uint32_t samples = 0;
+    uint32_t unsynchronized = 0;
+
+    while (now < end)
+    {
+        now += transmitting ? STEP_TX : STEP_IDLE;
+        transmitting = false;
+
+        for (uint8_t n=0; n<node_count; n++)
+        {
+            if (!nodes[n].alive || now < nodes[n].boot)
+                continue;
+
+            command_t *command = &nodes[n].command;
+            command->until = local_cycles(n, now);
+            if (write(nodes[n].socket, command, message_length(command_t, command)) < 0)
+            {
+                perror("write");
+                return 2;
+            }
+            command->packets = 0;
+        }
+
+        for (uint8_t n=0; n<node_count; n++)
+        {
+            if (!nodes[n].alive || now < nodes[n].boot)
+                continue;
+
+            report_t *r = &nodes[n].report;
+            if (read(nodes[n].socket, r, sizeof(*r)) <= 0)
+            {
+                fprintf(stderr, "node %u has quit\n", n + 1);
+                return 2;
+            }
+            transmitting |= r->transmitting;
+            for (uint8_t i=0; i<r->packets; i++)
+                relay(n, &r->packet[i]);
+        }
+
+        if (now >= dropout && nodes[0].alive)
+        {
+            stop(0);
+            printf("%6.1f s  node 1 (root) drops out\n", now / 1e6);
+        }
+
+        if (now < next_sample)
+            continue;
+        next_sample += SAMPLE;
+
+        // agreement of the global times among the synchronized nodes
+        uint64_t min = UINT64_MAX, max = 0;
+        uint8_t alive = 0, synchronized = 0;
+        for (uint8_t n=0; n<node_count; n++)
+        {
+            if (!nodes[n].alive)
+                continue;
+            alive++;
+            if (now < nodes[n].boot || !nodes[n].report.synchronized)
+                continue;
+            synchronized++;
+            if (nodes[n].report.global < min)
+                min = nodes[n].report.global;
+            if (nodes[n].report.global > max)
+                max = nodes[n].report.global;
+        }
+        int64_t spread = (synchronized > 0) ? (int64_t) (max - min) : 0;
+
+        bool settled = (now >= BOOT_MAX + SETTLE && now < dropout) || now >= dropout + SETTLE;
+        if (settled)
+        {
+            samples++;
+            if (synchronized < alive)
+                unsynchronized++;
+            if (spread > worst)
+                worst = spread;
+        }
+        else if (now >= BOOT_MAX + SETTLE && spread > worst_transition)
+        {
+            worst_transition = spread;
+        }
+
+        if (now % REPORT < SAMPLE)
+        {
+            uint16_t root = TIMESYNC_NODE_NONE;
+            for (uint8_t n=node_count; n>0; n--)
+            {
+                if (nodes[n-1].alive && now >= nodes[n-1].boot)
+                    root = nodes[n-1].report.root;
+            }
+            printf("%6.1f s  synchronized %u/%u, root %u, spread %lld us\n",
+                now / 1e6, synchronized, alive, root, (long long) spread);
+        }
+    }
+
+    for (uint8_t n=0; n<node_count; n++)
+    {
+        if (nodes[n].alive)
+        {
+            printf("node %u: %+.3f ppm to the global time\n", n + 1, nodes[n].report.skew_ppb / 1000.0);
+            stop(n);
+        }
+    }
+    while (wait(NULL) > 0);
+
+    printf("worst spread %lld us over %u samples, %u with unsynchronized nodes\n",
+        (long long) worst, samples, unsynchronized);
+    printf("worst spread %lld us while the root was taken over\n", (long long) worst_transition);
+
+    bool passed = worst <= AGREEMENT_US && unsynchronized == 0 && samples > 0;
+    printf("%s\n", passed ? "passed" : "FAILED");
+
+    return passed ? 0 : 1;
+}
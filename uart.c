@@ -69,7 +69,10 @@ void uart_send_char(char c)
 
     // peripheral switches register to 1, when transmission is complete
     while (UART_EVENT_TXDRDY == 0 && timeout > 0)
+    {
         timeout--;
+        NOP;
+    }
 
     // clear event
     UART_EVENT_TXDRDY = 0;
@@ -94,6 +97,28 @@ void uart_send_string(char* s)
     }
 }
 
+#ifndef UART_USE_FIFO
+/*
+ * Unbuffered counterpart of the FIFO-based uart_send()
+ */
+void uart_send(char* buffer, uint8_t length)
+{
+    uart_send_bytes(buffer, length);
+}
+#endif
+
+/*
+ * Format one byte as two hexadecimal digits,
+ * e.g. for hex dumps via uart_send()
+ */
+void char2hex(char* s, char* c)
+{
+    const char digits[] = "0123456789ABCDEF";
+
+    s[0] = digits[((uint8_t) *c) >> 4];
+    s[1] = digits[((uint8_t) *c) & 0x0F];
+}
+
 void uart_receive_char(char* c)
 {
     /*
@@ -104,7 +129,10 @@ void uart_receive_char(char* c)
 
     // peripheral switches register to 1, when a byte has been received
     while (UART_EVENT_RXDRDY == 0 && timeout > 0)
+    {
         timeout--;
+        NOP;
+    }
 
     // clear event
     // must be cleared before reading
@@ -14,6 +14,7 @@
 #include <stdbool.h>
 #include <string.h>
 
+#include "cortex_m0.h"
 #include "gpio.h"
 #include "delay.h"
 
@@ -25,7 +26,9 @@
  * Registers of the UART peripheral
  */
 
+#ifndef UART_BASE
 #define UART_BASE   0x40002000
+#endif
 
 // Tasks
 #define UART_TASK_STARTRX     (*(volatile uint32_t*) (UART_BASE+0x000))   // Start UART receiver
@@ -154,6 +157,8 @@ void    uart_send_bytes(char* s, uint8_t length);
 void    uart_send_string(char* s);
 void    uart_receive_char(char* c);
 void    uart_receive_line(char* line, uint8_t* length);
+void    uart_send(char* buffer, uint8_t length);
+void    char2hex(char* s, char* c);
 
 /*
  * To use a FIFO buffer,
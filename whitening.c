@@ -0,0 +1,90 @@
+/**
+ * Bluetooth Low Energy data whitening in software
+ * for the Nordic Semiconductor nRF51 series and the host
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ *
+ * The 7 bit LFSR is kept in bits 7..1 of a byte, position 0 of the
+ * Bluetooth specification in bit 1, so the bit reversed DATAWHITEIV
+ * (bit 6 always set) gives its initial state.
+ * whitening_keystream[s] holds the next eight whitening bits
+ * of LFSR state s (bits 7..1 shifted down), whitening_next[s] the state thereafter.
+ */
+
+#include "whitening.h"
+
+static const uint8_t whitening_keystream[128] =
+{
+    0x00, 0x40, 0x20, 0x60, 0x90, 0xD0, 0xB0, 0xF0, 0x48, 0x08, 0x68, 0x28,
+    0xD8, 0x98, 0xF8, 0xB8, 0x24, 0x64, 0x04, 0x44, 0xB4, 0xF4, 0x94, 0xD4,
+    0x6C, 0x2C, 0x4C, 0x0C, 0xFC, 0xBC, 0xDC, 0x9C, 0x92, 0xD2, 0xB2, 0xF2,
+    0x02, 0x42, 0x22, 0x62, 0xDA, 0x9A, 0xFA, 0xBA, 0x4A, 0x0A, 0x6A, 0x2A,
+    0xB6, 0xF6, 0x96, 0xD6, 0x26, 0x66, 0x06, 0x46, 0xFE, 0xBE, 0xDE, 0x9E,
+    0x6E, 0x2E, 0x4E, 0x0E, 0xC9, 0x89, 0xE9, 0xA9, 0x59, 0x19, 0x79, 0x39,
+    0x81, 0xC1, 0xA1, 0xE1, 0x11, 0x51, 0x31, 0x71, 0xED, 0xAD, 0xCD, 0x8D,
+    0x7D, 0x3D, 0x5D, 0x1D, 0xA5, 0xE5, 0x85, 0xC5, 0x35, 0x75, 0x15, 0x55,
+    0x5B, 0x1B, 0x7B, 0x3B, 0xCB, 0x8B, 0xEB, 0xAB, 0x13, 0x53, 0x33, 0x73,
+    0x83, 0xC3, 0xA3, 0xE3, 0x7F, 0x3F, 0x5F, 0x1F, 0xEF, 0xAF, 0xCF, 0x8F,
+    0x37, 0x77, 0x17, 0x57, 0xA7, 0xE7, 0x87, 0xC7
+};
+
+static const uint8_t whitening_next[128] =
+{
+    0x00, 0x22, 0x44, 0x66, 0x19, 0x3B, 0x5D, 0x7F, 0x32, 0x10, 0x76, 0x54,
+    0x2B, 0x09, 0x6F, 0x4D, 0x64, 0x46, 0x20, 0x02, 0x7D, 0x5F, 0x39, 0x1B,
+    0x56, 0x74, 0x12, 0x30, 0x4F, 0x6D, 0x0B, 0x29, 0x59, 0x7B, 0x1D, 0x3F,
+    0x40, 0x62, 0x04, 0x26, 0x6B, 0x49, 0x2F, 0x0D, 0x72, 0x50, 0x36, 0x14,
+    0x3D, 0x1F, 0x79, 0x5B, 0x24, 0x06, 0x60, 0x42, 0x0F, 0x2D, 0x4B, 0x69,
+    0x16, 0x34, 0x52, 0x70, 0x23, 0x01, 0x67, 0x45, 0x3A, 0x18, 0x7E, 0x5C,
+    0x11, 0x33, 0x55, 0x77, 0x08, 0x2A, 0x4C, 0x6E, 0x47, 0x65, 0x03, 0x21,
+    0x5E, 0x7C, 0x1A, 0x38, 0x75, 0x57, 0x31, 0x13, 0x6C, 0x4E, 0x28, 0x0A,
+    0x7A, 0x58, 0x3E, 0x1C, 0x63, 0x41, 0x27, 0x05, 0x48, 0x6A, 0x0C, 0x2E,
+    0x51, 0x73, 0x15, 0x37, 0x1E, 0x3C, 0x5A, 0x78, 0x07, 0x25, 0x43, 0x61,
+    0x2C, 0x0E, 0x68, 0x4A, 0x35, 0x17, 0x71, 0x53
+};
+
+static uint8_t whitening_state(uint8_t iv)
+{
+    uint8_t lfsr = 0;
+
+    // DATAWHITEIV bit 0 corresponds to LFSR position 6
+    iv |= 0x40;
+    for (uint8_t i=0; i<7; i++)
+    {
+        lfsr = (lfsr << 1) | (iv & 1);
+        iv >>= 1;
+    }
+
+    return lfsr;
+}
+
+void whitening_apply_bitwise(uint8_t iv, uint8_t *data, uint32_t length)
+{
+    uint8_t lfsr = whitening_state(iv) << 1;
+
+    while (length--)
+    {
+        for (uint8_t mask=1; mask; mask<<=1)
+        {
+            if (lfsr & 0x80)
+            {
+                lfsr ^= 0x11;
+                *data ^= mask;
+            }
+            lfsr <<= 1;
+        }
+        data++;
+    }
+}
+
+void whitening_apply(uint8_t iv, uint8_t *data, uint32_t length)
+{
+    uint8_t state = whitening_state(iv);
+
+    while (length--)
+    {
+        *data++ ^= whitening_keystream[state];
+        state = whitening_next[state];
+    }
+}
@@ -0,0 +1,29 @@
+/**
+ * Bluetooth Low Energy data whitening in software
+ * for the Nordic Semiconductor nRF51 series and the host
+ *
+ * Author: Matthias Bock <mail@matthiasbock.net>
+ * License: GNU GPLv3
+ *
+ * Applies the same x^7 + x^4 + 1 whitening sequence as the RADIO
+ * with PCNF1.WHITEEN set. The initial value is given like RADIO_DATAWHITEIV,
+ * i.e. the channel index for Bluetooth Low Energy.
+ * Whitening and dewhitening are the same operation.
+ */
+
+#ifndef WHITENING_H
+#define WHITENING_H
+
+#include <stdint.h>
+
+/**
+ * Reference implementation, one bit at a time
+ */
+void whitening_apply_bitwise(uint8_t iv, uint8_t *data, uint32_t length);
+
+/**
+ * One table lookup per byte (256 bytes of tables)
+ */
+void whitening_apply(uint8_t iv, uint8_t *data, uint32_t length);
+
+#endif